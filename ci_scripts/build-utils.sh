@@ -26,6 +26,15 @@ do_bazel_build()
   fi;
 }
 
+do_bazel_test()
+{
+  cd ${DS_TFDIR}
+  eval "export ${BAZEL_ENV_FLAGS}"
+
+  bazel ${BAZEL_OUTPUT_USER_ROOT} test \
+    -s --experimental_strict_action_env --workspace_status_command="bash native_client/bazel_workspace_status_cmd.sh" --config=monolithic -c opt ${BAZEL_BUILD_FLAGS} --test_output=errors ${BAZEL_TEST_TARGETS}
+}
+
 shutdown_bazel()
 {
   cd ${DS_TFDIR}
@@ -15,6 +15,15 @@ BAZEL_TARGETS="
 //native_client:generate_scorer_package
 "
 
+BAZEL_TEST_TARGETS="
+//native_client:ctc_beam_search_decoder_test
+//native_client:decoder_utils_test
+//native_client:dictionary_builder_test
+//native_client:score_cache_test
+//native_client:scorer_package_test
+//native_client:scorer_test
+"
+
 if [ "${runtime}" = "tflite" ]; then
   BAZEL_BUILD_TFLITE="--define=runtime=tflite"
 fi;
@@ -25,4 +34,6 @@ SYSTEM_TARGET=host
 
 do_bazel_build
 
+do_bazel_test
+
 do_deepspeech_binary_build
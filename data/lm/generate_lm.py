@@ -74,13 +74,13 @@ def convert_and_filter_topk(args):
     return data_lower, vocab_str
 
 
-def build_lm(args, data_lower, vocab_str):
-    print("\nCreating ARPA file ...")
-    lm_path = os.path.join(args.output_dir, "lm.arpa")
+def build_lm(args, data_lower, vocab_str, name, order, prune):
+    print("\nCreating ARPA file {}.arpa ...".format(name))
+    lm_path = os.path.join(args.output_dir, "{}.arpa".format(name))
     subargs = [
             os.path.join(args.kenlm_bins, "lmplz"),
             "--order",
-            str(args.arpa_order),
+            str(order),
             "--temp_prefix",
             args.output_dir,
             "--memory",
@@ -90,7 +90,7 @@ def build_lm(args, data_lower, vocab_str):
             "--arpa",
             lm_path,
             "--prune",
-            *args.arpa_prune.split("|"),
+            *prune.split("|"),
         ]
     if args.discount_fallback:
         subargs += ["--discount_fallback"]
@@ -98,7 +98,7 @@ def build_lm(args, data_lower, vocab_str):
 
     # Filter LM using vocabulary of top-k words
     print("\nFiltering ARPA file using vocabulary of top-k words ...")
-    filtered_path = os.path.join(args.output_dir, "lm_filtered.arpa")
+    filtered_path = os.path.join(args.output_dir, "{}_filtered.arpa".format(name))
     subprocess.run(
         [
             os.path.join(args.kenlm_bins, "filter"),
@@ -111,21 +111,24 @@ def build_lm(args, data_lower, vocab_str):
     )
 
     # Quantize and produce trie binary.
-    print("\nBuilding lm.binary ...")
-    binary_path = os.path.join(args.output_dir, "lm.binary")
-    subprocess.check_call(
-        [
-            os.path.join(args.kenlm_bins, "build_binary"),
-            "-a",
-            str(args.binary_a_bits),
-            "-q",
-            str(args.binary_q_bits),
-            "-v",
-            args.binary_type,
-            filtered_path,
-            binary_path,
-        ]
-    )
+    print("\nBuilding {}.binary ...".format(name))
+    binary_path = os.path.join(args.output_dir, "{}.binary".format(name))
+    subargs = [
+        os.path.join(args.kenlm_bins, "build_binary"),
+        "-a",
+        str(args.binary_a_bits),
+        "-q",
+        str(args.binary_q_bits),
+        "-v",
+    ]
+    if args.binary_threads is not None:
+        subargs += ["-j", str(args.binary_threads)]
+    subargs += [args.binary_type, filtered_path, binary_path]
+    subprocess.check_call(subargs)
+
+    # Delete intermediate files
+    os.remove(lm_path)
+    os.remove(filtered_path)
 
 
 def main():
@@ -189,21 +192,39 @@ def main():
         type=str,
         required=True,
     )
+    parser.add_argument(
+        "--binary_threads",
+        help="Number of threads build_binary parses and sorts n-grams with. Requires the build_binary of native_client/kenlm",
+        type=int,
+    )
     parser.add_argument(
         "--discount_fallback",
         help="To try when such message is returned by kenlm: 'Could not calculate Kneser-Ney discounts [...] rerun with --discount_fallback'",
         action="store_true",
     )
+    parser.add_argument(
+        "--first_pass_arpa_order",
+        help="Also build lm_first_pass.binary, a smaller model of this order for the first decoding pass, from the same text and vocabulary. lm.binary is then meant for rescoring",
+        type=int,
+    )
+    parser.add_argument(
+        "--first_pass_arpa_prune",
+        help="ARPA pruning parameters of lm_first_pass.binary, usually more aggressive than --arpa_prune. Separate values with '|'",
+        type=str,
+    )
 
     args = parser.parse_args()
+    if (args.first_pass_arpa_order is None) != (args.first_pass_arpa_prune is None):
+        parser.error("--first_pass_arpa_order and --first_pass_arpa_prune go together")
 
     data_lower, vocab_str = convert_and_filter_topk(args)
-    build_lm(args, data_lower, vocab_str)
+    build_lm(args, data_lower, vocab_str, "lm", args.arpa_order, args.arpa_prune)
+    if args.first_pass_arpa_order is not None:
+        build_lm(args, data_lower, vocab_str, "lm_first_pass",
+                 args.first_pass_arpa_order, args.first_pass_arpa_prune)
 
     # Delete intermediate files
     os.remove(os.path.join(args.output_dir, "lower.txt.gz"))
-    os.remove(os.path.join(args.output_dir, "lm.arpa"))
-    os.remove(os.path.join(args.output_dir, "lm_filtered.arpa"))
 
 
 if __name__ == "__main__":
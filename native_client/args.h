@@ -6,6 +6,7 @@
 #else
 #include <getopt.h>
 #endif
+#include <cstring>
 #include <iostream>
 
 #include "deepspeech.h"
@@ -14,6 +15,12 @@ char* model = NULL;
 
 char* scorer = NULL;
 
+int scorer_load_method = DS_SCORER_LOAD_LAZY;
+
+bool scorer_prefault = false;
+
+bool scorer_huge_pages = false;
+
 char* audio = NULL;
 
 bool set_beamwidth = false;
@@ -42,6 +49,10 @@ int extended_stream_size = 0;
 
 char* hot_words = NULL;
 
+bool fast_log_add = false;
+
+int decoder_threads = 0;
+
 void PrintHelp(const char* bin)
 {
     std::cout <<
@@ -51,6 +62,9 @@ void PrintHelp(const char* bin)
     "\n"
     "\t--model MODEL\t\t\tPath to the model (protocol buffer binary file)\n"
     "\t--scorer SCORER\t\t\tPath to the external scorer file\n"
+    "\t--scorer_load METHOD\t\tHow to load the scorer: lazy (default), populate, read or parallel_read\n"
+    "\t--scorer_prefault\t\tMap the pages of a lazily loaded scorer in the background\n"
+    "\t--scorer_huge_pages\t\tBack the scorer with transparent huge pages\n"
     "\t--audio AUDIO\t\t\tPath to the audio file to run (WAV format)\n"
     "\t--beam_width BEAM_WIDTH\t\tValue for decoder beam width (int)\n"
     "\t--lm_alpha LM_ALPHA\t\tValue for language model alpha param (float)\n"
@@ -62,6 +76,8 @@ void PrintHelp(const char* bin)
     "\t--stream size\t\t\tRun in stream mode, output intermediate results\n"
     "\t--extended_stream size\t\t\tRun in stream mode using metadata output, output intermediate results\n"
     "\t--hot_words\t\t\tHot-words and their boosts. Word:Boost pairs are comma-separated\n"
+    "\t--fast_log_add\t\t\tApproximate the merges of candidate probabilities, faster\n"
+    "\t--decoder_threads N\t\tNumber of threads the language model lookups of a timestep are spread over\n"
     "\t--help\t\t\t\tShow help\n"
     "\t--version\t\t\tPrint version and exits\n";
     char* version = DS_Version();
@@ -84,6 +100,11 @@ bool ProcessArgs(int argc, char** argv)
             {"extended", no_argument, nullptr, 'e'},
             {"json", no_argument, nullptr, 'j'},
             {"candidate_transcripts", required_argument, nullptr, 150},
+            {"scorer_load", required_argument, nullptr, 151},
+            {"scorer_prefault", no_argument, nullptr, 152},
+            {"scorer_huge_pages", no_argument, nullptr, 153},
+            {"fast_log_add", no_argument, nullptr, 154},
+            {"decoder_threads", required_argument, nullptr, 155},
             {"stream", required_argument, nullptr, 's'},
             {"extended_stream", required_argument, nullptr, 'S'},
             {"hot_words", required_argument, nullptr, 'w'},
@@ -144,6 +165,36 @@ bool ProcessArgs(int argc, char** argv)
             json_candidate_transcripts = atoi(optarg);
             break;
 
+        case 151:
+            if (strcmp(optarg, "lazy") == 0) {
+                scorer_load_method = DS_SCORER_LOAD_LAZY;
+            } else if (strcmp(optarg, "populate") == 0) {
+                scorer_load_method = DS_SCORER_LOAD_POPULATE_OR_READ;
+            } else if (strcmp(optarg, "read") == 0) {
+                scorer_load_method = DS_SCORER_LOAD_READ;
+            } else if (strcmp(optarg, "parallel_read") == 0) {
+                scorer_load_method = DS_SCORER_LOAD_PARALLEL_READ;
+            } else {
+                PrintHelp(argv[0]);
+            }
+            break;
+
+        case 152:
+            scorer_prefault = true;
+            break;
+
+        case 153:
+            scorer_huge_pages = true;
+            break;
+
+        case 154:
+            fast_log_add = true;
+            break;
+
+        case 155:
+            decoder_threads = atoi(optarg);
+            break;
+
         case 's':
             stream_size = atoi(optarg);
             break;
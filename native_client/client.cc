@@ -9,6 +9,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <chrono>
 #include <sstream>
 #include <string>
 
@@ -40,6 +41,7 @@
 typedef struct {
   const char* string;
   double cpu_time_overall;
+  double wall_time_overall;
 } ds_result;
 
 struct meta_word {
@@ -165,6 +167,7 @@ LocalDsSTT(ModelState* aCtx, const short* aBuffer, size_t aBufferSize,
   ds_result res = {0};
 
   clock_t ds_start_time = clock();
+  auto ds_start_wall_time = std::chrono::steady_clock::now();
 
   // sphinx-doc: c_ref_inference_start
   if (extended_output) {
@@ -246,6 +249,8 @@ LocalDsSTT(ModelState* aCtx, const short* aBuffer, size_t aBufferSize,
 
   res.cpu_time_overall =
     ((double) (ds_end_infer - ds_start_time)) / CLOCKS_PER_SEC;
+  res.wall_time_overall =
+    std::chrono::duration<double>(std::chrono::steady_clock::now() - ds_start_wall_time).count();
 
   return res;
 }
@@ -424,6 +429,9 @@ ProcessFile(ModelState* context, const char* path, bool show_times)
   if (show_times) {
     printf("cpu_time_overall=%.05f\n",
            result.cpu_time_overall);
+    // includes waiting for disk, the first file shows the cost of a cold scorer
+    printf("wall_time_overall=%.05f\n",
+           result.wall_time_overall);
   }
 }
 
@@ -469,12 +477,38 @@ main(int argc, char **argv)
     }
   }
 
+  if (fast_log_add) {
+    status = DS_SetModelFastLogAdd(ctx, 1);
+    if (status != 0) {
+      fprintf(stderr, "Could not enable fast log add.\n");
+      return 1;
+    }
+  }
+
+  if (decoder_threads > 0) {
+    status = DS_SetModelDecoderThreads(ctx, decoder_threads);
+    if (status != 0) {
+      fprintf(stderr, "Could not set decoder threads.\n");
+      return 1;
+    }
+  }
+
   if (scorer) {
+    status = DS_SetScorerLoadOptions(ctx, scorer_load_method, scorer_prefault, scorer_huge_pages);
+    if (status != 0) {
+      fprintf(stderr, "Could not set scorer load options.\n");
+      return 1;
+    }
+    auto scorer_load_start = std::chrono::steady_clock::now();
     status = DS_EnableExternalScorer(ctx, scorer);
     if (status != 0) {
       fprintf(stderr, "Could not enable external scorer.\n");
       return 1;
     }
+    if (show_times) {
+      printf("scorer_load_time=%.05f\n",
+             std::chrono::duration<double>(std::chrono::steady_clock::now() - scorer_load_start).count());
+    }
     if (set_alphabeta) {
       status = DS_SetScorerAlphaBeta(ctx, lm_alpha, lm_beta);
       if (status != 0) {
@@ -146,7 +146,8 @@ def ctc_beam_search_decoder(probs_seq,
                             cutoff_top_n=40,
                             scorer=None,
                             hot_words=dict(),
-                            num_results=1):
+                            num_results=1,
+                            fast_log_add=False):
     """Wrapper for the CTC Beam Search Decoder.
 
     :param probs_seq: 2-D list of probability distributions over each time
@@ -170,13 +171,16 @@ def ctc_beam_search_decoder(probs_seq,
     :type hot_words: map{string:float}
     :param num_results: Number of beams to return.
     :type num_results: int
+    :param fast_log_add: Merge probabilities with a faster approximation of
+                         the exact formula, default False.
+    :type fast_log_add: bool
     :return: List of tuples of confidence and sentence as decoding
              results, in descending order of the confidence.
     :rtype: list
     """
     beam_results = swigwrapper.ctc_beam_search_decoder(
         probs_seq, alphabet, beam_size, cutoff_prob, cutoff_top_n,
-        scorer, hot_words, num_results)
+        scorer, hot_words, num_results, fast_log_add)
     beam_results = [(res.confidence, alphabet.Decode(res.tokens)) for res in beam_results]
     return beam_results
 
@@ -190,7 +194,8 @@ def ctc_beam_search_decoder_batch(probs_seq,
                                   cutoff_top_n=40,
                                   scorer=None,
                                   hot_words=dict(),
-                                  num_results=1):
+                                  num_results=1,
+                                  fast_log_add=False):
     """Wrapper for the batched CTC beam search decoder.
 
     :param probs_seq: 3-D list with each element as an instance of 2-D list
@@ -218,13 +223,51 @@ def ctc_beam_search_decoder_batch(probs_seq,
     :type hot_words: map{string:float}
     :param num_results: Number of beams to return.
     :type num_results: int
+    :param fast_log_add: Merge probabilities with a faster approximation of
+                         the exact formula, default False.
+    :type fast_log_add: bool
     :return: List of tuples of confidence and sentence as decoding
              results, in descending order of the confidence.
     :rtype: list
     """
-    batch_beam_results = swigwrapper.ctc_beam_search_decoder_batch(probs_seq, seq_lengths, alphabet, beam_size, num_processes, cutoff_prob, cutoff_top_n, scorer, hot_words, num_results)
+    batch_beam_results = swigwrapper.ctc_beam_search_decoder_batch(probs_seq, seq_lengths, alphabet, beam_size, num_processes, cutoff_prob, cutoff_top_n, scorer, hot_words, num_results, fast_log_add)
     batch_beam_results = [
         [(res.confidence, alphabet.Decode(res.tokens)) for res in beam_results]
         for beam_results in batch_beam_results
     ]
     return batch_beam_results
+
+
+class DecoderExecutor(swigwrapper.DecoderExecutor):
+    """Long-lived pool of decoding threads, reusable across batches.
+
+    Prefer this over :func:`ctc_beam_search_decoder_batch` when decoding many
+    batches, it avoids creating threads for every batch and balances long and
+    short utterances across threads.
+
+    :param num_processes: Number of decoding threads.
+    :type num_processes: int
+    """
+    def __init__(self, num_processes):
+        super(DecoderExecutor, self).__init__(num_processes)
+
+    def decode_batch(self,
+                     probs_seq,
+                     seq_lengths,
+                     alphabet,
+                     beam_size,
+                     cutoff_prob=1.0,
+                     cutoff_top_n=40,
+                     scorer=None,
+                     hot_words=dict(),
+                     num_results=1,
+                     fast_log_add=False):
+        """Decode a batch, see :func:`ctc_beam_search_decoder_batch` for the
+        parameters and return value.
+        """
+        batch_beam_results = super(DecoderExecutor, self).decode_batch(probs_seq, seq_lengths, alphabet, beam_size, cutoff_prob, cutoff_top_n, scorer, hot_words, num_results, fast_log_add)
+        batch_beam_results = [
+            [(res.confidence, alphabet.Decode(res.tokens)) for res in beam_results]
+            for beam_results in batch_beam_results
+        ]
+        return batch_beam_results
@@ -0,0 +1,57 @@
+#include "beam_table.h"
+
+#include "decoder_utils.h"
+
+BeamTable::BeamId
+BeamTable::allocate(PathTrie* new_node, unsigned int new_character)
+{
+  BeamId id;
+  if (!free_ids_.empty()) {
+    id = free_ids_.back();
+    free_ids_.pop_back();
+  } else {
+    id = node.size();
+    log_prob_b_prev.push_back(0.f);
+    log_prob_nb_prev.push_back(0.f);
+    log_prob_b_cur.push_back(0.f);
+    log_prob_nb_cur.push_back(0.f);
+    score.push_back(0.f);
+    character.push_back(0);
+    node.push_back(nullptr);
+  }
+
+  reset(id);
+  score[id] = -NUM_FLT_INF;
+  character[id] = new_character;
+  node[id] = new_node;
+  return id;
+}
+
+void
+BeamTable::release(BeamId id)
+{
+  node[id] = nullptr;
+  free_ids_.push_back(id);
+}
+
+void
+BeamTable::reset(BeamId id)
+{
+  log_prob_b_prev[id] = -NUM_FLT_INF;
+  log_prob_nb_prev[id] = -NUM_FLT_INF;
+  log_prob_b_cur[id] = -NUM_FLT_INF;
+  log_prob_nb_cur[id] = -NUM_FLT_INF;
+}
+
+void
+BeamTable::clear()
+{
+  log_prob_b_prev.clear();
+  log_prob_nb_prev.clear();
+  log_prob_b_cur.clear();
+  log_prob_nb_cur.clear();
+  score.clear();
+  character.clear();
+  node.clear();
+  free_ids_.clear();
+}
@@ -0,0 +1,59 @@
+#ifndef BEAM_TABLE_H_
+#define BEAM_TABLE_H_
+
+#include <vector>
+
+class PathTrie;
+
+/* Per-prefix scores of the beam search in structure-of-arrays layout.
+ *
+ * Every PathTrie node owns a beam id that indexes the arrays below, so the
+ * fields read and written on every frame for every beam are stored
+ * contiguously instead of being scattered over the heap allocated nodes,
+ * which keep only the structure of the trie. Ids of removed nodes are
+ * recycled, so the table grows with the number of live nodes only.
+ */
+class BeamTable {
+public:
+  using BeamId = unsigned int;
+
+  BeamTable() = default;
+  ~BeamTable() = default;
+
+  // disallow copying
+  BeamTable(const BeamTable&) = delete;
+  BeamTable& operator=(const BeamTable&) = delete;
+
+  // allocate the scores of a new node, with every log probability at -inf
+  BeamId allocate(PathTrie* node, unsigned int character);
+
+  // give back the id of a deleted node
+  void release(BeamId id);
+
+  // reset the probabilities of a node that is brought back into the beam
+  void reset(BeamId id);
+
+  // drop every id
+  void clear();
+
+  // compare the scores of two beams, ties are broken by character
+  bool better(BeamId x, BeamId y) const {
+    if (score[x] == score[y]) {
+      return character[x] < character[y];
+    }
+    return score[x] > score[y];
+  }
+
+  std::vector<float> log_prob_b_prev;
+  std::vector<float> log_prob_nb_prev;
+  std::vector<float> log_prob_b_cur;
+  std::vector<float> log_prob_nb_cur;
+  std::vector<float> score;
+  std::vector<unsigned int> character;
+  std::vector<PathTrie*> node;
+
+private:
+  std::vector<BeamId> free_ids_;
+};
+
+#endif  // BEAM_TABLE_H_
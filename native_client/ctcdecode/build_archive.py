@@ -44,9 +44,15 @@ KENLM_FILES = [
 
 CTC_DECODER_FILES = [
     'ctc_beam_search_decoder.cpp',
+    'beam_table.cpp',
     'scorer.cpp',
+    'score_cache.cpp',
+    'hot_words.cpp',
+    'lattice.cpp',
     'path_trie.cpp',
     'decoder_utils.cpp',
+    'dense_dictionary.cpp',
+    'dictionary_builder.cpp',
     'workspace_status.cc',
     '../alphabet.cc',
 ]
@@ -1,6 +1,8 @@
 #include "ctc_beam_search_decoder.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <limits>
@@ -13,13 +15,36 @@
 #include "path_trie.h"
 
 
+// Compile hot-words into a trie, null if there are none
+static std::shared_ptr<const HotWordTrie>
+compile_hot_words(const std::unordered_map<std::string, float>& hot_words,
+                  const Alphabet& alphabet)
+{
+  if (hot_words.empty()) {
+    return nullptr;
+  }
+  return std::make_shared<HotWordTrie>(hot_words, alphabet);
+}
+
+int
+DecoderState::init(const Alphabet& alphabet,
+                   size_t beam_size,
+                   double cutoff_prob,
+                   size_t cutoff_top_n,
+                   std::shared_ptr<Scorer> ext_scorer,
+                   const std::unordered_map<std::string, float>& hot_words)
+{
+  return init(alphabet, beam_size, cutoff_prob, cutoff_top_n, ext_scorer,
+              compile_hot_words(hot_words, alphabet));
+}
+
 int
 DecoderState::init(const Alphabet& alphabet,
                    size_t beam_size,
                    double cutoff_prob,
                    size_t cutoff_top_n,
                    std::shared_ptr<Scorer> ext_scorer,
-                   std::unordered_map<std::string, float> hot_words)
+                   std::shared_ptr<const HotWordTrie> hot_words)
 {
   // assign special ids
   abs_time_step_ = 0;
@@ -29,33 +54,171 @@ DecoderState::init(const Alphabet& alphabet,
   beam_size_ = beam_size;
   cutoff_prob_ = cutoff_prob;
   cutoff_top_n_ = cutoff_top_n;
+  min_beam_size_ = beam_size;
+  min_cutoff_top_n_ = cutoff_top_n;
+  deadline_hits_ = 0;
   ext_scorer_ = ext_scorer;
-  hot_words_ = hot_words;
+  alpha_ = ext_scorer ? ext_scorer->alpha : 0.;
+  beta_ = ext_scorer ? ext_scorer->beta : 0.;
+  hot_words_ = (hot_words && hot_words->size() > 0) ? hot_words : nullptr;
   start_expanding_ = false;
+  greedy_ = false;
+  greedy_last_ = blank_id_;
+  greedy_log_prob_ = 0.0;
+  greedy_tokens_.clear();
+  greedy_timesteps_.clear();
 
   // init prefixes' root
+  prefixes_.clear();
+  prefix_root_.reset();
+  beams_.clear();
   PathTrie *root = new PathTrie;
-  root->score = root->log_prob_b_prev = 0.0;
+  root->beam_id = beams_.allocate(root, root->character);
+  beams_.score[root->beam_id] = beams_.log_prob_b_prev[root->beam_id] = 0.0;
   prefix_root_.reset(root);
   prefix_root_->timesteps = &timestep_tree_root_;
-  prefixes_.push_back(root);
+  prefixes_.push_back(root->beam_id);
 
-  if (ext_scorer && (bool)(ext_scorer_->dictionary)) {
-    // no need for std::make_shared<>() since Copy() does 'new' behind the doors
-    auto dict_ptr = std::shared_ptr<PathTrie::FstType>(ext_scorer->dictionary->Copy(true));
-    root->set_dictionary(dict_ptr);
-    auto matcher = std::make_shared<fst::SortedMatcher<PathTrie::FstType>>(*dict_ptr, fst::MATCH_INPUT);
-    root->set_matcher(matcher);
+  // the dictionary is shared with every other decoder of the scorer
+  dictionary_ = PathTrie::Dictionary();
+  dictionary_fst_.reset();
+  dense_dictionary_.reset();
+  lookahead_.reset();
+  if (ext_scorer_ && ext_scorer_->dictionary) {
+    dictionary_fst_ = ext_scorer_->dictionary;
+    dense_dictionary_ = ext_scorer_->dense_dictionary;
+    lookahead_ = ext_scorer_->get_lookahead();
+    dictionary_.fst = dictionary_fst_.get();
+    dictionary_.dense = dense_dictionary_.get();
+    root->set_dictionary_state(dictionary_.fst->Start());
+    if (lookahead_) {
+      dictionary_.lookahead = lookahead_.get();
+      root->lookahead = dictionary_.lookahead[dictionary_.fst->Start()];
+    }
   }
 
   return 0;
 }
 
+void
+DecoderState::set_rescorer(std::shared_ptr<Scorer> rescorer)
+{
+  rescorer_ = rescorer;
+  rescorer_alpha_ = rescorer ? rescorer->alpha : 0.;
+  rescorer_beta_ = rescorer ? rescorer->beta : 0.;
+}
+
+void
+DecoderState::set_scorer_weights(double alpha, double beta)
+{
+  alpha_ = alpha;
+  beta_ = beta;
+}
+
+void
+DecoderState::set_rescorer_weights(double alpha, double beta)
+{
+  rescorer_alpha_ = alpha;
+  rescorer_beta_ = beta;
+}
+
+void
+DecoderState::update_scores()
+{
+  const size_t num_prefixes = prefixes_.size();
+  log_probs_b_.resize(num_prefixes);
+  log_probs_nb_.resize(num_prefixes);
+  scores_.resize(num_prefixes);
+  for (size_t i = 0; i < num_prefixes; ++i) {
+    BeamTable::BeamId id = prefixes_[i];
+    log_probs_b_[i] = beams_.log_prob_b_prev[id] = beams_.log_prob_b_cur[id];
+    log_probs_nb_[i] = beams_.log_prob_nb_prev[id] = beams_.log_prob_nb_cur[id];
+    beams_.log_prob_b_cur[id] = -NUM_FLT_INF;
+    beams_.log_prob_nb_cur[id] = -NUM_FLT_INF;
+  }
+  log_sum_exp_batch(log_probs_b_.data(), log_probs_nb_.data(), scores_.data(),
+                    num_prefixes, fast_log_add_);
+  for (size_t i = 0; i < num_prefixes; ++i) {
+    beams_.score[prefixes_[i]] = scores_[i];
+  }
+}
+
+int
+DecoderState::set_greedy(bool greedy)
+{
+  if (abs_time_step_ != 0) {
+    return 1;
+  }
+  greedy_ = greedy;
+  return 0;
+}
+
+void
+DecoderState::set_beam_threshold(float threshold, size_t max_active)
+{
+  beam_threshold_ = threshold;
+  max_active_ = max_active;
+}
+
+void
+DecoderState::set_beam_size(size_t beam_size)
+{
+  beam_size_ = beam_size;
+  min_beam_size_ = std::min(min_beam_size_, beam_size);
+}
+
+void
+DecoderState::set_cutoff_top_n(size_t cutoff_top_n)
+{
+  cutoff_top_n_ = cutoff_top_n;
+  min_cutoff_top_n_ = std::min(min_cutoff_top_n_, cutoff_top_n);
+}
+
+void
+DecoderState::next_greedy(const double *probs,
+                          int time_dim,
+                          int class_dim)
+{
+  // A single pass over the frames, without any allocation: the branch-free
+  // argmax keeps the inner loop bound by memory bandwidth.
+  for (int t = 0; t < time_dim; ++t, ++abs_time_step_) {
+    const double *prob = &probs[t*class_dim];
+    int best = 0;
+    double best_prob = prob[0];
+    for (int c = 1; c < class_dim; ++c) {
+      bool better = prob[c] > best_prob;
+      best = better ? c : best;
+      best_prob = better ? prob[c] : best_prob;
+    }
+
+    greedy_log_prob_ += std::log(best_prob);
+    if (best != blank_id_ && best != greedy_last_) {
+      greedy_tokens_.push_back(best);
+      greedy_timesteps_.push_back(abs_time_step_);
+    }
+    greedy_last_ = best;
+  }
+}
+
 void
 DecoderState::next(const double *probs,
                    int time_dim,
-                   int class_dim)
+                   int class_dim,
+                   double time_budget)
 {
+  if (greedy_) {
+    next_greedy(probs, time_dim, class_dim);
+    return;
+  }
+
+  // With a time budget, the cost of a frame is assumed proportional to the
+  // number of prefixes it expands, and estimated from the frames done so far
+  typedef std::chrono::steady_clock Clock;
+  const Clock::time_point start = time_budget > 0.0 ? Clock::now() : Clock::time_point();
+  size_t expanded = 0;
+  size_t width_limit = std::numeric_limits<size_t>::max();
+  bool narrowed = false;
+
   // prefix search over time
   for (size_t rel_time_step = 0; rel_time_step < time_dim; ++rel_time_step, ++abs_time_step_) {
     auto *prob = &probs[rel_time_step*class_dim];
@@ -73,198 +236,632 @@ DecoderState::next(const double *probs,
       continue;
     }
 
+    if (time_budget > 0.0 && expanded > 0) {
+      double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+      double frames_left = time_dim - rel_time_step;
+      double affordable = (time_budget - elapsed) / (frames_left * elapsed / expanded);
+      width_limit = static_cast<size_t>(std::max(1.0, std::min(affordable, 1e9)));
+      if (width_limit < std::min(prefixes_.size(), this->max_active())) {
+        narrowed = true;
+      }
+    }
+
+    const size_t max_active = std::min(this->max_active(), width_limit);
+    expanded += std::max<size_t>(1, std::min(prefixes_.size(), max_active));
     float min_cutoff = -NUM_FLT_INF;
     bool full_beam = false;
+    auto beam_compare = [this](BeamTable::BeamId x, BeamTable::BeamId y) {
+      return beams_.better(x, y);
+    };
     if (ext_scorer_) {
-      size_t num_prefixes = std::min(prefixes_.size(), beam_size_);
+      size_t num_prefixes = std::min(prefixes_.size(), max_active);
       std::partial_sort(prefixes_.begin(),
                         prefixes_.begin() + num_prefixes,
                         prefixes_.end(),
-                        prefix_compare);
+                        beam_compare);
 
-      min_cutoff = prefixes_[num_prefixes - 1]->score +
-                   std::log(prob[blank_id_]) - std::max(0.0, ext_scorer_->beta);
-      full_beam = (num_prefixes == beam_size_);
+      min_cutoff = beams_.score[prefixes_[num_prefixes - 1]] +
+                   std::log(prob[blank_id_]) - std::max(0.0, beta_);
+      full_beam = (num_prefixes == max_active);
     }
 
     std::vector<std::pair<size_t, float>> log_prob_idx =
         get_pruned_log_probs(prob, class_dim, cutoff_prob_, cutoff_top_n_);
+
+    // The expansion is done in three passes, so that the language model
+    // scores of the frame are looked up as one batch, which can be spread
+    // over the expansion pool while giving exactly the same result:
+    //  1. walk (class x prefix) in order, creating the new PathTrie nodes and
+    //     recording one update per candidate path,
+    //  2. add the language model and hot-word scores to the extensions,
+    //  3. merge the updates into the beam table in the order of the first pass.
+    updates_.clear();
+
     // loop over class dim
     for (size_t index = 0; index < log_prob_idx.size(); index++) {
-      auto c = log_prob_idx[index].first;
+      const unsigned int c = log_prob_idx[index].first;
       auto log_prob_c = log_prob_idx[index].second;
 
-      for (size_t i = 0; i < prefixes_.size() && i < beam_size_; ++i) {
-        auto prefix = prefixes_[i];
-        if (full_beam && log_prob_c + prefix->score < min_cutoff) {
+      for (size_t i = 0; i < prefixes_.size() && i < max_active; ++i) {
+        BeamTable::BeamId id = prefixes_[i];
+        const float prefix_score = beams_.score[id];
+        if (full_beam && log_prob_c + prefix_score < min_cutoff) {
           break;
         }
-        if (prefix->score == -NUM_FLT_INF) {
+        if (prefix_score == -NUM_FLT_INF) {
           continue;
         }
-        assert(prefix->timesteps != nullptr);
+        const unsigned int prefix_character = beams_.character[id];
 
         // blank
         if (c == blank_id_) {
           // compute probability of current path
-          float log_p = log_prob_c + prefix->score;
-
-          // combine current path with previous ones with the same prefix
-          // the blank label comes last, so we can compare log_prob_nb_cur with log_p
-          if (prefix->log_prob_nb_cur < log_p) {
-            // keep current timesteps
-            prefix->previous_timesteps = nullptr;
-          }
-          prefix->log_prob_b_cur =
-              log_sum_exp(prefix->log_prob_b_cur, log_p);
+          float log_p = log_prob_c + prefix_score;
+          updates_.push_back(BeamUpdate{BeamUpdate::BLANK, id, id, c, log_p, 0.f, log_prob_c});
           continue;
         }
 
         // repeated character
-        if (c == prefix->character) {
+        if (c == prefix_character) {
           // compute probability of current path
-          float log_p = log_prob_c + prefix->log_prob_nb_prev;
-
-          // combine current path with previous ones with the same prefix
-          if (prefix->log_prob_nb_cur < log_p) {
-            // keep current timesteps
-            prefix->previous_timesteps = nullptr;
-          }
-          prefix->log_prob_nb_cur = log_sum_exp(
-              prefix->log_prob_nb_cur, log_p);
+          float log_p = log_prob_c + beams_.log_prob_nb_prev[id];
+          updates_.push_back(BeamUpdate{BeamUpdate::REPEAT, id, id, c, log_p, 0.f, log_prob_c});
         }
 
         // get new prefix
-        auto prefix_new = prefix->get_path_trie(c, log_prob_c);
+        PathTrie* prefix = beams_.node[id];
+        assert(prefix->timesteps != nullptr);
+        auto prefix_new = prefix->get_path_trie(beams_, dictionary_, c, log_prob_c);
 
         if (prefix_new != nullptr) {
           // compute probability of current path
           float log_p = -NUM_FLT_INF;
 
-          if (c == prefix->character &&
-              prefix->log_prob_b_prev > -NUM_FLT_INF) {
-            log_p = log_prob_c + prefix->log_prob_b_prev;
-          } else if (c != prefix->character) {
-            log_p = log_prob_c + prefix->score;
+          if (c == prefix_character &&
+              beams_.log_prob_b_prev[id] > -NUM_FLT_INF) {
+            log_p = log_prob_c + beams_.log_prob_b_prev[id];
+          } else if (c != prefix_character) {
+            log_p = log_prob_c + prefix_score;
           }
 
-          if (ext_scorer_) {
-            // skip scoring the space in word based LMs
-            PathTrie* prefix_to_score;
-            if (ext_scorer_->is_utf8_mode()) {
-              prefix_to_score = prefix_new;
+          // hot-word boosting, a word is credited progressively as it is
+          // spelled and gets its full boost once it is followed by a space
+          float boost = 0.f;
+          if (ext_scorer_ && hot_words_) {
+            if (c == space_id_) {
+              boost = hot_words_->word_boost(prefix->hot_word_state) -
+                      hot_words_->prefix_boost(prefix->hot_word_state);
+              prefix_new->hot_word_state = hot_words_->root();
             } else {
-              prefix_to_score = prefix;
-            }
-
-            // language model scoring
-            if (ext_scorer_->is_scoring_boundary(prefix_to_score, c)) {
-              float score = 0.0;
-              std::vector<std::string> ngram;
-              ngram = ext_scorer_->make_ngram(prefix_to_score);
-
-              float hot_boost = 0.0;
-              if (!hot_words_.empty()) {
-                std::unordered_map<std::string, float>::iterator iter;
-                // increase prob of prefix for every word
-                // that matches a word in the hot-words list
-                for (std::string word : ngram) {
-                  iter = hot_words_.find(word);
-                  if ( iter != hot_words_.end() ) {
-                    // increase the log_cond_prob(prefix|LM)
-                    hot_boost += iter->second;
-                  }
-                }
-              }
-
-              bool bos = ngram.size() < ext_scorer_->get_max_order();
-              score = ( ext_scorer_->get_log_cond_prob(ngram, bos) + hot_boost ) * ext_scorer_->alpha;
-              log_p += score;
-              log_p += ext_scorer_->beta;
+              prefix_new->hot_word_state = hot_words_->next(prefix->hot_word_state, c);
+              boost = hot_words_->prefix_boost(prefix_new->hot_word_state) -
+                      hot_words_->prefix_boost(prefix->hot_word_state);
             }
           }
 
-          // combine current path with previous ones with the same prefix
-          if (prefix_new->log_prob_nb_cur < log_p) {
-            // record data needed to update timesteps
-            // the actual update will be done if nothing better is found
-            prefix_new->previous_timesteps = prefix->timesteps;
-            prefix_new->new_timestep = abs_time_step_;
+          // LM look-ahead, a partial word is scored with the best unigram
+          // that can complete it, and the actual LM score replaces it once
+          // the word is complete. Every prefix carries exactly one such
+          // estimate, so prefixes at different points of a word compare fairly.
+          if (dictionary_.lookahead) {
+            boost += prefix_new->lookahead - prefix->lookahead;
           }
-          prefix_new->log_prob_nb_cur =
-              log_sum_exp(prefix_new->log_prob_nb_cur, log_p);
+
+          updates_.push_back(BeamUpdate{BeamUpdate::EXTEND, id, prefix_new->beam_id, c, log_p, boost, log_prob_c});
         }
       }  // end of loop over prefix
     }    // end of loop over alphabet
 
+    if (ext_scorer_) {
+      score_extensions();
+    }
+
+    for (const BeamUpdate& update : updates_) {
+      BeamTable::BeamId target = update.target;
+      float log_p = update.log_p;
+
+      // combine current path with previous ones with the same prefix
+      switch (update.kind) {
+      case BeamUpdate::BLANK:
+        // the blank label comes last, so we can compare log_prob_nb_cur with log_p
+        if (beams_.log_prob_nb_cur[target] < log_p) {
+          // keep current timesteps
+          beams_.node[target]->previous_timesteps = nullptr;
+        }
+        beams_.log_prob_b_cur[target] = log_add(beams_.log_prob_b_cur[target], log_p);
+        break;
+
+      case BeamUpdate::REPEAT:
+        if (beams_.log_prob_nb_cur[target] < log_p) {
+          // keep current timesteps
+          beams_.node[target]->previous_timesteps = nullptr;
+        }
+        beams_.log_prob_nb_cur[target] = log_add(beams_.log_prob_nb_cur[target], log_p);
+        break;
+
+      case BeamUpdate::EXTEND:
+        if (beams_.log_prob_nb_cur[target] < log_p) {
+          // record data needed to update timesteps
+          // the actual update will be done if nothing better is found
+          PathTrie* target_node = beams_.node[target];
+          target_node->previous_timesteps = beams_.node[update.prefix]->timesteps;
+          target_node->new_timestep = abs_time_step_;
+          target_node->new_log_prob_c = update.log_prob_c;
+        }
+        beams_.log_prob_nb_cur[target] = log_add(beams_.log_prob_nb_cur[target], log_p);
+        break;
+      }
+    }
+
     // update log probs
     prefixes_.clear();
     prefix_root_->iterate_to_vec(prefixes_);
+    update_scores();
 
-    // only preserve top beam_size prefixes
-    if (prefixes_.size() > beam_size_) {
+    // only preserve top max_active prefixes
+    if (prefixes_.size() > max_active) {
       std::nth_element(prefixes_.begin(),
-                       prefixes_.begin() + beam_size_,
+                       prefixes_.begin() + max_active,
                        prefixes_.end(),
-                       prefix_compare);
-      for (size_t i = beam_size_; i < prefixes_.size(); ++i) {
-        prefixes_[i]->remove();
+                       beam_compare);
+      for (size_t i = max_active; i < prefixes_.size(); ++i) {
+        beams_.node[prefixes_[i]]->remove(beams_);
       }
 
       // Remove the elements from std::vector
-      prefixes_.resize(beam_size_);
+      prefixes_.resize(max_active);
+    }
+
+    // and among them, those close enough to the best one
+    if (beam_threshold_ > 0.f && !prefixes_.empty()) {
+      float best_score = -NUM_FLT_INF;
+      for (BeamTable::BeamId id : prefixes_) {
+        best_score = std::max(best_score, beams_.score[id]);
+      }
+      const float threshold = best_score - beam_threshold_;
+      auto pruned = std::partition(prefixes_.begin(), prefixes_.end(),
+                                   [this, threshold](BeamTable::BeamId id) {
+                                     return beams_.score[id] >= threshold;
+                                   });
+      for (auto it = pruned; it != prefixes_.end(); ++it) {
+        beams_.node[*it]->remove(beams_);
+      }
+      prefixes_.erase(pruned, prefixes_.end());
     }
   }  // end of loop over time
+
+  if (narrowed) {
+    ++deadline_hits_;
+  }
+}
+
+void
+DecoderState::score_extensions()
+{
+  // The n-grams completed by the extensions are independent, so they are
+  // scored as one batch
+  size_t num_queries = 0;
+  scored_updates_.clear();
+  for (size_t i = 0; i < updates_.size(); ++i) {
+    BeamUpdate& update = updates_[i];
+    if (update.kind != BeamUpdate::EXTEND) {
+      continue;
+    }
+
+    // skip scoring the space in word based LMs
+    PathTrie* prefix_to_score;
+    if (ext_scorer_->is_utf8_mode()) {
+      prefix_to_score = beams_.node[update.target];
+    } else {
+      prefix_to_score = beams_.node[update.prefix];
+    }
+
+    // language model scoring
+    if (ext_scorer_->is_scoring_boundary(prefix_to_score, update.character)) {
+      if (num_queries == queries_.size()) {
+        queries_.emplace_back();
+      }
+      Scorer::NgramQuery& query = queries_[num_queries++];
+      query.num_words = ext_scorer_->make_ngram_indices(prefix_to_score, query.words);
+      query.ngram.clear();
+      if (query.num_words == 0) {
+        query.ngram = ext_scorer_->make_ngram(prefix_to_score);
+      }
+      size_t length = query.num_words ? query.num_words : query.ngram.size();
+      query.bos = length < ext_scorer_->get_max_order();
+      scored_updates_.push_back(i);
+    }
+  }
+  score_queries(num_queries);
+
+  size_t next_scored = 0;
+  for (size_t i = 0; i < updates_.size(); ++i) {
+    BeamUpdate& update = updates_[i];
+    if (update.kind != BeamUpdate::EXTEND) {
+      continue;
+    }
+
+    if (next_scored < scored_updates_.size() && scored_updates_[next_scored] == i) {
+      float score = queries_[next_scored].score * alpha_;
+      update.log_p += score;
+      update.log_p += beta_;
+      ++next_scored;
+    }
+
+    if (update.boost != 0.f) {
+      update.log_p += update.boost * alpha_;
+    }
+  }
+}
+
+void
+DecoderState::set_expansion_pool(std::shared_ptr<ThreadPool> pool,
+                                 size_t num_workers)
+{
+  expansion_pool_ = num_workers > 1 ? pool : nullptr;
+  expansion_workers_ = std::max<size_t>(1, num_workers);
+}
+
+void
+DecoderState::score_queries(size_t num_queries)
+{
+  // Below this many n-grams per part, dispatching costs more than it saves
+  const size_t MIN_QUERIES_PER_PART = 64;
+
+  size_t num_parts = 1;
+  if (expansion_pool_) {
+    num_parts = std::min(expansion_workers_, num_queries / MIN_QUERIES_PER_PART);
+  }
+  if (num_parts <= 1) {
+    ext_scorer_->get_log_cond_probs(queries_.data(), num_queries);
+    return;
+  }
+
+  // The parts are claimed by the tasks and by the calling thread alike, so
+  // that the frame goes on even if the workers of a shared pool are busy,
+  // or waiting for frames of their own. Tasks starting once every part is
+  // claimed return at once, the progress is shared with them so that they
+  // can still check it after this call returned.
+  struct Progress {
+    std::atomic<size_t> next_part{0};
+    size_t parts_done = 0;
+    std::mutex lock;
+    std::condition_variable done;
+  };
+  auto progress = std::make_shared<Progress>();
+  const size_t part_size = (num_queries + num_parts - 1) / num_parts;
+  Scorer::NgramQuery* queries = queries_.data();
+  Scorer* scorer = ext_scorer_.get();
+  auto score_parts = [=]() {
+    for (size_t part; (part = progress->next_part.fetch_add(1)) < num_parts;) {
+      const size_t begin = part * part_size;
+      const size_t end = std::min(begin + part_size, num_queries);
+      scorer->get_log_cond_probs(queries + begin, end - begin);
+      std::lock_guard<std::mutex> lock(progress->lock);
+      if (++progress->parts_done == num_parts) {
+        progress->done.notify_one();
+      }
+    }
+  };
+
+  for (size_t i = 1; i < num_parts; ++i) {
+    expansion_pool_->enqueue(score_parts);
+  }
+  score_parts();
+  std::unique_lock<std::mutex> lock(progress->lock);
+  progress->done.wait(lock, [&]() { return progress->parts_done == num_parts; });
 }
 
 std::vector<Output>
 DecoderState::decode(size_t num_results) const
 {
-  std::vector<PathTrie*> prefixes_copy = prefixes_;
-  std::unordered_map<const PathTrie*, float> scores;
-  for (PathTrie* prefix : prefixes_copy) {
-    scores[prefix] = prefix->score;
+  if (greedy_) {
+    Output output;
+    output.confidence = greedy_log_prob_;
+    output.tokens = greedy_tokens_;
+    output.timesteps = greedy_timesteps_;
+    return std::vector<Output>(num_results > 0 ? 1 : 0, output);
+  }
+
+  std::vector<float> scores;
+  std::vector<size_t> order;
+  size_t num_returned = rank_prefixes(num_results, scores, order);
+
+  std::vector<Output> outputs(num_returned);
+  for (size_t i = 0; i < num_returned; ++i) {
+    PathTrie* prefix = beams_.node[prefixes_[order[i]]];
+    Output& output = outputs[i];
+    prefix->get_path_vec(output.tokens);
+    output.timesteps = get_history(prefix->timesteps, &timestep_tree_root_);
+    assert(output.tokens.size() == output.timesteps.size());
+    output.confidence = scores[order[i]];
+  }
+
+  return outputs;
+}
+
+bool
+DecoderState::score_last_word(Scorer& scorer, PathTrie* prefix, float* lm_score) const
+{
+  PathTrie* prefix_boundary = scorer.is_utf8_mode() ? prefix : prefix->parent;
+  if (!prefix_boundary || scorer.is_scoring_boundary(prefix_boundary, prefix->character)) {
+    return false;
+  }
+  std::vector<std::string> ngram = scorer.make_ngram(prefix);
+  bool bos = ngram.size() < scorer.get_max_order();
+  *lm_score = scorer.get_log_cond_prob(ngram, bos);
+  return true;
+}
+
+void
+DecoderState::score_paths(Scorer& scorer,
+                          size_t num_prefixes,
+                          std::vector<float>& lm_scores,
+                          std::vector<size_t>& num_words) const
+{
+  // Prefixes share the nodes of their common history, so the nodes of all
+  // paths are listed once, parents first, and each word is scored once
+  const size_t NO_PARENT = std::numeric_limits<size_t>::max();
+  std::unordered_map<const PathTrie*, size_t> node_index;
+  std::vector<PathTrie*> nodes;
+  std::vector<size_t> parents;
+  std::vector<PathTrie*> unlisted;
+  for (size_t i = 0; i < num_prefixes; ++i) {
+    for (PathTrie* node = beams_.node[prefixes_[i]];
+         node->parent != nullptr && node_index.count(node) == 0;
+         node = node->parent) {
+      unlisted.push_back(node);
+    }
+    for (; !unlisted.empty(); unlisted.pop_back()) {
+      PathTrie* node = unlisted.back();
+      auto parent = node_index.find(node->parent);
+      parents.push_back(parent != node_index.end() ? parent->second : NO_PARENT);
+      node_index[node] = nodes.size();
+      nodes.push_back(node);
+    }
+  }
+
+  // Word indices are only meaningful for the scorer whose dictionary built
+  // the prefixes, or for codepoints
+  const bool use_indices = &scorer == ext_scorer_.get() || scorer.is_utf8_mode();
+  std::vector<Scorer::NgramQuery> queries;
+  auto add_query = [&](PathTrie* prefix) {
+    queries.emplace_back();
+    Scorer::NgramQuery& query = queries.back();
+    query.num_words = use_indices ? scorer.make_ngram_indices(prefix, query.words) : 0;
+    if (query.num_words == 0) {
+      query.ngram = scorer.make_ngram(prefix);
+    }
+    size_t length = query.num_words ? query.num_words : query.ngram.size();
+    query.bos = length < scorer.get_max_order();
+  };
+
+  // words ending at each node, with the same boundaries as
+  // score_extensions(), then the last word of each prefix as
+  // score_last_word() scores it
+  std::vector<size_t> node_query(nodes.size(), NO_PARENT);
+  for (size_t k = 0; k < nodes.size(); ++k) {
+    PathTrie* node = nodes[k];
+    PathTrie* prefix_to_score = scorer.is_utf8_mode() ? node : node->parent;
+    if (scorer.is_scoring_boundary(prefix_to_score, node->character)) {
+      node_query[k] = queries.size();
+      add_query(prefix_to_score);
+    }
+  }
+  std::vector<size_t> last_word_query(num_prefixes, NO_PARENT);
+  for (size_t i = 0; i < num_prefixes; ++i) {
+    PathTrie* prefix = beams_.node[prefixes_[i]];
+    PathTrie* prefix_boundary = scorer.is_utf8_mode() ? prefix : prefix->parent;
+    if (prefix_boundary && !scorer.is_scoring_boundary(prefix_boundary, prefix->character)) {
+      last_word_query[i] = queries.size();
+      add_query(prefix);
+    }
+  }
+  scorer.get_log_cond_probs(queries.data(), queries.size());
+
+  // sum the scores along the paths, parents first
+  std::vector<double> node_scores(nodes.size());
+  std::vector<size_t> node_words(nodes.size());
+  for (size_t k = 0; k < nodes.size(); ++k) {
+    node_scores[k] = parents[k] != NO_PARENT ? node_scores[parents[k]] : 0.0;
+    node_words[k] = parents[k] != NO_PARENT ? node_words[parents[k]] : 0;
+    if (node_query[k] != NO_PARENT) {
+      node_scores[k] += queries[node_query[k]].score;
+      ++node_words[k];
+    }
+  }
+
+  lm_scores.assign(num_prefixes, 0.f);
+  num_words.assign(num_prefixes, 0);
+  for (size_t i = 0; i < num_prefixes; ++i) {
+    PathTrie* prefix = beams_.node[prefixes_[i]];
+    double lm_score = 0.0;
+    if (prefix->parent != nullptr) {
+      const size_t k = node_index[prefix];
+      lm_score = node_scores[k];
+      num_words[i] = node_words[k];
+    }
+    if (last_word_query[i] != NO_PARENT) {
+      lm_score += queries[last_word_query[i]].score;
+      ++num_words[i];
+    }
+    lm_scores[i] = lm_score;
+  }
+}
+
+size_t
+DecoderState::rank_prefixes(size_t num_results,
+                            std::vector<float>& scores,
+                            std::vector<size_t>& order) const
+{
+  // final scores, parallel to prefixes_
+  const size_t num_prefixes = prefixes_.size();
+  scores.resize(num_prefixes);
+  for (size_t i = 0; i < num_prefixes; ++i) {
+    scores[i] = beams_.score[prefixes_[i]];
   }
 
   // score the last word of each prefix that doesn't end with space
   if (ext_scorer_) {
-    for (size_t i = 0; i < beam_size_ && i < prefixes_copy.size(); ++i) {
-      PathTrie* prefix = prefixes_copy[i];
-      PathTrie* prefix_boundary = ext_scorer_->is_utf8_mode() ? prefix : prefix->parent;
-      if (prefix_boundary && !ext_scorer_->is_scoring_boundary(prefix_boundary, prefix->character)) {
-        float score = 0.0;
-        std::vector<std::string> ngram = ext_scorer_->make_ngram(prefix);
-        bool bos = ngram.size() < ext_scorer_->get_max_order();
-        score = ext_scorer_->get_log_cond_prob(ngram, bos) * ext_scorer_->alpha;
-        score += ext_scorer_->beta;
-        scores[prefix] += score;
+    for (size_t i = 0; i < max_active() && i < num_prefixes; ++i) {
+      PathTrie* prefix = beams_.node[prefixes_[i]];
+      float lm_score;
+      if (score_last_word(*ext_scorer_, prefix, &lm_score)) {
+        scores[i] += lm_score * alpha_ + beta_;
+      }
+
+      // complete the boost of a hot-word ending the transcript
+      if (hot_words_ && prefix->character != space_id_) {
+        scores[i] += (hot_words_->word_boost(prefix->hot_word_state) -
+                      hot_words_->prefix_boost(prefix->hot_word_state)) * alpha_;
+      }
+
+      // the last word is scored above, drop the estimate of its score. The
+      // root starts with the estimate of any word, so a prefix carries the
+      // difference between its own estimate and that one.
+      if (dictionary_.lookahead) {
+        scores[i] -= (prefix->lookahead - prefix_root_->lookahead) * alpha_;
+      }
+    }
+  }
+
+  // second pass: swap the language model scores of the search for those of
+  // the rescorer
+  if (rescorer_) {
+    const size_t num_rescored = std::min(max_active(), num_prefixes);
+    std::vector<float> lm_scores;
+    std::vector<size_t> num_words;
+    if (ext_scorer_) {
+      score_paths(*ext_scorer_, num_rescored, lm_scores, num_words);
+      for (size_t i = 0; i < num_rescored; ++i) {
+        scores[i] -= lm_scores[i] * alpha_ + num_words[i] * beta_;
+      }
+    }
+    score_paths(*rescorer_, num_rescored, lm_scores, num_words);
+    for (size_t i = 0; i < num_rescored; ++i) {
+      scores[i] += lm_scores[i] * rescorer_alpha_ + num_words[i] * rescorer_beta_;
+    }
+  }
+
+  // rank the prefixes by final score, ties broken by last character
+  order.resize(num_prefixes);
+  for (size_t i = 0; i < num_prefixes; ++i) {
+    order[i] = i;
+  }
+  size_t num_returned = std::min(num_prefixes, num_results);
+  std::partial_sort(order.begin(),
+                    order.begin() + num_returned,
+                    order.end(),
+                    [this, &scores](size_t x, size_t y) {
+                      if (scores[x] == scores[y]) {
+                        return beams_.character[prefixes_[x]] < beams_.character[prefixes_[y]];
+                      }
+                      return scores[x] > scores[y];
+                    });
+  return num_returned;
+}
+
+Lattice
+DecoderState::decode_lattice(size_t num_results) const
+{
+  Lattice lattice;
+
+  if (greedy_) {
+    // a single transcript, whose scores are only known as a whole
+    if (num_results > 0) {
+      bool in_word = false;
+      for (size_t i = 0; i < greedy_tokens_.size(); ++i) {
+        if (!in_word) {
+          lattice.arcs.push_back(Lattice::Arc{lattice.num_nodes - 1, lattice.num_nodes, {},
+                                            greedy_timesteps_[i], greedy_timesteps_[i], 0.f, 0.f});
+          ++lattice.num_nodes;
+          in_word = true;
+        }
+        Lattice::Arc& arc = lattice.arcs.back();
+        arc.end_timestep = greedy_timesteps_[i];
+        if (greedy_tokens_[i] == space_id_) {
+          in_word = false;
+        } else {
+          arc.tokens.push_back(greedy_tokens_[i]);
+        }
       }
+      lattice.finals.emplace_back(lattice.num_nodes - 1, greedy_log_prob_);
     }
+    return lattice;
   }
 
-  using namespace std::placeholders;
-  size_t num_returned = std::min(prefixes_copy.size(), num_results);
-  std::partial_sort(prefixes_copy.begin(),
-                    prefixes_copy.begin() + num_returned,
-                    prefixes_copy.end(),
-                    std::bind(prefix_compare_external, _1, _2, scores));
+  std::vector<float> scores;
+  std::vector<size_t> order;
+  size_t num_returned = rank_prefixes(num_results, scores, order);
 
-  std::vector<Output> outputs;
-  outputs.reserve(num_returned);
+  // Word boundaries of the transcripts are the spaces and their last
+  // characters. As PathTrie is a tree, the word leading to a boundary is
+  // the same in every transcript going through it, so boundaries already
+  // in the lattice are shared.
+  std::unordered_map<const PathTrie*, unsigned int> nodes;
+  nodes[prefix_root_.get()] = 0;
+  std::vector<PathTrie*> path;
 
   for (size_t i = 0; i < num_returned; ++i) {
-    Output output;
-    prefixes_copy[i]->get_path_vec(output.tokens);
-    output.timesteps  = get_history(prefixes_copy[i]->timesteps, &timestep_tree_root_);
-    assert(output.tokens.size() == output.timesteps.size());
-    output.confidence = scores[prefixes_copy[i]];
-    outputs.push_back(output);
+    PathTrie* prefix = beams_.node[prefixes_[order[i]]];
+    path.clear();
+    for (PathTrie* node = prefix; node->parent != nullptr; node = node->parent) {
+      path.push_back(node);
+    }
+    std::reverse(path.begin(), path.end());
+    std::vector<unsigned int> timesteps = get_history(prefix->timesteps, &timestep_tree_root_);
+    assert(path.size() == timesteps.size());
+
+    unsigned int from = 0;
+    size_t word_start = 0;
+    for (size_t k = 0; k < path.size(); ++k) {
+      bool last = k + 1 == path.size();
+      if (path[k]->character != space_id_ && !last) {
+        continue;
+      }
+
+      auto node = nodes.find(path[k]);
+      if (node != nodes.end()) {
+        from = node->second;
+      } else {
+        Lattice::Arc arc{from, lattice.num_nodes++, {},
+                       timesteps[word_start], timesteps[k], 0.f, 0.f};
+        for (size_t j = word_start; j <= k; ++j) {
+          PathTrie* word_node = path[j];
+          if (word_node->character != space_id_) {
+            arc.tokens.push_back(word_node->character);
+          }
+          arc.acoustic_score += word_node->log_prob_c;
+
+          // language model scores as added by the search
+          if (ext_scorer_) {
+            PathTrie* prefix_to_score = ext_scorer_->is_utf8_mode() ? word_node : word_node->parent;
+            if (ext_scorer_->is_scoring_boundary(prefix_to_score, word_node->character)) {
+              std::vector<std::string> ngram = ext_scorer_->make_ngram(prefix_to_score);
+              bool bos = ngram.size() < ext_scorer_->get_max_order();
+              arc.lm_score += ext_scorer_->get_log_cond_prob(ngram, bos);
+            }
+          }
+        }
+        float lm_score;
+        if (last && ext_scorer_ && score_last_word(*ext_scorer_, path[k], &lm_score)) {
+          arc.lm_score += lm_score;
+        }
+
+        nodes[path[k]] = arc.to;
+        from = arc.to;
+        lattice.arcs.push_back(std::move(arc));
+      }
+      word_start = k + 1;
+    }
+    lattice.finals.emplace_back(from, scores[order[i]]);
   }
 
-  return outputs;
+  return lattice;
 }
 
-std::vector<Output> ctc_beam_search_decoder(
+static std::vector<Output>
+decode_with_compiled_hot_words(
     const double *probs,
     int time_dim,
     int class_dim,
@@ -273,16 +870,38 @@ std::vector<Output> ctc_beam_search_decoder(
     double cutoff_prob,
     size_t cutoff_top_n,
     std::shared_ptr<Scorer> ext_scorer,
-    std::unordered_map<std::string, float> hot_words,
-    size_t num_results)
+    std::shared_ptr<const HotWordTrie> hot_words,
+    size_t num_results,
+    bool fast_log_add)
 {
   VALID_CHECK_EQ(alphabet.GetSize()+1, class_dim, "Number of output classes in acoustic model does not match number of labels in the alphabet file. Alphabet file must be the same one that was used to train the acoustic model.");
   DecoderState state;
   state.init(alphabet, beam_size, cutoff_prob, cutoff_top_n, ext_scorer, hot_words);
+  state.set_fast_log_add(fast_log_add);
   state.next(probs, time_dim, class_dim);
   return state.decode(num_results);
 }
 
+std::vector<Output> ctc_beam_search_decoder(
+    const double *probs,
+    int time_dim,
+    int class_dim,
+    const Alphabet &alphabet,
+    size_t beam_size,
+    double cutoff_prob,
+    size_t cutoff_top_n,
+    std::shared_ptr<Scorer> ext_scorer,
+    const std::unordered_map<std::string, float> &hot_words,
+    size_t num_results,
+    bool fast_log_add)
+{
+  return decode_with_compiled_hot_words(probs, time_dim, class_dim, alphabet,
+                                        beam_size, cutoff_prob, cutoff_top_n,
+                                        ext_scorer,
+                                        compile_hot_words(hot_words, alphabet),
+                                        num_results, fast_log_add);
+}
+
 std::vector<std::vector<Output>>
 ctc_beam_search_decoder_batch(
     const double *probs,
@@ -297,34 +916,181 @@ ctc_beam_search_decoder_batch(
     double cutoff_prob,
     size_t cutoff_top_n,
     std::shared_ptr<Scorer> ext_scorer,
-    std::unordered_map<std::string, float> hot_words,
-    size_t num_results)
+    const std::unordered_map<std::string, float> &hot_words,
+    size_t num_results,
+    bool fast_log_add)
 {
   VALID_CHECK_GT(num_processes, 0, "num_processes must be nonnegative!");
+  DecoderExecutor executor(num_processes);
+  return executor.decode_batch(probs, batch_size, time_dim, class_dim,
+                               seq_lengths, seq_lengths_size, alphabet,
+                               beam_size, cutoff_prob, cutoff_top_n,
+                               ext_scorer, hot_words, num_results,
+                               fast_log_add);
+}
+
+DecoderExecutor::DecoderExecutor(size_t num_threads)
+{
+  VALID_CHECK_GT(num_threads, 0, "num_threads must be positive!");
+  for (size_t i = 0; i < num_threads; ++i) {
+    queues_.emplace_back(new TaskQueue);
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&DecoderExecutor::worker_loop, this, i);
+  }
+}
+
+DecoderExecutor::~DecoderExecutor()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stop_ = true;
+  }
+  work_available_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+bool
+DecoderExecutor::pop_task(size_t worker_id, Task* task)
+{
+  // Take the next task from our own queue first, then steal from the back
+  // of the other queues, where the cheapest tasks are.
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    TaskQueue& queue = *queues_[(worker_id + i) % queues_.size()];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (!queue.tasks.empty()) {
+      if (i == 0) {
+        *task = queue.tasks.front();
+        queue.tasks.pop_front();
+      } else {
+        *task = queue.tasks.back();
+        queue.tasks.pop_back();
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+DecoderExecutor::worker_loop(size_t worker_id)
+{
+  size_t seen_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      work_available_.wait(guard, [&] { return stop_ || generation_ != seen_generation; });
+      if (stop_) {
+        return;
+      }
+      seen_generation = generation_;
+    }
+
+    Task task;
+    while (pop_task(worker_id, &task)) {
+      std::exception_ptr error;
+      try {
+        (*task.job)(task.index);
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> guard(lock_);
+      if (error && !error_) {
+        error_ = error;
+      }
+      if (--pending_ == 0) {
+        work_done_.notify_all();
+      }
+    }
+  }
+}
+
+void
+DecoderExecutor::run(const std::vector<size_t>& order,
+                     const std::function<void(size_t)>& job)
+{
+  if (order.empty()) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> run_guard(run_lock_);
+  {
+    // set before queueing, workers still draining the queues can pick up
+    // the new tasks right away
+    std::lock_guard<std::mutex> guard(lock_);
+    pending_ = order.size();
+    error_ = nullptr;
+  }
+
+  // Deal the tasks round-robin, so that every worker starts with one of the
+  // most expensive tasks
+  for (size_t i = 0; i < order.size(); ++i) {
+    TaskQueue& queue = *queues_[i % queues_.size()];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    queue.tasks.push_back(Task{&job, order[i]});
+  }
+
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> guard(lock_);
+    ++generation_;
+    work_available_.notify_all();
+    work_done_.wait(guard, [this] { return pending_ == 0; });
+    std::swap(error, error_);
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+std::vector<std::vector<Output>>
+DecoderExecutor::decode_batch(const double* probs,
+                              int batch_size,
+                              int time_dim,
+                              int class_dim,
+                              const int* seq_lengths,
+                              int seq_lengths_size,
+                              const Alphabet &alphabet,
+                              size_t beam_size,
+                              double cutoff_prob,
+                              size_t cutoff_top_n,
+                              std::shared_ptr<Scorer> ext_scorer,
+                              const std::unordered_map<std::string, float> &hot_words,
+                              size_t num_results,
+                              bool fast_log_add)
+{
   VALID_CHECK_EQ(batch_size, seq_lengths_size, "must have one sequence length per batch element");
-  // thread pool
-  ThreadPool pool(num_processes);
-
-  // enqueue the tasks of decoding
-  std::vector<std::future<std::vector<Output>>> res;
-  for (size_t i = 0; i < batch_size; ++i) {
-    res.emplace_back(pool.enqueue(ctc_beam_search_decoder,
-                                  &probs[i*time_dim*class_dim],
-                                  seq_lengths[i],
-                                  class_dim,
-                                  alphabet,
-                                  beam_size,
-                                  cutoff_prob,
-                                  cutoff_top_n,
-                                  ext_scorer,
-                                  hot_words,
-                                  num_results));
-  }
-
-  // get decoding results
-  std::vector<std::vector<Output>> batch_results;
-  for (size_t i = 0; i < batch_size; ++i) {
-    batch_results.emplace_back(res[i].get());
+
+  // hot-words are compiled once and shared by all the tasks
+  std::shared_ptr<const HotWordTrie> compiled_hot_words =
+      compile_hot_words(hot_words, alphabet);
+
+  // longest utterances first
+  std::vector<size_t> order(batch_size);
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
   }
+  std::stable_sort(order.begin(), order.end(), [seq_lengths](size_t a, size_t b) {
+    return seq_lengths[a] > seq_lengths[b];
+  });
+
+  std::vector<std::vector<Output>> batch_results(batch_size);
+  run(order, [&](size_t i) {
+    batch_results[i] = decode_with_compiled_hot_words(&probs[i*time_dim*class_dim],
+                                                      seq_lengths[i],
+                                                      class_dim,
+                                                      alphabet,
+                                                      beam_size,
+                                                      cutoff_prob,
+                                                      cutoff_top_n,
+                                                      ext_scorer,
+                                                      compiled_hot_words,
+                                                      num_results,
+                                                      fast_log_add);
+  });
   return batch_results;
 }
@@ -1,14 +1,27 @@
 #ifndef CTC_BEAM_SEARCH_DECODER_H_
 #define CTC_BEAM_SEARCH_DECODER_H_
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "scorer.h"
+#include "beam_table.h"
+#include "decoder_utils.h"
+#include "hot_words.h"
+#include "lattice.h"
 #include "output.h"
 #include "alphabet.h"
 
+class ThreadPool;
+
 class DecoderState {
   int abs_time_step_;
   int space_id_;
@@ -17,12 +30,111 @@ class DecoderState {
   double cutoff_prob_;
   size_t cutoff_top_n_;
   bool start_expanding_;
+  // smallest values of beam_size_ and cutoff_top_n_ used so far
+  size_t min_beam_size_;
+  size_t min_cutoff_top_n_;
+  // calls to next() that narrowed the beam to meet their time budget
+  size_t deadline_hits_;
+
+  // best path (greedy) decoding, see set_greedy()
+  bool greedy_ = false;
+  int greedy_last_;
+  double greedy_log_prob_;
+  std::vector<unsigned int> greedy_tokens_;
+  std::vector<unsigned int> greedy_timesteps_;
 
   std::shared_ptr<Scorer> ext_scorer_;
-  std::vector<PathTrie*> prefixes_;
+  // second pass language model, see set_rescorer()
+  std::shared_ptr<Scorer> rescorer_;
+  // language model and word insertion weights of ext_scorer_ and rescorer_
+  // for this decoder, see set_scorer_weights()
+  double alpha_ = 0.;
+  double beta_ = 0.;
+  double rescorer_alpha_ = 0.;
+  double rescorer_beta_ = 0.;
+  // dictionary of ext_scorer_, empty if there is none
+  PathTrie::Dictionary dictionary_;
+  // keep the tables dictionary_ points into alive if the scorer loads others
+  std::shared_ptr<const PathTrie::FstType> dictionary_fst_;
+  std::shared_ptr<const DenseDictionary> dense_dictionary_;
+  std::shared_ptr<const float> lookahead_;
+  BeamTable beams_;
+  std::vector<BeamTable::BeamId> prefixes_;
   std::unique_ptr<PathTrie> prefix_root_;
   TimestepTreeNode timestep_tree_root_{nullptr, 0};
-  std::unordered_map<std::string, float> hot_words_;
+  std::shared_ptr<const HotWordTrie> hot_words_;
+
+  // A candidate update of a prefix during one frame, see next()
+  struct BeamUpdate {
+    enum Kind : unsigned char { BLANK, REPEAT, EXTEND };
+    Kind kind;
+    BeamTable::BeamId prefix;   // prefix being expanded
+    BeamTable::BeamId target;   // prefix receiving the probability mass
+    unsigned int character;
+    float log_p;
+    float boost;     // hot-word and look-ahead score change, scaled by alpha
+    float log_prob_c;  // probability of character in this frame
+  };
+  std::vector<BeamUpdate> updates_;
+
+  // n-grams scored by the extensions of a frame and the updates they belong
+  // to, reused across frames like updates_. Queries past the ones of the
+  // current frame are left over from earlier frames.
+  std::vector<Scorer::NgramQuery> queries_;
+  std::vector<size_t> scored_updates_;
+
+  // workers the n-grams of a frame are scored on, see set_expansion_pool()
+  std::shared_ptr<ThreadPool> expansion_pool_;
+  size_t expansion_workers_ = 1;
+
+  bool fast_log_add_ = false;
+
+  // score threshold pruning, see set_beam_threshold()
+  float beam_threshold_ = 0.f;
+  size_t max_active_ = 0;
+
+  // number of prefixes kept after each frame
+  size_t max_active() const {
+    return beam_threshold_ > 0.f && max_active_ > 0 ? std::min(max_active_, beam_size_)
+                                                    : beam_size_;
+  }
+  // scratch buffers of update_scores()
+  std::vector<float> log_probs_b_;
+  std::vector<float> log_probs_nb_;
+  std::vector<float> scores_;
+
+  float log_add(float x, float y) const {
+    return fast_log_add_ ? log_sum_exp_fast(x, y) : log_sum_exp(x, y);
+  }
+
+  // set the score of every prefix in prefixes_ from its previous log probs
+  void update_scores();
+
+  // add language model and hot-word scores to the extensions in updates_
+  void score_extensions();
+
+  // score the first num_queries n-grams of queries_, on the expansion pool
+  // if there is one
+  void score_queries(size_t num_queries);
+
+  void next_greedy(const double *probs, int time_dim, int class_dim);
+
+  // LM score (not scaled by alpha) of the last word of prefix, if it is
+  // scored by decode() because prefix doesn't end with a scoring boundary
+  bool score_last_word(Scorer& scorer, PathTrie* prefix, float* lm_score) const;
+
+  // LM score (not scaled by alpha) of every word of the first num_prefixes
+  // prefixes, and their number, as the search scores them with scorer
+  void score_paths(Scorer& scorer,
+                   size_t num_prefixes,
+                   std::vector<float>& lm_scores,
+                   std::vector<size_t>& num_words) const;
+
+  // final scores of prefixes_ and the indices of the best num_results of
+  // them, best first. Returns the number of indices ranked.
+  size_t rank_prefixes(size_t num_results,
+                       std::vector<float>& scores,
+                       std::vector<size_t>& order) const;
 
 public:
   DecoderState() = default;
@@ -42,6 +154,8 @@ public:
    *     ext_scorer: External scorer to evaluate a prefix, which consists of
    *                 n-gram language model scoring and word insertion term.
    *                 Default null, decoding the input sample without scorer.
+   *     hot_words: A map of hot-words and their corresponding boosts
+   *                The hot-word is a string and the boost is a float.
    * Return:
    *     Zero on success, non-zero on failure.
   */
@@ -50,7 +164,100 @@ public:
            double cutoff_prob,
            size_t cutoff_top_n,
            std::shared_ptr<Scorer> ext_scorer,
-           std::unordered_map<std::string, float> hot_words);
+           const std::unordered_map<std::string, float>& hot_words);
+
+  /* Same as above, with hot-words already compiled into a trie that can be
+   * shared with other decoders. hot_words can be null.
+  */
+  int init(const Alphabet& alphabet,
+           size_t beam_size,
+           double cutoff_prob,
+           size_t cutoff_top_n,
+           std::shared_ptr<Scorer> ext_scorer,
+           std::shared_ptr<const HotWordTrie> hot_words);
+
+  /* Spread the language model lookups of each frame over a worker pool. The
+   * prefixes are still expanded and merged on the calling thread, in the
+   * same order, so the result is identical to decoding without a pool; only
+   * the latency of wide beams improves.
+   *
+   * Parameters:
+   *     pool: Worker pool, can be shared between decoders and with other
+   *           work. A frame doesn't wait for busy workers: the calling
+   *           thread scores whatever they haven't started. Null to decode on
+   *           the calling thread only.
+   *     num_workers: Maximum number of parts the lookups of a frame are
+   *                  split into, including the one of the calling thread.
+  */
+  void set_expansion_pool(std::shared_ptr<ThreadPool> pool,
+                          size_t num_workers);
+
+  /* Decode the best path instead of running a beam search: the most probable
+   * class of every frame is taken, repeats are collapsed and blanks dropped.
+   * The external scorer, hot-words and beam width are ignored, and decode()
+   * returns a single result whose confidence is the log probability of the
+   * path. Must be called after init() and before the first call to next().
+   *
+   * Return:
+   *     Zero on success, non-zero if frames have already been decoded.
+  */
+  int set_greedy(bool greedy);
+
+  /* Merge beams with log_sum_exp_fast() instead of the exact log_sum_exp().
+   * Scores then differ from the exact ones by less than 1e-5 per merge,
+   * which can reorder beams whose scores are nearly tied.
+  */
+  void set_fast_log_add(bool fast) { fast_log_add_ = fast; }
+
+  /* Prune the beam by score in addition to its width: after each frame,
+   * prefixes scoring more than threshold below the best one are dropped.
+   * Frames where one path clearly dominates then keep only a few prefixes,
+   * while ambiguous frames keep up to max_active of them.
+   *
+   * Parameters:
+   *     threshold: Maximum score difference (natural log) to the best prefix.
+   *                Zero or negative disables threshold pruning.
+   *     max_active: Maximum number of prefixes kept with threshold pruning,
+   *                 zero to keep the beam width. Never exceeds the beam
+   *                 width, so that set_beam_size() still narrows the beam.
+  */
+  void set_beam_threshold(float threshold, size_t max_active);
+
+  /* Rescore the results of decode() and decode_lattice() with a second
+   * language model, typically larger than the one of the external scorer.
+   * Every prefix of the beam gets the LM and word insertion scores of the
+   * external scorer replaced by those of the rescorer, weighted by its own
+   * alpha and beta, before being ranked. The search itself is unchanged.
+   *
+   * Parameters:
+   *     rescorer: Scorer of the second pass, null to disable rescoring. Its
+   *               vocabulary should match the one of the external scorer.
+  */
+  void set_rescorer(std::shared_ptr<Scorer> rescorer);
+
+  /* Weight the external scorer, or the rescorer, with alpha and beta in this
+   * decoder instead of the weights they have when passed to init() or
+   * set_rescorer(). Decoders can then share a scorer with different weights.
+  */
+  void set_scorer_weights(double alpha, double beta);
+  void set_rescorer_weights(double alpha, double beta);
+
+  bool is_greedy() const { return greedy_; }
+
+  /* Change the beam width and the number of classes expanded per frame of a
+   * running decoder, from the next frame on. Lowering them makes decoding
+   * cheaper at the cost of accuracy, beams beyond the new width are dropped
+   * at the end of the next frame.
+  */
+  void set_beam_size(size_t beam_size);
+  void set_cutoff_top_n(size_t cutoff_top_n);
+
+  size_t beam_size() const { return beam_size_; }
+  size_t cutoff_top_n() const { return cutoff_top_n_; }
+
+  // smallest beam width and cutoff used since init()
+  size_t min_beam_size() const { return min_beam_size_; }
+  size_t min_cutoff_top_n() const { return min_cutoff_top_n_; }
 
   /* Send data to the decoder
    *
@@ -59,10 +266,19 @@ public:
    *               over alphabet of one time step.
    *     time_dim: Number of timesteps.
    *     class_dim: Number of classes (alphabet length + 1 for space character).
+   *     time_budget: Seconds the call may take, zero for no limit. When the
+   *                  remaining frames would not fit in what is left of the
+   *                  budget at the current beam width, the beam is narrowed
+   *                  for them, down to a single prefix.
   */
   void next(const double *probs,
             int time_dim,
-            int class_dim);
+            int class_dim,
+            double time_budget = 0.0);
+
+  // number of calls to next() that had to narrow the beam to meet their
+  // time budget
+  size_t deadline_hits() const { return deadline_hits_; }
 
   /* Get up to num_results transcriptions from current decoder state.
    *
@@ -74,6 +290,19 @@ public:
    *     in descending order.
   */
   std::vector<Output> decode(size_t num_results=1) const;
+
+  /* Get the word lattice of up to num_results transcriptions from current
+   * decoder state, a tree where they share their common leading words. It
+   * holds the same transcriptions and confidences as decode(), but its size
+   * grows with the number of distinct words rather than with
+   * num_results * length. In greedy mode arcs carry no scores. With a
+   * rescorer, confidences are the rescored ones while the LM scores of arcs
+   * remain those of the external scorer.
+   *
+   * Parameters:
+   *     num_results: Number of beams to include.
+  */
+  Lattice decode_lattice(size_t num_results) const;
 };
 
 
@@ -93,6 +322,9 @@ public:
  *     hot_words: A map of hot-words and their corresponding boosts
  *                The hot-word is a string and the boost is a float.
  *     num_results: Number of beams to return.
+ *     fast_log_add: Merge probabilities with log_sum_exp_fast() instead of
+ *                   the exact log_sum_exp(), see
+ *                   DecoderState::set_fast_log_add().
  * Return:
  *     A vector where each element is a pair of score and decoding result,
  *     in descending order.
@@ -107,8 +339,9 @@ std::vector<Output> ctc_beam_search_decoder(
     double cutoff_prob,
     size_t cutoff_top_n,
     std::shared_ptr<Scorer> ext_scorer,
-    std::unordered_map<std::string, float> hot_words,
-    size_t num_results=1);
+    const std::unordered_map<std::string, float> &hot_words,
+    size_t num_results=1,
+    bool fast_log_add=false);
 
 /* CTC Beam Search Decoder for batch data
  * Parameters:
@@ -125,6 +358,9 @@ std::vector<Output> ctc_beam_search_decoder(
  *     hot_words: A map of hot-words and their corresponding boosts
  *                The hot-word is a string and the boost is a float.
  *     num_results: Number of beams to return.
+ *     fast_log_add: Merge probabilities with log_sum_exp_fast() instead of
+ *                   the exact log_sum_exp(), see
+ *                   DecoderState::set_fast_log_add().
  * Return:
  *     A 2-D vector where each element is a vector of beam search decoding
  *     result for one audio sample.
@@ -143,7 +379,80 @@ ctc_beam_search_decoder_batch(
     double cutoff_prob,
     size_t cutoff_top_n,
     std::shared_ptr<Scorer> ext_scorer,
-    std::unordered_map<std::string, float> hot_words,
-    size_t num_results=1);
+    const std::unordered_map<std::string, float> &hot_words,
+    size_t num_results=1,
+    bool fast_log_add=false);
+
+/* Long-lived executor for batches of CTC beam search decoding
+ *
+ * The worker threads are created once and reused by every call to
+ * decode_batch(). Each worker has its own task queue and steals from the
+ * others when it runs out of work, and the longest utterances of a batch are
+ * handed out first, so long and short utterances balance across threads.
+ * Calls to decode_batch() from several threads are serialized.
+*/
+class DecoderExecutor {
+public:
+  /* Parameters:
+   *     num_threads: Number of worker threads.
+  */
+  explicit DecoderExecutor(size_t num_threads);
+  ~DecoderExecutor();
+
+  // Disallow copying
+  DecoderExecutor(const DecoderExecutor&) = delete;
+  DecoderExecutor& operator=(const DecoderExecutor&) = delete;
+
+  size_t num_threads() const { return workers_.size(); }
+
+  /* Decode a batch, see ctc_beam_search_decoder_batch() for the parameters.
+   * Hot-words are compiled once and shared by all the utterances.
+  */
+  std::vector<std::vector<Output>>
+  decode_batch(const double* probs,
+               int batch_size,
+               int time_dim,
+               int class_dim,
+               const int* seq_lengths,
+               int seq_lengths_size,
+               const Alphabet &alphabet,
+               size_t beam_size,
+               double cutoff_prob,
+               size_t cutoff_top_n,
+               std::shared_ptr<Scorer> ext_scorer,
+               const std::unordered_map<std::string, float> &hot_words,
+               size_t num_results=1,
+               bool fast_log_add=false);
+
+private:
+  struct Task {
+    const std::function<void(size_t)>* job;
+    size_t index;
+  };
+
+  struct TaskQueue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  // Run job(i) for every i in order on the workers and wait for completion.
+  // Tasks are dealt round-robin, so order should start with the most
+  // expensive ones.
+  void run(const std::vector<size_t>& order, const std::function<void(size_t)>& job);
+  void worker_loop(size_t worker_id);
+  bool pop_task(size_t worker_id, Task* task);
+
+  std::vector<std::thread> workers_;
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+
+  std::mutex run_lock_;  // serializes run()
+  std::mutex lock_;      // protects the fields below
+  std::condition_variable work_available_;
+  std::condition_variable work_done_;
+  size_t generation_ = 0;
+  size_t pending_ = 0;
+  std::exception_ptr error_;
+  bool stop_ = false;
+};
 
 #endif  // CTC_BEAM_SEARCH_DECODER_H_
@@ -0,0 +1,732 @@
+#include "ctc_beam_search_decoder.h"
+#include "test_util.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Checks the decoder on frames spelling sentences of a random language
+// model, comparing its results across the ways of running it that must not
+// change them.
+
+static const size_t ORDER = 3;
+// frames per call to DecoderState::next(), as a stream would feed them
+static const size_t FRAMES_PER_CALL = 16;
+
+struct TestData {
+  Alphabet alphabet;
+  std::vector<std::string> words;
+  std::shared_ptr<Scorer> scorer;
+  std::string sentence;
+  std::vector<double> probs;
+};
+
+static std::string make_sentence(const std::vector<std::string>& words,
+                                  size_t num_words,
+                                  unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::string sentence;
+  for (size_t i = 0; i < num_words; ++i) {
+    sentence += (i ? " " : "") + words[rng() % words.size()];
+  }
+  return sentence;
+}
+
+static bool make_test_data(TestData& data)
+{
+  if (!make_test_alphabet(data.alphabet)) {
+    return false;
+  }
+  data.words = make_test_words(2000, 5);
+  const std::string arpa_path = test_file("ctc_beam_search_decoder_test.arpa");
+  const std::string lm_path = test_file("ctc_beam_search_decoder_test.binary");
+  const std::string package_path = test_file("ctc_beam_search_decoder_test.scorer");
+  write_test_arpa(arpa_path, data.words, ORDER, 6);
+  build_test_lm(arpa_path, lm_path);
+  if (!write_test_package(lm_path, package_path, data.alphabet, false, data.words, false, false)) {
+    return false;
+  }
+  data.scorer = std::make_shared<Scorer>();
+  if (data.scorer->init(package_path, data.alphabet) != DS_ERR_OK) {
+    return false;
+  }
+  data.sentence = make_sentence(data.words, 12, 7);
+  data.probs = make_test_probs(data.sentence, data.alphabet, 8, 0.95);
+  return true;
+}
+
+static void init_decoder(DecoderState& decoder,
+                         const TestData& data,
+                         size_t beam_size)
+{
+  decoder.init(data.alphabet, beam_size, 1.0, 40, data.scorer, nullptr);
+}
+
+static void feed(DecoderState& decoder, const TestData& data)
+{
+  const size_t class_dim = data.alphabet.GetSize() + 1;
+  const size_t time_dim = data.probs.size() / class_dim;
+  for (size_t t = 0; t < time_dim; t += FRAMES_PER_CALL) {
+    decoder.next(&data.probs[t * class_dim],
+                 std::min(FRAMES_PER_CALL, time_dim - t),
+                 class_dim);
+  }
+}
+
+// Results of a decoder fed data, set up by setup if given
+static std::vector<Output> decode_test_data(const TestData& data,
+                                            size_t beam_size,
+                                            size_t num_results,
+                                            std::function<void(DecoderState&)> setup = nullptr)
+{
+  DecoderState decoder;
+  init_decoder(decoder, data, beam_size);
+  if (setup) {
+    setup(decoder);
+  }
+  feed(decoder, data);
+  return decoder.decode(num_results);
+}
+
+static std::vector<std::string> split_words(const std::string& text)
+{
+  std::istringstream in(text);
+  std::vector<std::string> words;
+  for (std::string word; in >> word;) {
+    words.push_back(word);
+  }
+  return words;
+}
+
+// Results must match bit for bit, confidences included
+static bool same_outputs(const std::vector<Output>& a, const std::vector<Output>& b)
+{
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (a[i].confidence != b[i].confidence || a[i].tokens != b[i].tokens ||
+        a[i].timesteps != b[i].timesteps) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void test_expansion_pool(const TestData& data)
+{
+  // wide enough for frames to have several parts of n-grams to score
+  const size_t BEAM_SIZE = 1024;
+  const size_t NUM_RESULTS = 20;
+
+  DecoderState serial;
+  init_decoder(serial, data, BEAM_SIZE);
+  feed(serial, data);
+  const std::vector<Output> expected = serial.decode(NUM_RESULTS);
+  EXPECT(!expected.empty() && data.alphabet.Decode(expected[0].tokens) == data.sentence,
+         "expansion pool: serial decoder doesn't find \"%s\"", data.sentence.c_str());
+
+  for (size_t num_workers : {2, 3, 8}) {
+    DecoderState decoder;
+    init_decoder(decoder, data, BEAM_SIZE);
+    decoder.set_expansion_pool(std::make_shared<ThreadPool>(num_workers - 1), num_workers);
+    feed(decoder, data);
+    EXPECT(same_outputs(decoder.decode(NUM_RESULTS), expected),
+           "expansion pool: %zu workers give other results than one", num_workers);
+  }
+
+  // A frame must not wait for workers busy with other work, which could be
+  // waiting for it.
+  auto pool = std::make_shared<ThreadPool>(2);
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  for (int i = 0; i < 2; ++i) {
+    pool->enqueue([released]() { released.wait(); });
+  }
+  DecoderState decoder;
+  init_decoder(decoder, data, BEAM_SIZE);
+  decoder.set_expansion_pool(pool, 3);
+  feed(decoder, data);
+  release.set_value();
+  EXPECT(same_outputs(decoder.decode(NUM_RESULTS), expected),
+         "expansion pool: busy workers give other results than one");
+}
+
+static void test_hot_words(const TestData& data)
+{
+  const size_t BEAM_SIZE = 64;
+  const size_t NUM_RESULTS = 8;
+  const std::vector<Output> plain = decode_test_data(data, BEAM_SIZE, NUM_RESULTS);
+  const std::vector<std::string> sentence = split_words(data.sentence);
+
+  // A boosted word of the transcript changes its confidence by the boost
+  // weighted like the language model, whether it ends a word of the
+  // transcript or the transcript itself. Positive boosts are credited as
+  // the word is spelled, negative ones once it is complete. Scores are
+  // floats summed over every frame, so they only match to a fraction of the
+  // boost.
+  const std::vector<std::pair<std::string, float>> boosts{
+    {sentence[3], 5.f}, {sentence.back(), 5.f}, {sentence.back(), -2.f}};
+  for (const auto& boost : boosts) {
+    const std::string& word = boost.first;
+    const std::unordered_map<std::string, float> hot_words{boost};
+    const std::vector<Output> boosted = decode_test_data(data, BEAM_SIZE, NUM_RESULTS,
+      [&](DecoderState& decoder) {
+        decoder.init(data.alphabet, BEAM_SIZE, 1.0, 40, data.scorer, hot_words);
+      });
+    const size_t count = std::count(sentence.begin(), sentence.end(), word);
+    const double expected = plain[0].confidence + count * boost.second * data.scorer->alpha;
+    EXPECT(!boosted.empty() && data.alphabet.Decode(boosted[0].tokens) == data.sentence,
+           "hot-words: boosting \"%s\" by %g changes the transcript", word.c_str(), boost.second);
+    EXPECT(!boosted.empty() && std::fabs(boosted[0].confidence - expected) < std::fabs(boost.second) * 0.01,
+           "hot-words: boosting \"%s\" by %g gives a confidence of %f, expected %f",
+           word.c_str(), boost.second, boosted.empty() ? 0.0 : boosted[0].confidence, expected);
+
+    // compiled once and shared, the hot-words boost alike
+    auto trie = std::make_shared<const HotWordTrie>(hot_words, data.alphabet);
+    const std::vector<Output> shared = decode_test_data(data, BEAM_SIZE, NUM_RESULTS,
+      [&](DecoderState& decoder) {
+        decoder.init(data.alphabet, BEAM_SIZE, 1.0, 40, data.scorer, trie);
+      });
+    EXPECT(same_outputs(shared, boosted),
+           "hot-words: a shared trie boosts \"%s\" otherwise than a map", word.c_str());
+  }
+
+  // A word penalized enough is replaced by others.
+  const std::string& penalized = sentence[3];
+  const std::unordered_map<std::string, float> hot_words{{penalized, -30.f}};
+  const std::vector<Output> results = decode_test_data(data, BEAM_SIZE, NUM_RESULTS,
+    [&](DecoderState& decoder) {
+      decoder.init(data.alphabet, BEAM_SIZE, 1.0, 40, data.scorer, hot_words);
+    });
+  const std::vector<std::string> words = results.empty() ? std::vector<std::string>()
+                                                         : split_words(data.alphabet.Decode(results[0].tokens));
+  EXPECT(!results.empty() && std::count(words.begin(), words.end(), penalized) == 0,
+         "hot-words: penalized \"%s\" is still transcribed", penalized.c_str());
+}
+
+static void test_executor(const TestData& data)
+{
+  const size_t BEAM_SIZE = 64;
+  const size_t NUM_RESULTS = 5;
+  const size_t BATCH_SIZE = 7;
+  const size_t class_dim = data.alphabet.GetSize() + 1;
+  const std::unordered_map<std::string, float> hot_words{{split_words(data.sentence)[0], 3.f}};
+
+  // utterances of different lengths, padded with blank frames
+  std::vector<std::vector<double>> utterances;
+  std::vector<int> seq_lengths;
+  int time_dim = 0;
+  for (size_t i = 0; i < BATCH_SIZE; ++i) {
+    utterances.push_back(make_test_probs(make_sentence(data.words, 1 + i * 3 % 10, 20 + i),
+                                         data.alphabet, 30 + i, 0.7));
+    seq_lengths.push_back(utterances.back().size() / class_dim);
+    time_dim = std::max(time_dim, seq_lengths.back());
+  }
+  std::vector<double> probs(BATCH_SIZE * time_dim * class_dim, 0.0);
+  for (size_t i = 0; i < BATCH_SIZE; ++i) {
+    std::copy(utterances[i].begin(), utterances[i].end(), &probs[i * time_dim * class_dim]);
+    for (int t = seq_lengths[i]; t < time_dim; ++t) {
+      probs[(i * time_dim + t) * class_dim + class_dim - 1] = 1.0;
+    }
+  }
+
+  std::vector<std::vector<Output>> expected;
+  for (size_t i = 0; i < BATCH_SIZE; ++i) {
+    expected.push_back(ctc_beam_search_decoder(utterances[i].data(), seq_lengths[i], class_dim,
+                                               data.alphabet, BEAM_SIZE, 1.0, 40, data.scorer,
+                                               hot_words, NUM_RESULTS));
+  }
+  auto check = [&](const std::vector<std::vector<Output>>& results, const char* name) {
+    EXPECT(results.size() == BATCH_SIZE, "executor: %s decodes %zu utterances of %zu",
+           name, results.size(), BATCH_SIZE);
+    for (size_t i = 0; i < results.size() && i < BATCH_SIZE; ++i) {
+      EXPECT(same_outputs(results[i], expected[i]),
+             "executor: %s decodes utterance %zu otherwise than a single decoder", name, i);
+    }
+  };
+
+  for (size_t num_threads : {1, 3, 8}) {
+    DecoderExecutor executor(num_threads);
+    // twice, the workers are reused
+    for (int run = 0; run < 2; ++run) {
+      const std::string name = std::to_string(num_threads) + " threads, run " + std::to_string(run);
+      check(executor.decode_batch(probs.data(), BATCH_SIZE, time_dim, class_dim,
+                                  seq_lengths.data(), seq_lengths.size(), data.alphabet,
+                                  BEAM_SIZE, 1.0, 40, data.scorer, hot_words, NUM_RESULTS),
+            name.c_str());
+    }
+  }
+  check(ctc_beam_search_decoder_batch(probs.data(), BATCH_SIZE, time_dim, class_dim,
+                                      seq_lengths.data(), seq_lengths.size(), data.alphabet,
+                                      BEAM_SIZE, 3, 1.0, 40, data.scorer, hot_words, NUM_RESULTS),
+        "ctc_beam_search_decoder_batch");
+}
+
+// Frames whose classes have random probabilities, so that the best path
+// has repeats, blanks and spaces anywhere
+static std::vector<double> make_random_probs(size_t time_dim, size_t class_dim, unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> noise(0.0, 1.0);
+  std::vector<double> probs(time_dim * class_dim);
+  for (size_t t = 0; t < time_dim; ++t) {
+    double total = 0.0;
+    for (size_t c = 0; c < class_dim; ++c) {
+      // blanks are the most frequent class, as in real frames
+      probs[t * class_dim + c] = noise(rng) * (c + 1 == class_dim ? 3.0 : 1.0);
+      total += probs[t * class_dim + c];
+    }
+    for (size_t c = 0; c < class_dim; ++c) {
+      probs[t * class_dim + c] /= total;
+    }
+  }
+  return probs;
+}
+
+static void test_greedy(const TestData& data)
+{
+  const size_t class_dim = data.alphabet.GetSize() + 1;
+  const unsigned int blank = data.alphabet.GetSize();
+  TestData random_data = data;
+  random_data.probs = make_random_probs(300, class_dim, 40);
+
+  const TestData* inputs[] = {&data, &random_data};
+  for (const TestData* frames : inputs) {
+    // best path, with repeats collapsed and blanks dropped
+    Output expected;
+    expected.confidence = 0.0;
+    unsigned int previous = blank;
+    const size_t time_dim = frames->probs.size() / class_dim;
+    for (size_t t = 0; t < time_dim; ++t) {
+      const double* prob = &frames->probs[t * class_dim];
+      const unsigned int best = std::max_element(prob, prob + class_dim) - prob;
+      expected.confidence += std::log(prob[best]);
+      if (best != blank && best != previous) {
+        expected.tokens.push_back(best);
+        expected.timesteps.push_back(t);
+      }
+      previous = best;
+    }
+
+    const char* name = frames == &data ? "sentence" : "random frames";
+    const std::vector<Output> results = decode_test_data(*frames, 16, 5, [](DecoderState& decoder) {
+      decoder.set_greedy(true);
+    });
+    EXPECT(same_outputs(results, {expected}), "greedy: %s: result isn't the best path", name);
+
+    // the scorer is ignored
+    DecoderState decoder;
+    decoder.init(data.alphabet, 16, 1.0, 40, nullptr, nullptr);
+    decoder.set_greedy(true);
+    feed(decoder, *frames);
+    EXPECT(same_outputs(decoder.decode(5), {expected}), "greedy: %s: result depends on the scorer", name);
+  }
+  EXPECT(data.alphabet.Decode(decode_test_data(data, 16, 1, [](DecoderState& decoder) {
+           decoder.set_greedy(true);
+         })[0].tokens) == data.sentence,
+         "greedy: \"%s\" isn't the best path of its frames", data.sentence.c_str());
+
+  // the mode can't change once frames are decoded
+  DecoderState decoder;
+  init_decoder(decoder, data, 16);
+  feed(decoder, data);
+  EXPECT(decoder.set_greedy(true) != 0, "greedy: enabled after decoding frames");
+  EXPECT(!decoder.is_greedy(), "greedy: enabled after decoding frames");
+}
+
+static void test_beam_threshold(const TestData& data)
+{
+  const size_t BEAM_SIZE = 64;
+  const size_t MAX_ACTIVE = 6;
+  // frames noisy enough to keep many prefixes close to the best one
+  TestData noisy = data;
+  noisy.probs = make_test_probs(data.sentence, data.alphabet, 9, 0.5);
+
+  TestData without_scorer = noisy;
+  without_scorer.scorer = nullptr;
+  const TestData* inputs[] = {&noisy, &without_scorer};
+  for (const TestData* frames : inputs) {
+    const char* name = frames->scorer ? "with scorer" : "without scorer";
+    const std::vector<Output> plain = decode_test_data(*frames, BEAM_SIZE, BEAM_SIZE);
+
+    // a threshold nothing is below, or a cap without threshold, prune nothing
+    EXPECT(same_outputs(decode_test_data(*frames, BEAM_SIZE, BEAM_SIZE, [](DecoderState& decoder) {
+             decoder.set_beam_threshold(1e9f, 0);
+           }), plain),
+           "beam threshold: %s: an unreachable threshold changes the results", name);
+    EXPECT(same_outputs(decode_test_data(*frames, BEAM_SIZE, BEAM_SIZE, [&](DecoderState& decoder) {
+             decoder.set_beam_threshold(0.f, MAX_ACTIVE);
+           }), plain),
+           "beam threshold: %s: max_active applies without threshold", name);
+
+    // with a threshold, max_active caps the beam like its width does
+    EXPECT(same_outputs(decode_test_data(*frames, BEAM_SIZE, BEAM_SIZE, [&](DecoderState& decoder) {
+             decoder.set_beam_threshold(1e9f, MAX_ACTIVE);
+           }), decode_test_data(*frames, MAX_ACTIVE, BEAM_SIZE)),
+           "beam threshold: %s: max_active of %zu decodes otherwise than a beam of that width",
+           name, MAX_ACTIVE);
+
+    // and a close threshold keeps fewer prefixes, but still the best one.
+    // Language model scores spread the beam further apart.
+    const float THRESHOLD = frames->scorer ? 4.f : 2.5f;
+    const std::vector<Output> pruned = decode_test_data(*frames, BEAM_SIZE, BEAM_SIZE, [&](DecoderState& decoder) {
+      decoder.set_beam_threshold(THRESHOLD, 0);
+    });
+    EXPECT(!pruned.empty() && pruned.size() < plain.size(),
+           "beam threshold: %s: a threshold of %g keeps %zu prefixes of %zu",
+           name, THRESHOLD, pruned.size(), plain.size());
+    EXPECT(!pruned.empty() && pruned[0].tokens == plain[0].tokens,
+           "beam threshold: %s: a threshold of %g loses the best transcript", name, THRESHOLD);
+    if (!frames->scorer) {
+      // without scorer, the confidences are the scores the beam is pruned by
+      for (const Output& output : pruned) {
+        EXPECT(output.confidence >= pruned[0].confidence - THRESHOLD,
+               "beam threshold: %s: a prefix %f below the best one is kept",
+               name, pruned[0].confidence - output.confidence);
+      }
+    }
+  }
+}
+
+static void test_quality_scaling(const TestData& data)
+{
+  const size_t BEAM_SIZE = 64;
+  const size_t class_dim = data.alphabet.GetSize() + 1;
+  const size_t time_dim = data.probs.size() / class_dim;
+  TestData noisy = data;
+  noisy.probs = make_test_probs(data.sentence, data.alphabet, 9, 0.5);
+
+  // lowered before the first frame, like initialized with the lower values
+  DecoderState reference;
+  reference.init(data.alphabet, 8, 1.0, 5, data.scorer, nullptr);
+  feed(reference, noisy);
+  EXPECT(same_outputs(decode_test_data(noisy, BEAM_SIZE, BEAM_SIZE, [](DecoderState& decoder) {
+           decoder.set_beam_size(8);
+           decoder.set_cutoff_top_n(5);
+         }), reference.decode(BEAM_SIZE)),
+         "quality scaling: lowering the beam before decoding differs from starting with it");
+
+  // lowered while decoding, the beam narrows from the next frame on, and
+  // widens again once restored
+  DecoderState decoder;
+  init_decoder(decoder, noisy, BEAM_SIZE);
+  const size_t first_part = time_dim / 3;
+  decoder.next(noisy.probs.data(), first_part, class_dim);
+  EXPECT(decoder.decode(BEAM_SIZE).size() == BEAM_SIZE,
+         "quality scaling: beam not full before lowering it");
+  decoder.set_beam_size(4);
+  decoder.set_cutoff_top_n(10);
+  decoder.next(&noisy.probs[first_part * class_dim], first_part, class_dim);
+  EXPECT(decoder.decode(BEAM_SIZE).size() <= 4,
+         "quality scaling: %zu prefixes kept with a beam of 4", decoder.decode(BEAM_SIZE).size());
+  decoder.set_beam_size(BEAM_SIZE);
+  decoder.set_cutoff_top_n(40);
+  decoder.next(&noisy.probs[2 * first_part * class_dim], time_dim - 2 * first_part, class_dim);
+  EXPECT(decoder.decode(BEAM_SIZE).size() > 4,
+         "quality scaling: beam doesn't widen once restored");
+  EXPECT(decoder.beam_size() == BEAM_SIZE && decoder.cutoff_top_n() == 40,
+         "quality scaling: restored values not in effect");
+  EXPECT(decoder.min_beam_size() == 4 && decoder.min_cutoff_top_n() == 10,
+         "quality scaling: lowest values are %zu and %zu, expected 4 and 10",
+         decoder.min_beam_size(), decoder.min_cutoff_top_n());
+}
+
+// Feed data to decoder like feed(), with a time budget for each call, and
+// return the number of calls
+static size_t feed_with_budget(DecoderState& decoder, const TestData& data, double time_budget)
+{
+  const size_t class_dim = data.alphabet.GetSize() + 1;
+  const size_t time_dim = data.probs.size() / class_dim;
+  size_t num_calls = 0;
+  for (size_t t = 0; t < time_dim; t += FRAMES_PER_CALL, ++num_calls) {
+    decoder.next(&data.probs[t * class_dim],
+                 std::min(FRAMES_PER_CALL, time_dim - t),
+                 class_dim,
+                 time_budget);
+  }
+  return num_calls;
+}
+
+static void test_deadline(const TestData& data)
+{
+  const size_t BEAM_SIZE = 64;
+  const std::vector<Output> plain = decode_test_data(data, BEAM_SIZE, BEAM_SIZE);
+
+  // a budget that is never reached changes nothing
+  DecoderState relaxed;
+  init_decoder(relaxed, data, BEAM_SIZE);
+  feed_with_budget(relaxed, data, 1e6);
+  EXPECT(relaxed.deadline_hits() == 0, "deadline: %zu hits with a budget of 1e6 s",
+         relaxed.deadline_hits());
+  EXPECT(same_outputs(relaxed.decode(BEAM_SIZE), plain),
+         "deadline: a budget that isn't reached changes the results");
+
+  // one that is always exceeded narrows the beam of every call, from its
+  // second frame on, down to a single prefix
+  DecoderState hurried;
+  init_decoder(hurried, data, BEAM_SIZE);
+  const size_t num_calls = feed_with_budget(hurried, data, 1e-9);
+  EXPECT(hurried.deadline_hits() == num_calls,
+         "deadline: %zu hits in %zu calls exceeding their budget", hurried.deadline_hits(), num_calls);
+  const std::vector<Output> narrowed = hurried.decode(BEAM_SIZE);
+  EXPECT(narrowed.size() == 1 && !narrowed[0].tokens.empty(),
+         "deadline: %zu prefixes kept instead of one transcript", narrowed.size());
+}
+
+// Words of each final of lattice, and the timesteps they start at
+static void lattice_paths(const Lattice& lattice,
+                          std::vector<std::vector<std::string>>& words,
+                          std::vector<std::vector<unsigned int>>& starts,
+                          const Alphabet& alphabet)
+{
+  // the arc leading to each node, nodes having a single one
+  std::vector<const Lattice::Arc*> incoming(lattice.num_nodes, nullptr);
+  for (const Lattice::Arc& arc : lattice.arcs) {
+    incoming[arc.to] = &arc;
+  }
+  words.clear();
+  starts.clear();
+  for (const auto& final : lattice.finals) {
+    words.emplace_back();
+    starts.emplace_back();
+    for (const Lattice::Arc* arc = incoming[final.first]; arc; arc = incoming[arc->from]) {
+      words.back().insert(words.back().begin(), alphabet.Decode(arc->tokens));
+      starts.back().insert(starts.back().begin(), arc->start_timestep);
+    }
+  }
+}
+
+template<typename T>
+static T read_value(const std::string& bytes, size_t& offset)
+{
+  T value = T();
+  if (offset + sizeof(T) <= bytes.size()) {
+    memcpy(&value, &bytes[offset], sizeof(T));
+  }
+  offset += sizeof(T);
+  return value;
+}
+
+static void test_lattice_serialization(const Lattice& lattice, const Alphabet& alphabet)
+{
+  const std::string bytes = lattice.serialize(alphabet);
+  size_t offset = 0;
+  EXPECT(read_value<int32_t>(bytes, offset) == 0x4C415454, "lattice: bad magic");
+  EXPECT(read_value<int32_t>(bytes, offset) == 1, "lattice: bad version");
+  EXPECT(read_value<uint32_t>(bytes, offset) == lattice.num_nodes, "lattice: bad number of nodes");
+  const uint32_t num_arcs = read_value<uint32_t>(bytes, offset);
+  const uint32_t num_finals = read_value<uint32_t>(bytes, offset);
+  EXPECT(num_arcs == lattice.arcs.size() && num_finals == lattice.finals.size(),
+         "lattice: %u arcs and %u finals serialized, expected %zu and %zu",
+         num_arcs, num_finals, lattice.arcs.size(), lattice.finals.size());
+  for (uint32_t i = 0; i < num_arcs && i < lattice.arcs.size(); ++i) {
+    const Lattice::Arc& arc = lattice.arcs[i];
+    bool same = read_value<uint32_t>(bytes, offset) == arc.from;
+    same = read_value<uint32_t>(bytes, offset) == arc.to && same;
+    same = read_value<uint32_t>(bytes, offset) == arc.start_timestep && same;
+    same = read_value<uint32_t>(bytes, offset) == arc.end_timestep && same;
+    same = read_value<float>(bytes, offset) == arc.acoustic_score && same;
+    same = read_value<float>(bytes, offset) == arc.lm_score && same;
+    const uint32_t text_size = read_value<uint32_t>(bytes, offset);
+    same = bytes.compare(offset, text_size, alphabet.Decode(arc.tokens)) == 0 && same;
+    offset += text_size;
+    EXPECT(same, "lattice: arc %u serialized with other values", i);
+  }
+  for (uint32_t i = 0; i < num_finals && i < lattice.finals.size(); ++i) {
+    bool same = read_value<uint32_t>(bytes, offset) == lattice.finals[i].first;
+    same = read_value<double>(bytes, offset) == lattice.finals[i].second && same;
+    EXPECT(same, "lattice: final %u serialized with other values", i);
+  }
+  EXPECT(offset == bytes.size(), "lattice: %zu bytes serialized, %zu read", bytes.size(), offset);
+}
+
+// Check that the finals of lattice are the transcripts of results, in the
+// same order and with the same confidences, and that arcs start at the
+// first timestep of their word
+static void check_lattice(const Lattice& lattice,
+                          const std::vector<Output>& results,
+                          const Alphabet& alphabet,
+                          const char* name)
+{
+  EXPECT(lattice.finals.size() == results.size(), "lattice: %s: %zu finals for %zu results",
+         name, lattice.finals.size(), results.size());
+  std::vector<std::vector<std::string>> words;
+  std::vector<std::vector<unsigned int>> starts;
+  lattice_paths(lattice, words, starts, alphabet);
+  for (size_t i = 0; i < words.size() && i < results.size(); ++i) {
+    EXPECT(lattice.finals[i].second == results[i].confidence,
+           "lattice: %s: final %zu has a confidence of %f, decode() gives %f",
+           name, i, lattice.finals[i].second, results[i].confidence);
+    EXPECT(words[i] == split_words(alphabet.Decode(results[i].tokens)),
+           "lattice: %s: final %zu isn't \"%s\"", name, i, alphabet.Decode(results[i].tokens).c_str());
+
+    std::vector<unsigned int> expected_starts;
+    bool word_start = true;
+    for (size_t k = 0; k < results[i].tokens.size(); ++k) {
+      if (word_start) {
+        expected_starts.push_back(results[i].timesteps[k]);
+      }
+      word_start = alphabet.IsSpace(results[i].tokens[k]);
+    }
+    EXPECT(starts[i] == expected_starts, "lattice: %s: final %zu has words starting at other timesteps",
+           name, i);
+  }
+}
+
+static void test_lattice(const TestData& data)
+{
+  const size_t BEAM_SIZE = 64;
+  const size_t NUM_RESULTS = 20;
+  TestData noisy = data;
+  noisy.probs = make_test_probs(data.sentence, data.alphabet, 9, 0.5);
+
+  TestData without_scorer = noisy;
+  without_scorer.scorer = nullptr;
+  const TestData* inputs[] = {&noisy, &without_scorer};
+  for (const TestData* frames : inputs) {
+    const char* name = frames->scorer ? "with scorer" : "without scorer";
+    DecoderState decoder;
+    init_decoder(decoder, *frames, BEAM_SIZE);
+    feed(decoder, *frames);
+    const std::vector<Output> results = decoder.decode(NUM_RESULTS);
+    const Lattice lattice = decoder.decode_lattice(NUM_RESULTS);
+    check_lattice(lattice, results, frames->alphabet, name);
+
+    // a tree sharing the leading words of the transcripts
+    size_t num_words = 0;
+    for (const Output& output : results) {
+      num_words += split_words(frames->alphabet.Decode(output.tokens)).size();
+    }
+    std::vector<bool> reached(lattice.num_nodes, false);
+    reached[0] = true;
+    bool tree = true;
+    for (const Lattice::Arc& arc : lattice.arcs) {
+      tree = tree && arc.to < lattice.num_nodes && reached[arc.from] && !reached[arc.to];
+      if (arc.to < lattice.num_nodes) {
+        reached[arc.to] = true;
+      }
+    }
+    EXPECT(tree, "lattice: %s: arcs aren't a tree in topological order", name);
+    EXPECT(lattice.arcs.size() < num_words, "lattice: %s: %zu arcs for %zu words, none shared",
+           name, lattice.arcs.size(), num_words);
+    test_lattice_serialization(lattice, frames->alphabet);
+  }
+
+  // in greedy mode, the single transcript
+  DecoderState greedy;
+  init_decoder(greedy, noisy, BEAM_SIZE);
+  greedy.set_greedy(true);
+  feed(greedy, noisy);
+  check_lattice(greedy.decode_lattice(NUM_RESULTS), greedy.decode(NUM_RESULTS), noisy.alphabet, "greedy");
+}
+
+// Scorer of another random language model over the words of data
+static std::shared_ptr<Scorer> make_other_scorer(const TestData& data)
+{
+  const std::string arpa_path = test_file("ctc_beam_search_decoder_test_other.arpa");
+  const std::string lm_path = test_file("ctc_beam_search_decoder_test_other.binary");
+  const std::string package_path = test_file("ctc_beam_search_decoder_test_other.scorer");
+  write_test_arpa(arpa_path, data.words, ORDER, 12);
+  build_test_lm(arpa_path, lm_path);
+  auto scorer = std::make_shared<Scorer>();
+  if (!write_test_package(lm_path, package_path, data.alphabet, false, data.words, false, false) ||
+      scorer->init(package_path, data.alphabet) != DS_ERR_OK) {
+    return nullptr;
+  }
+  return scorer;
+}
+
+static void test_rescorer(const TestData& data)
+{
+  const size_t BEAM_SIZE = 64;
+  TestData noisy = data;
+  noisy.probs = make_test_probs(data.sentence, data.alphabet, 9, 0.5);
+  const std::vector<Output> plain = decode_test_data(noisy, BEAM_SIZE, BEAM_SIZE);
+  auto rescore = [&](std::shared_ptr<Scorer> rescorer, double alpha, double beta) {
+    return decode_test_data(noisy, BEAM_SIZE, BEAM_SIZE, [&](DecoderState& decoder) {
+      decoder.set_rescorer(rescorer);
+      decoder.set_rescorer_weights(alpha, beta);
+    });
+  };
+
+  EXPECT(same_outputs(rescore(nullptr, 0.0, 0.0), plain), "rescorer: none changes the results");
+
+  // The scorer of the search as rescorer swaps its scores for the same
+  // ones, summed in another order.
+  const std::vector<Output> same = rescore(data.scorer, data.scorer->alpha, data.scorer->beta);
+  bool same_ranking = same.size() == plain.size();
+  for (size_t i = 0; same_ranking && i < same.size(); ++i) {
+    same_ranking = same[i].tokens == plain[i].tokens &&
+                   std::fabs(same[i].confidence - plain[i].confidence) < 1e-3;
+  }
+  EXPECT(same_ranking, "rescorer: the scorer of the search rescores its results otherwise");
+
+  // Another language model reranks the results but leaves the search
+  // alone, so the whole beam holds the same transcripts.
+  std::shared_ptr<Scorer> other = make_other_scorer(data);
+  EXPECT(other != nullptr, "rescorer: can't make another scorer");
+  if (!other) {
+    return;
+  }
+  const std::vector<Output> rescored = rescore(other, other->alpha, other->beta);
+  std::set<std::vector<unsigned int>> plain_transcripts, rescored_transcripts;
+  bool changed = false, sorted = true;
+  for (size_t i = 0; i < plain.size() && i < rescored.size(); ++i) {
+    plain_transcripts.insert(plain[i].tokens);
+    rescored_transcripts.insert(rescored[i].tokens);
+    changed = changed || rescored[i].confidence != plain[i].confidence;
+    sorted = sorted && (i == 0 || rescored[i].confidence <= rescored[i - 1].confidence);
+  }
+  EXPECT(rescored.size() == plain.size() && rescored_transcripts == plain_transcripts,
+         "rescorer: rescoring changes the transcripts of the beam");
+  EXPECT(changed, "rescorer: another language model gives the same confidences");
+  EXPECT(sorted, "rescorer: results aren't ranked by rescored confidence");
+
+  // Without weight, the rescorer's language model doesn't matter.
+  const std::vector<Output> unweighted = rescore(other, 0.0, 0.0);
+  const std::vector<Output> unweighted_same = rescore(data.scorer, 0.0, 0.0);
+  bool same_confidences = unweighted.size() == unweighted_same.size();
+  for (size_t i = 0; same_confidences && i < unweighted.size(); ++i) {
+    same_confidences = unweighted[i].confidence == unweighted_same[i].confidence;
+  }
+  EXPECT(same_confidences, "rescorer: the scores of a rescorer without weight count");
+
+  // Lattices carry the rescored confidences.
+  DecoderState decoder;
+  init_decoder(decoder, noisy, BEAM_SIZE);
+  decoder.set_rescorer(other);
+  feed(decoder, noisy);
+  check_lattice(decoder.decode_lattice(20), decoder.decode(20), noisy.alphabet, "rescored");
+}
+
+int main()
+{
+  TestData data;
+  if (!make_test_data(data)) {
+    fprintf(stderr, "can't make test data\n");
+    return 1;
+  }
+  test_expansion_pool(data);
+  test_hot_words(data);
+  test_executor(data);
+  test_greedy(data);
+  test_beam_threshold(data);
+  test_quality_scaling(data);
+  test_deadline(data);
+  test_lattice(data);
+  test_rescorer(data);
+  return test_result();
+}
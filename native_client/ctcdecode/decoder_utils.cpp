@@ -4,6 +4,37 @@
 #include <cmath>
 #include <limits>
 
+float LOG_ADD_TABLE[LOG_ADD_TABLE_SIZE];
+
+namespace {
+
+struct LogAddTableInitializer {
+  LogAddTableInitializer() {
+    for (size_t i = 0; i < LOG_ADD_TABLE_SIZE; ++i) {
+      double d = static_cast<double>(i) / LOG_ADD_TABLE_RESOLUTION;
+      LOG_ADD_TABLE[i] = std::log1p(std::exp(-d));
+    }
+  }
+} log_add_table_initializer;
+
+}  // namespace
+
+void log_sum_exp_batch(const float *x,
+                       const float *y,
+                       float *out,
+                       size_t n,
+                       bool fast) {
+  if (fast) {
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = log_sum_exp_fast(x[i], y[i]);
+    }
+  } else {
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = log_sum_exp(x[i], y[i]);
+    }
+  }
+}
+
 std::vector<std::pair<size_t, float>> get_pruned_log_probs(
     const double *prob_step,
     size_t class_dim,
@@ -95,30 +126,6 @@ std::vector<std::string> split_str(const std::string &s,
   return result;
 }
 
-bool prefix_compare(const PathTrie *x, const PathTrie *y) {
-  if (x->score == y->score) {
-    if (x->character == y->character) {
-      return false;
-    } else {
-      return (x->character < y->character);
-    }
-  } else {
-    return x->score > y->score;
-  }
-}
-
-bool prefix_compare_external(const PathTrie *x, const PathTrie *y, const std::unordered_map<const PathTrie*, float>& scores) {
-  if (scores.at(x) == scores.at(y)) {
-    if (x->character == y->character) {
-      return false;
-    } else {
-      return (x->character < y->character);
-    }
-  } else {
-    return scores.at(x) > scores.at(y);
-  }
-}
-
 void add_word_to_fst(const std::vector<unsigned int> &word,
                      fst::StdVectorFst *dictionary) {
   if (dictionary->NumStates() == 0) {
@@ -136,27 +143,39 @@ void add_word_to_fst(const std::vector<unsigned int> &word,
   dictionary->SetFinal(dst, fst::StdArc::Weight::One());
 }
 
-bool add_word_to_dictionary(
+bool word_to_labels(
     const std::string &word,
     const std::unordered_map<std::string, int> &char_map,
     bool utf8,
     int SPACE_ID,
-    fst::StdVectorFst *dictionary) {
+    std::vector<unsigned int> *labels) {
   auto characters = utf8 ? split_into_bytes(word) : split_into_codepoints(word);
 
-  std::vector<unsigned int> int_word;
-
+  labels->clear();
   for (auto &c : characters) {
     auto int_c = char_map.find(c);
     if (int_c != char_map.end()) {
-      int_word.push_back(int_c->second);
+      labels->push_back(int_c->second);
     } else {
-      return false;  // return without adding
+      return false;
     }
   }
 
   if (!utf8) {
-    int_word.push_back(SPACE_ID);
+    labels->push_back(SPACE_ID);
+  }
+  return true;
+}
+
+bool add_word_to_dictionary(
+    const std::string &word,
+    const std::unordered_map<std::string, int> &char_map,
+    bool utf8,
+    int SPACE_ID,
+    fst::StdVectorFst *dictionary) {
+  std::vector<unsigned int> int_word;
+  if (!word_to_labels(word, char_map, utf8, SPACE_ID, &int_word)) {
+    return false;  // return without adding
   }
 
   add_word_to_fst(int_word, dictionary);
@@ -45,13 +45,47 @@ bool pair_comp_second_rev(const std::pair<T1, T2> &a,
 // Return the sum of two probabilities in log scale
 template <typename T>
 T log_sum_exp(const T &x, const T &y) {
-  static T num_min = -std::numeric_limits<T>::max();
+  const T num_min = -std::numeric_limits<T>::max();
   if (x <= num_min) return y;
   if (y <= num_min) return x;
   T xmax = std::max(x, y);
   return std::log(std::exp(x - xmax) + std::exp(y - xmax)) + xmax;
 }
 
+// log(1 + exp(-d)) tabulated for d in [0, LOG_ADD_TABLE_RANGE), with
+// LOG_ADD_TABLE_RESOLUTION entries per unit, see log_sum_exp_fast()
+const size_t LOG_ADD_TABLE_RESOLUTION = 64;
+const size_t LOG_ADD_TABLE_RANGE = 16;
+const size_t LOG_ADD_TABLE_SIZE = LOG_ADD_TABLE_RANGE * LOG_ADD_TABLE_RESOLUTION + 1;
+extern float LOG_ADD_TABLE[LOG_ADD_TABLE_SIZE];
+
+/* Approximate log_sum_exp() without calling exp or log, by interpolating
+ * log(1 + exp(-|x - y|)) linearly in LOG_ADD_TABLE. The absolute error is
+ * below 1e-5 (the interpolation error is bounded by 1/(32 * 64^2), and beyond
+ * the table the correction is below 1.2e-7), well under the precision that
+ * matters when ranking beams.
+ */
+inline float log_sum_exp_fast(float x, float y) {
+  const float num_min = -NUM_FLT_INF;
+  if (x <= num_min) return y;
+  if (y <= num_min) return x;
+  float xmax = std::max(x, y);
+  float d = xmax - std::min(x, y);
+  if (!(d < LOG_ADD_TABLE_RANGE)) return xmax;
+  float pos = d * LOG_ADD_TABLE_RESOLUTION;
+  size_t i = static_cast<size_t>(pos);
+  float frac = pos - i;
+  return xmax + LOG_ADD_TABLE[i] + frac * (LOG_ADD_TABLE[i+1] - LOG_ADD_TABLE[i]);
+}
+
+// Compute out[i] = log_sum_exp(x[i], y[i]) for i in [0, n), with the fast
+// approximation if fast is true
+void log_sum_exp_batch(const float *x,
+                       const float *y,
+                       float *out,
+                       size_t n,
+                       bool fast);
+
 // Get pruned probability vector for each time step's beam search
 std::vector<std::pair<size_t, float>> get_pruned_log_probs(
     const double *prob_step,
@@ -59,11 +93,6 @@ std::vector<std::pair<size_t, float>> get_pruned_log_probs(
     double cutoff_prob,
     size_t cutoff_top_n);
 
-// Functor for prefix comparsion
-bool prefix_compare(const PathTrie *x, const PathTrie *y);
-
-bool prefix_compare_external(const PathTrie *x, const PathTrie *y, const std::unordered_map<const PathTrie*, float>& scores);
-
 /* Get length of utf8 encoding string
  * See: http://stackoverflow.com/a/4063229
  */
@@ -95,6 +124,15 @@ inline bool byte_is_codepoint_boundary(unsigned char c) {
   return (c & 0xC0) != 0x80;
 }
 
+// Convert a word in string to the labels of the dictionary, false if one of
+// its characters isn't in char_map
+bool word_to_labels(
+    const std::string &word,
+    const std::unordered_map<std::string, int> &char_map,
+    bool utf8,
+    int SPACE_ID,
+    std::vector<unsigned int> *labels);
+
 // Add a word in string to dictionary
 bool add_word_to_dictionary(
     const std::string &word,
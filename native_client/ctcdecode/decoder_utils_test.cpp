@@ -0,0 +1,79 @@
+#include "decoder_utils.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Checks that log_sum_exp_fast() stays within its documented error of the
+// exact formula, and that log_sum_exp_batch() matches the scalar versions.
+
+static double exact_log_sum_exp(double x, double y)
+{
+  double xmax = std::max(x, y);
+  return xmax + std::log1p(std::exp(-std::fabs(x - y)));
+}
+
+static void test_fast_error()
+{
+  // d = |x - y| covers the table and beyond, at several magnitudes of x so
+  // that the rounding of xmax is included
+  const float bases[] = {0.f, -0.5f, -3.7f, -42.f, -1234.5f};
+  const int steps = 400000;
+  for (float x : bases) {
+    double max_error = 0.;
+    float worst = 0.f;
+    for (int i = 0; i <= steps; ++i) {
+      float d = i * 20.f / steps;
+      float y = x - d;
+      double error = std::fabs(log_sum_exp_fast(x, y) - exact_log_sum_exp(x, y));
+      // the float rounding of the result itself is not the approximation's
+      error -= std::fabs(x) * std::numeric_limits<float>::epsilon();
+      if (error > max_error) {
+        max_error = error;
+        worst = d;
+      }
+      EXPECT(log_sum_exp_fast(x, y) == log_sum_exp_fast(y, x),
+            "log_sum_exp_fast is not symmetric for x=%g y=%g", x, y);
+    }
+    EXPECT(max_error < 1e-5, "log_sum_exp_fast error %g at x=%g d=%g", max_error, x, worst);
+  }
+}
+
+static void test_infinities()
+{
+  const float inf = NUM_FLT_INF;
+  EXPECT(log_sum_exp_fast(-inf, -2.f) == -2.f, "-inf is not the identity");
+  EXPECT(log_sum_exp_fast(-2.f, -inf) == -2.f, "-inf is not the identity");
+  EXPECT(log_sum_exp_fast(-inf, -inf) == -inf, "-inf + -inf is not -inf");
+  EXPECT(log_sum_exp(-inf, -2.f) == -2.f, "-inf is not the identity");
+}
+
+static void test_batch()
+{
+  const size_t n = 10007;
+  std::vector<float> x(n), y(n), out(n);
+  for (size_t i = 0; i < n; ++i) {
+    x[i] = -(i % 977) * 0.013f;
+    y[i] = i % 101 == 0 ? -NUM_FLT_INF : -(i % 613) * 0.021f;
+  }
+  for (bool fast : {false, true}) {
+    log_sum_exp_batch(x.data(), y.data(), out.data(), n, fast);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < n; ++i) {
+      float expected = fast ? log_sum_exp_fast(x[i], y[i]) : log_sum_exp(x[i], y[i]);
+      mismatches += out[i] != expected;
+    }
+    EXPECT(mismatches == 0, "%zu batched %s results differ from the scalar ones",
+          mismatches, fast ? "fast" : "exact");
+  }
+}
+
+int main()
+{
+  test_fast_error();
+  test_infinities();
+  test_batch();
+  return test_result();
+}
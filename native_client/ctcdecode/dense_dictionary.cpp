@@ -0,0 +1,113 @@
+#include "dense_dictionary.h"
+
+#include <algorithm>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Ask for transparent huge pages for a buffer that hasn't been touched yet.
+// It's fine if the system doesn't provide them.
+static void
+advise_huge_pages(void* data, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+  const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = (reinterpret_cast<uintptr_t>(data) + page_size - 1) & ~(page_size - 1);
+  uintptr_t end = (reinterpret_cast<uintptr_t>(data) + size) & ~(page_size - 1);
+  if (begin < end) {
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+  }
+#endif
+}
+
+DenseDictionary::DenseDictionary(const FstType& dictionary)
+{
+  num_states_ = dictionary.NumStates();
+  start_ = dictionary.Start();
+
+  num_labels_ = 0;
+  for (StateId s = 0; s < num_states_; ++s) {
+    for (fst::ArcIterator<FstType> aiter(dictionary, s); !aiter.Done(); aiter.Next()) {
+      num_labels_ = std::max(num_labels_, static_cast<int32_t>(aiter.Value().ilabel) + 1);
+    }
+  }
+
+  set_region(fst::MappedFile::Allocate(region_size()));
+  StateId* transitions = reinterpret_cast<StateId*>(region_->mutable_data());
+  uint8_t* finals = reinterpret_cast<uint8_t*>(transitions + static_cast<size_t>(num_states_) * num_labels_);
+  std::fill(transitions, transitions + static_cast<size_t>(num_states_) * num_labels_, NO_STATE);
+  for (StateId s = 0; s < num_states_; ++s) {
+    for (fst::ArcIterator<FstType> aiter(dictionary, s); !aiter.Done(); aiter.Next()) {
+      const fst::StdArc& arc = aiter.Value();
+      transitions[static_cast<size_t>(s) * num_labels_ + arc.ilabel] = arc.nextstate;
+    }
+    finals[s] = dictionary.Final(s) != fst::TropicalWeight::Zero();
+  }
+}
+
+size_t
+DenseDictionary::region_size() const
+{
+  return static_cast<size_t>(num_states_) * num_labels_ * sizeof(StateId) + num_states_;
+}
+
+void
+DenseDictionary::set_region(fst::MappedFile* region)
+{
+  region_.reset(region);
+  transitions_ = reinterpret_cast<const StateId*>(region_->data());
+  finals_ = reinterpret_cast<const uint8_t*>(transitions_ + static_cast<size_t>(num_states_) * num_labels_);
+}
+
+DenseDictionary*
+DenseDictionary::Read(std::istream& strm,
+                      const std::string& source,
+                      bool memorymap,
+                      bool huge_pages)
+{
+  std::unique_ptr<DenseDictionary> dense(new DenseDictionary);
+  strm.read(reinterpret_cast<char*>(&dense->num_states_), sizeof(dense->num_states_));
+  strm.read(reinterpret_cast<char*>(&dense->num_labels_), sizeof(dense->num_labels_));
+  strm.read(reinterpret_cast<char*>(&dense->start_), sizeof(dense->start_));
+  if (!strm || dense->num_states_ < 0 || dense->num_labels_ < 0 ||
+      dense->start_ < 0 || dense->start_ >= dense->num_states_) {
+    return nullptr;
+  }
+
+  // the table is aligned in the file so that it can be mapped in place
+  if (!fst::AlignInput(strm)) {
+    return nullptr;
+  }
+  if (memorymap) {
+    fst::MappedFile* region = fst::MappedFile::Map(&strm, true, source, dense->region_size());
+    if (!region) {
+      return nullptr;
+    }
+    dense->set_region(region);
+  } else {
+    dense->set_region(fst::MappedFile::Allocate(dense->region_size()));
+    if (huge_pages) {
+      advise_huge_pages(dense->region_->mutable_data(), dense->region_size());
+    }
+    strm.read(reinterpret_cast<char*>(dense->region_->mutable_data()), dense->region_size());
+    if (!strm) {
+      return nullptr;
+    }
+  }
+  return dense.release();
+}
+
+bool
+DenseDictionary::Write(std::ostream& strm) const
+{
+  strm.write(reinterpret_cast<const char*>(&num_states_), sizeof(num_states_));
+  strm.write(reinterpret_cast<const char*>(&num_labels_), sizeof(num_labels_));
+  strm.write(reinterpret_cast<const char*>(&start_), sizeof(start_));
+  if (!fst::AlignOutput(strm)) {
+    return false;
+  }
+  strm.write(reinterpret_cast<const char*>(region_->data()), region_size());
+  return !strm.fail();
+}
@@ -0,0 +1,87 @@
+#ifndef DENSE_DICTIONARY_H_
+#define DENSE_DICTIONARY_H_
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "fst/fstlib.h"
+#include "fst/mapped-file.h"
+
+/* Vocabulary automaton stored as a direct-indexed transition table.
+ *
+ * The table has one row per state of the dictionary FST and one column per
+ * input label, so following a label is a single load instead of a binary
+ * search over the arcs of the state. State ids are those of the FST it was
+ * built from, which makes both representations interchangeable. The table
+ * grows with states x labels, so it only pays off for small alphabets such
+ * as the English one or the 255 labels of bytes output mode.
+ *
+ * Stored in its own section of scorer packages built with --dense_dictionary,
+ * memory mapped from the package when loading it, unless the scorer is read
+ * into memory.
+ */
+class DenseDictionary {
+public:
+  using FstType = fst::ConstFst<fst::StdArc>;
+  using StateId = int32_t;
+
+  // target of missing transitions
+  static const StateId NO_STATE = -1;
+
+  // Build the table of an epsilon-free, deterministic dictionary FST
+  explicit DenseDictionary(const FstType& dictionary);
+
+  // disallow copying
+  DenseDictionary(const DenseDictionary&) = delete;
+  DenseDictionary& operator=(const DenseDictionary&) = delete;
+
+  // Read a table written by Write(). With memorymap, it is mapped from the
+  // file source when the stream position allows it, otherwise it is read
+  // into memory, backed by transparent huge pages if huge_pages is set and
+  // the system supports them. Returns null on error.
+  static DenseDictionary* Read(std::istream& strm,
+                               const std::string& source,
+                               bool memorymap = true,
+                               bool huge_pages = false);
+
+  bool Write(std::ostream& strm) const;
+
+  StateId Start() const { return start_; }
+
+  bool IsFinal(StateId state) const { return finals_[state] != 0; }
+
+  // state reached by following label from state, NO_STATE if there is none
+  StateId Next(StateId state, int label) const {
+    if (label < 0 || label >= num_labels_) {
+      return NO_STATE;
+    }
+    return transitions_[static_cast<size_t>(state) * num_labels_ + label];
+  }
+
+  int32_t NumStates() const { return num_states_; }
+  int32_t NumLabels() const { return num_labels_; }
+
+  // the transitions and finals of the table, as one region of Size() bytes
+  const void* Data() const { return region_->data(); }
+  size_t Size() const { return region_size(); }
+
+private:
+  DenseDictionary() = default;
+
+  // size in bytes of the transitions and finals of the table
+  size_t region_size() const;
+  void set_region(fst::MappedFile* region);
+
+  int32_t num_states_ = 0;
+  int32_t num_labels_ = 0;
+  StateId start_ = NO_STATE;
+
+  // transitions (states x labels) followed by one final flag per state
+  std::unique_ptr<fst::MappedFile> region_;
+  const StateId* transitions_ = nullptr;
+  const uint8_t* finals_ = nullptr;
+};
+
+#endif  // DENSE_DICTIONARY_H_
@@ -0,0 +1,143 @@
+#include "dictionary_builder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <future>
+
+#include "ThreadPool.h"
+
+static size_t
+hash_combine(size_t seed, size_t value)
+{
+  return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+DictionaryBuilder::DictionaryBuilder()
+  : fst_(new fst::StdVectorFst)
+  , path_(1)
+{
+}
+
+void
+DictionaryBuilder::Add(const Word& word)
+{
+  assert(empty_ || !(word < previous_));
+  size_t prefix = 0;
+  while (prefix < word.size() && prefix < previous_.size() &&
+         word[prefix] == previous_[prefix]) {
+    ++prefix;
+  }
+
+  // The states of the previous word past the common prefix are complete
+  FreezeFrom(prefix);
+  for (size_t i = prefix; i < word.size(); ++i) {
+    path_.back().arcs.emplace_back(word[i], fst::kNoStateId);
+    path_.emplace_back();
+  }
+  path_.back().final = true;
+  previous_ = word;
+  empty_ = false;
+}
+
+std::unique_ptr<fst::StdVectorFst>
+DictionaryBuilder::Finish()
+{
+  if (!empty_) {
+    FreezeFrom(0);
+    fst_->SetStart(Freeze(path_[0]));
+  }
+  path_.clear();
+  register_.clear();
+  return std::move(fst_);
+}
+
+void
+DictionaryBuilder::FreezeFrom(size_t depth)
+{
+  while (path_.size() > depth + 1) {
+    StateId state = Freeze(path_.back());
+    path_.pop_back();
+    path_.back().arcs.back().second = state;
+  }
+}
+
+DictionaryBuilder::StateId
+DictionaryBuilder::Freeze(const PendingState& pending)
+{
+  size_t hash = pending.final;
+  for (const auto& arc : pending.arcs) {
+    hash = hash_combine(hash, arc.first);
+    hash = hash_combine(hash, arc.second);
+  }
+
+  // The states the arcs lead to are unique in the automaton, so equivalent
+  // states have the same arcs
+  const auto candidates = register_.equal_range(hash);
+  for (auto it = candidates.first; it != candidates.second; ++it) {
+    const StateId state = it->second;
+    if ((fst_->Final(state) == fst::StdArc::Weight::One()) != pending.final ||
+        fst_->NumArcs(state) != pending.arcs.size()) {
+      continue;
+    }
+    bool same = true;
+    size_t i = 0;
+    for (fst::ArcIterator<fst::StdVectorFst> aiter(*fst_, state); !aiter.Done(); aiter.Next(), ++i) {
+      const fst::StdArc& arc = aiter.Value();
+      if (arc.ilabel != pending.arcs[i].first || arc.nextstate != pending.arcs[i].second) {
+        same = false;
+        break;
+      }
+    }
+    if (same) {
+      return state;
+    }
+  }
+
+  const StateId state = fst_->AddState();
+  if (pending.final) {
+    fst_->SetFinal(state, fst::StdArc::Weight::One());
+  }
+  fst_->ReserveArcs(state, pending.arcs.size());
+  for (const auto& arc : pending.arcs) {
+    fst_->AddArc(state, fst::StdArc(arc.first, arc.first, fst::StdArc::Weight::One(), arc.second));
+  }
+  register_.emplace(hash, state);
+  return state;
+}
+
+void
+DictionaryBuilder::Sort(std::vector<Word>* words, size_t num_threads)
+{
+  num_threads = std::max<size_t>(1, std::min(num_threads, words->size()));
+  std::vector<size_t> bounds;
+  for (size_t i = 0; i <= num_threads; ++i) {
+    bounds.push_back(words->size() * i / num_threads);
+  }
+
+  // Sort the shards, then merge neighbours until one is left
+  ThreadPool pool(num_threads);
+  std::vector<std::future<void>> tasks;
+  for (size_t i = 0; i < num_threads; ++i) {
+    tasks.push_back(pool.enqueue([words, &bounds, i] {
+      std::sort(words->begin() + bounds[i], words->begin() + bounds[i + 1]);
+    }));
+  }
+  for (auto& task : tasks) {
+    task.get();
+  }
+  for (size_t width = 1; width < num_threads; width *= 2) {
+    tasks.clear();
+    for (size_t i = 0; i + width < num_threads; i += 2 * width) {
+      const size_t end = std::min(i + 2 * width, num_threads);
+      tasks.push_back(pool.enqueue([words, &bounds, i, width, end] {
+        std::inplace_merge(words->begin() + bounds[i],
+                           words->begin() + bounds[i + width],
+                           words->begin() + bounds[end]);
+      }));
+    }
+    for (auto& task : tasks) {
+      task.get();
+    }
+  }
+  words->erase(std::unique(words->begin(), words->end()), words->end());
+}
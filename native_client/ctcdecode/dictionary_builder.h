@@ -0,0 +1,71 @@
+#ifndef DICTIONARY_BUILDER_H_
+#define DICTIONARY_BUILDER_H_
+
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "fst/fstlib.h"
+
+/* Incremental construction of the minimal deterministic automaton of a
+ * vocabulary, after Daciuk et al., "Incremental Construction of Minimal
+ * Acyclic Finite-State Automata" (2000).
+ *
+ * Words must be added in lexicographic order of their labels. Once a word is
+ * added, the states of the previous word past their common prefix can't
+ * change anymore: each of them is merged with an equivalent state already in
+ * the automaton, or added to it otherwise. Only the states of the current
+ * word are kept aside, so the automaton is minimal at every step and memory
+ * stays proportional to it, unlike building a trie of the whole vocabulary
+ * and running RmEpsilon, Determinize and Minimize over it.
+ *
+ * The result accepts the same words as that pipeline, with the same number
+ * of states and arcs, and arcs sorted by label.
+ */
+class DictionaryBuilder {
+public:
+  using Word = std::vector<unsigned int>;
+  using StateId = fst::StdVectorFst::StateId;
+
+  DictionaryBuilder();
+
+  // disallow copying
+  DictionaryBuilder(const DictionaryBuilder&) = delete;
+  DictionaryBuilder& operator=(const DictionaryBuilder&) = delete;
+
+  // Add a word, not less than the previous one. Repeated words are ignored.
+  void Add(const Word& word);
+
+  // Complete the automaton of the words added so far. The builder can't be
+  // used anymore afterwards.
+  std::unique_ptr<fst::StdVectorFst> Finish();
+
+  // Sort words and remove duplicates, sorting shards of them on num_threads
+  // threads before merging them.
+  static void Sort(std::vector<Word>* words, size_t num_threads);
+
+private:
+  // a state of the current word, whose last arc leads to the next one
+  struct PendingState {
+    bool final = false;
+    std::vector<std::pair<unsigned int, StateId>> arcs;
+  };
+
+  // Add a state equivalent to pending to the automaton, unless there is one
+  // already, and return it
+  StateId Freeze(const PendingState& pending);
+
+  // Freeze the states of the current word deeper than depth
+  void FreezeFrom(size_t depth);
+
+  std::unique_ptr<fst::StdVectorFst> fst_;
+  // states of the current word, path_[0] being the start state
+  std::vector<PendingState> path_;
+  Word previous_;
+  bool empty_ = true;
+  // states of the automaton by hash of their final flag and arcs
+  std::unordered_multimap<size_t, StateId> register_;
+};
+
+#endif  // DICTIONARY_BUILDER_H_
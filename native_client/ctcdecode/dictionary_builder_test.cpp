@@ -0,0 +1,112 @@
+#include "dictionary_builder.h"
+#include "decoder_utils.h"
+#include "scorer.h"
+#include "test_util.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Checks that the dictionary built incrementally by DictionaryBuilder is
+// isomorphic to the one of the RmEpsilon, Determinize and Minimize pipeline
+// it replaces, with any number of threads and in both output modes.
+
+// The dictionary of words as built before DictionaryBuilder
+static std::unique_ptr<fst::StdVectorFst> reference_dictionary(const std::unordered_set<std::string>& words,
+                                                               const Alphabet& alphabet,
+                                                               bool utf8)
+{
+  std::unordered_map<std::string, int> char_map;
+  for (size_t i = 0; i < alphabet.GetSize(); ++i) {
+    char_map[alphabet.DecodeSingle(i)] = i + 1;
+  }
+  fst::StdVectorFst dictionary;
+  for (const std::string& word : words) {
+    if (word != "<s>" && word != "<unk>" && word != "</s>") {
+      add_word_to_dictionary(word, char_map, utf8, alphabet.GetSpaceLabel() + 1, &dictionary);
+    }
+  }
+  fst::RmEpsilon(&dictionary);
+  std::unique_ptr<fst::StdVectorFst> minimal(new fst::StdVectorFst);
+  fst::Determinize(dictionary, minimal.get());
+  fst::Minimize(minimal.get());
+  return minimal;
+}
+
+static void test_isomorphic(const std::unordered_set<std::string>& words,
+                            const Alphabet& alphabet,
+                            bool utf8)
+{
+  std::unique_ptr<fst::StdVectorFst> reference = reference_dictionary(words, alphabet, utf8);
+  for (size_t num_threads : {1, 3, 8}) {
+    Scorer scorer;
+    scorer.set_alphabet(alphabet);
+    scorer.set_utf8_mode(utf8);
+    scorer.fill_dictionary(words, num_threads);
+    fst::StdVectorFst built(*scorer.dictionary);
+    EXPECT(built.NumStates() == reference->NumStates(),
+           "%s mode, %zu threads: %d states instead of %d", utf8 ? "bytes" : "letters",
+           num_threads, built.NumStates(), reference->NumStates());
+    EXPECT(fst::Isomorphic(*reference, built),
+           "%s mode, %zu threads: dictionary isn't isomorphic to the reference",
+           utf8 ? "bytes" : "letters", num_threads);
+    EXPECT(built.Properties(fst::kILabelSorted, true) != 0,
+           "%s mode, %zu threads: arcs aren't sorted", utf8 ? "bytes" : "letters", num_threads);
+  }
+}
+
+static void test_builder()
+{
+  // repeated words are ignored, prefixes of words are words of their own
+  std::vector<DictionaryBuilder::Word> words = {
+    {3, 1, 2}, {1, 2}, {1}, {1, 2}, {3, 1, 2}, {2, 1, 2}, {1, 2, 3}
+  };
+  DictionaryBuilder::Sort(&words, 2);
+  EXPECT(words.size() == 5, "sorting kept %zu words instead of 5", words.size());
+  for (size_t i = 1; i < words.size(); ++i) {
+    EXPECT(words[i-1] < words[i], "words aren't sorted");
+  }
+
+  DictionaryBuilder builder;
+  for (const auto& word : words) {
+    builder.Add(word);
+    builder.Add(word);
+  }
+  std::unique_ptr<fst::StdVectorFst> dictionary = builder.Finish();
+  // the start state, the states after 1, 1 2 and 2 or 3, the state after
+  // 2 1 or 3 1, and the state without arcs 1 2 3, 2 1 2 and 3 1 2 end in
+  EXPECT(dictionary->NumStates() == 6, "%d states instead of 6", dictionary->NumStates());
+
+  // like the reference pipeline, an empty vocabulary has no states at all
+  DictionaryBuilder empty;
+  EXPECT(empty.Finish()->NumStates() == 0, "empty dictionary has states");
+}
+
+int main()
+{
+  Alphabet alphabet;
+  if (!make_test_alphabet(alphabet)) {
+    fprintf(stderr, "can't write alphabet\n");
+    return 1;
+  }
+  const std::vector<std::string> random_words = make_test_words(20000, 5);
+  std::unordered_set<std::string> words(random_words.begin(), random_words.end());
+  // prefixes of other words, the tokens the dictionary leaves out and words
+  // outside of the alphabet
+  for (const char* word : {"a", "ab", "abc", "abcd", "z", "<s>", "</s>", "<unk>", "naïve", "x-y"}) {
+    words.insert(word);
+  }
+  test_isomorphic(words, alphabet, false);
+
+  std::unordered_set<std::string> utf8_words(words);
+  for (const char* word : {"été", "straße", "日本語", "日本", "ünter", "ça"}) {
+    utf8_words.insert(word);
+  }
+  test_isomorphic(utf8_words, UTF8Alphabet(), true);
+  test_isomorphic(std::unordered_set<std::string>(), alphabet, false);
+
+  test_builder();
+  return test_result();
+}
@@ -0,0 +1,71 @@
+#include "hot_words.h"
+
+#include <algorithm>
+#include <map>
+
+HotWordTrie::HotWordTrie(const std::unordered_map<std::string, float>& hot_words,
+                         const Alphabet& alphabet)
+{
+  // Build a pointer-based trie first, then flatten it into sorted arc arrays
+  std::vector<std::map<unsigned int, StateId>> children(1);
+  word_boost_.assign(1, 0.f);
+  prefix_boost_.assign(1, 0.f);
+
+  for (const auto& hot_word : hot_words) {
+    if (hot_word.first.empty() || !alphabet.CanEncode(hot_word.first)) {
+      continue;
+    }
+    std::vector<unsigned int> labels = alphabet.Encode(hot_word.first);
+    if (std::find(labels.begin(), labels.end(), alphabet.GetSpaceLabel()) != labels.end()) {
+      continue;
+    }
+
+    const float boost = hot_word.second;
+    StateId state = root();
+    for (size_t depth = 1; depth <= labels.size(); ++depth) {
+      auto it = children[state].find(labels[depth-1]);
+      if (it == children[state].end()) {
+        StateId new_state = children.size();
+        children[state][labels[depth-1]] = new_state;
+        children.emplace_back();
+        word_boost_.push_back(0.f);
+        prefix_boost_.push_back(0.f);
+        state = new_state;
+      } else {
+        state = it->second;
+      }
+      // spread positive boosts linearly over the letters of the word
+      prefix_boost_[state] = std::max(prefix_boost_[state],
+                                      boost * depth / labels.size());
+    }
+    word_boost_[state] = boost;
+    ++num_words_;
+  }
+
+  first_arc_.reserve(children.size() + 1);
+  for (const auto& state_children : children) {
+    first_arc_.push_back(arcs_.size());
+    for (const auto& child : state_children) {
+      arcs_.push_back(Arc{child.first, child.second});
+    }
+  }
+  first_arc_.push_back(arcs_.size());
+}
+
+HotWordTrie::StateId
+HotWordTrie::next(StateId state, unsigned int label) const
+{
+  if (state == NO_STATE) {
+    return NO_STATE;
+  }
+  // hot-word lists are short, a linear scan over the few arcs is enough
+  for (size_t i = first_arc_[state]; i < first_arc_[state+1]; ++i) {
+    if (arcs_[i].label == label) {
+      return arcs_[i].nextstate;
+    }
+    if (arcs_[i].label > label) {
+      break;
+    }
+  }
+  return NO_STATE;
+}
@@ -0,0 +1,74 @@
+#ifndef HOT_WORDS_H_
+#define HOT_WORDS_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "alphabet.h"
+
+/* Immutable trie of hot-words over alphabet labels, compiled once from the
+ * hot-words map and shared by every decoder that uses it.
+ *
+ * Each PathTrie node records the trie state reached by the word it is
+ * currently spelling, so the decoder steps through both tries together and
+ * never builds strings to look hot-words up. Besides the boost of a complete
+ * hot-word, every state carries a partial boost credited to paths that spell
+ * a prefix of a positively boosted hot-word, which keeps them alive during
+ * pruning before the word is finished. The partial boost is withdrawn as soon
+ * as the path leaves the trie.
+ */
+class HotWordTrie {
+public:
+  using StateId = int;
+
+  // state of paths that do not spell a prefix of any hot-word
+  static const StateId NO_STATE = -1;
+
+  /* Build the trie
+   *
+   * Parameters:
+   *     hot_words: A map of hot-words and their corresponding boosts.
+   *     alphabet: The alphabet, words it can't encode and words containing
+   *               a space are skipped.
+   */
+  HotWordTrie(const std::unordered_map<std::string, float>& hot_words,
+              const Alphabet& alphabet);
+
+  // disallow copying
+  HotWordTrie(const HotWordTrie&) = delete;
+  HotWordTrie& operator=(const HotWordTrie&) = delete;
+
+  StateId root() const { return 0; }
+
+  // state reached after appending label, NO_STATE if this leaves the trie
+  StateId next(StateId state, unsigned int label) const;
+
+  // boost of the hot-word ending at state, zero if there is none
+  float word_boost(StateId state) const {
+    return state == NO_STATE ? 0.f : word_boost_[state];
+  }
+
+  // boost credited to a path that has spelled state so far
+  float prefix_boost(StateId state) const {
+    return state == NO_STATE ? 0.f : prefix_boost_[state];
+  }
+
+  // number of hot-words in the trie
+  size_t size() const { return num_words_; }
+
+private:
+  struct Arc {
+    unsigned int label;
+    StateId nextstate;
+  };
+
+  // arcs of state s are arcs_[first_arc_[s], first_arc_[s+1]), sorted by label
+  std::vector<size_t> first_arc_;
+  std::vector<Arc> arcs_;
+  std::vector<float> word_boost_;
+  std::vector<float> prefix_boost_;
+  size_t num_words_ = 0;
+};
+
+#endif  // HOT_WORDS_H_
@@ -0,0 +1,38 @@
+#include "lattice.h"
+
+#include <cstdint>
+
+static const int32_t MAGIC = 0x4C415454; // 'LATT'
+static const int32_t FILE_VERSION = 1;
+
+template<typename T>
+static void append(std::string& out, T value)
+{
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+std::string Lattice::serialize(const Alphabet& alphabet) const
+{
+  std::string out;
+  append<int32_t>(out, MAGIC);
+  append<int32_t>(out, FILE_VERSION);
+  append<uint32_t>(out, num_nodes);
+  append<uint32_t>(out, arcs.size());
+  append<uint32_t>(out, finals.size());
+  for (const Arc& arc : arcs) {
+    append<uint32_t>(out, arc.from);
+    append<uint32_t>(out, arc.to);
+    append<uint32_t>(out, arc.start_timestep);
+    append<uint32_t>(out, arc.end_timestep);
+    append<float>(out, arc.acoustic_score);
+    append<float>(out, arc.lm_score);
+    std::string text = alphabet.Decode(arc.tokens);
+    append<uint32_t>(out, text.size());
+    out.append(text);
+  }
+  for (const auto& final : finals) {
+    append<uint32_t>(out, final.first);
+    append<double>(out, final.second);
+  }
+  return out;
+}
@@ -0,0 +1,48 @@
+#ifndef LATTICE_H_
+#define LATTICE_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "alphabet.h"
+
+/* Word lattice of the best transcripts of a decoder: a tree of words rooted
+ * at node 0 where transcripts share their common leading words. Arcs are in
+ * topological order, and each transcript ends at a final node with its
+ * confidence, as returned by DecoderState::decode().
+ */
+struct Lattice {
+    // A word, leading from one node to another
+    struct Arc {
+        unsigned int from;
+        unsigned int to;
+        // labels of the word, without the space ending it
+        std::vector<unsigned int> tokens;
+        // timesteps of the first token and of the one ending the word
+        unsigned int start_timestep;
+        unsigned int end_timestep;
+        // log probability of the labels of the word, and of the space ending
+        // it, at the timestep each of them is emitted at
+        float acoustic_score;
+        // natural log probability of the word given by the language model,
+        // not scaled by alpha, zero without scorer
+        float lm_score;
+    };
+
+    unsigned int num_nodes = 1;
+    std::vector<Arc> arcs;
+    std::vector<std::pair<unsigned int, double>> finals;
+
+    /* Serialize into a compact binary form, with host byte order:
+     *     int32 magic 'LATT', int32 version,
+     *     uint32 number of nodes, uint32 number of arcs, uint32 number of finals,
+     *     per arc: uint32 from, uint32 to, uint32 start timestep,
+     *              uint32 end timestep, float32 acoustic score,
+     *              float32 LM score, uint32 text size, UTF-8 text,
+     *     per final: uint32 node, float64 confidence.
+    */
+    std::string serialize(const Alphabet& alphabet) const;
+};
+
+#endif  // LATTICE_H_
@@ -9,23 +9,21 @@
 #include "decoder_utils.h"
 
 PathTrie::PathTrie() {
-  log_prob_b_prev = -NUM_FLT_INF;
-  log_prob_nb_prev = -NUM_FLT_INF;
-  log_prob_b_cur = -NUM_FLT_INF;
-  log_prob_nb_cur = -NUM_FLT_INF;
+  beam_id = 0;
   log_prob_c = -NUM_FLT_INF;
-  score = -NUM_FLT_INF;
 
   ROOT_ = -1;
   character = ROOT_;
   exists_ = true;
   parent = nullptr;
+  hot_word_state = 0;
+  lookahead = 0.f;
+  word_index = NO_WORD_INDEX;
+  codepoint_length = 0;
+  codepoint_bytes = 0;
+  codepoint = 0;
 
-  dictionary_ = nullptr;
   dictionary_state_ = 0;
-  has_dictionary_ = false;
-
-  matcher_ = nullptr;
 }
 
 PathTrie::~PathTrie() {
@@ -34,7 +32,86 @@ PathTrie::~PathTrie() {
   }
 }
 
-PathTrie* PathTrie::get_path_trie(unsigned int new_char, float cur_log_prob_c, bool reset) {
+// Find the arc leaving state with the given input label. The dictionary is
+// input label sorted, so this is a binary search over the arcs of state,
+// done without a matcher so that nothing has to be allocated per decoder.
+static bool find_dictionary_arc(const PathTrie::FstType& dictionary,
+                                PathTrie::FstType::StateId state,
+                                PathTrie::FstType::Arc::Label label,
+                                PathTrie::FstType::StateId* nextstate) {
+  fst::ArcIterator<PathTrie::FstType> aiter(dictionary, state);
+  size_t low = 0;
+  size_t high = dictionary.NumArcs(state);
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    aiter.Seek(mid);
+    const PathTrie::FstType::Arc& arc = aiter.Value();
+    if (arc.ilabel < label) {
+      low = mid + 1;
+    } else if (arc.ilabel > label) {
+      high = mid;
+    } else {
+      *nextstate = arc.nextstate;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Follow label from state in the dictionary, in the dense table if there is
+// one and in the FST otherwise
+static bool next_dictionary_state(const PathTrie::Dictionary& dictionary,
+                                  PathTrie::FstType::StateId state,
+                                  PathTrie::FstType::Arc::Label label,
+                                  PathTrie::FstType::StateId* nextstate) {
+  if (dictionary.dense) {
+    *nextstate = dictionary.dense->Next(state, label);
+    return *nextstate != DenseDictionary::NO_STATE;
+  }
+  return find_dictionary_arc(*dictionary.fst, state, label, nextstate);
+}
+
+static bool is_final_dictionary_state(const PathTrie::Dictionary& dictionary,
+                                      PathTrie::FstType::StateId state) {
+  if (dictionary.dense) {
+    return dictionary.dense->IsFinal(state);
+  }
+  return dictionary.fst->Final(state) != fst::TropicalWeight::Zero();
+}
+
+// Decode the byte of a new node, following the decoding of its parent, so
+// that codepoint boundaries are known without walking back the prefix
+static void decode_utf8_byte(const PathTrie& parent, PathTrie* node) {
+  const unsigned char byte = node->character + 1;
+  if (byte_is_codepoint_boundary(byte)) {
+    if ((byte >> 7) == 0x00) {
+      node->codepoint_length = 1;
+      node->codepoint = byte;
+    } else if ((byte >> 5) == 0x06) {
+      node->codepoint_length = 2;
+      node->codepoint = byte & 0x1F;
+    } else if ((byte >> 4) == 0x0E) {
+      node->codepoint_length = 3;
+      node->codepoint = byte & 0x0F;
+    } else if ((byte >> 3) == 0x1E) {
+      node->codepoint_length = 4;
+      node->codepoint = byte & 0x07;
+    }
+    node->codepoint_bytes = 1;
+  } else if (!parent.is_empty()) {
+    // continuation byte, counted up to 255 as longer runs are no codepoint
+    // either
+    node->codepoint_length = parent.codepoint_length;
+    node->codepoint_bytes = std::min(parent.codepoint_bytes + 1, 0xFF);
+    node->codepoint = (parent.codepoint << 6) | (byte & 0x3F);
+  }
+}
+
+PathTrie* PathTrie::get_path_trie(BeamTable& beams,
+                                  const Dictionary& dictionary,
+                                  unsigned int new_char,
+                                  float cur_log_prob_c,
+                                  bool reset) {
   auto child = children_.begin();
   for (; child != children_.end(); ++child) {
     if (child->first == new_char) {
@@ -44,45 +121,40 @@ PathTrie* PathTrie::get_path_trie(unsigned int new_char, float cur_log_prob_c, b
   if (child != children_.end()) {
     if (!child->second->exists_) {
       child->second->exists_ = true;
-      child->second->log_prob_b_prev = -NUM_FLT_INF;
-      child->second->log_prob_nb_prev = -NUM_FLT_INF;
-      child->second->log_prob_b_cur = -NUM_FLT_INF;
-      child->second->log_prob_nb_cur = -NUM_FLT_INF;
+      beams.reset(child->second->beam_id);
     }
     return child->second;
   } else {
-    if (has_dictionary_) {
-      matcher_->SetState(dictionary_state_);
-      bool found = matcher_->Find(new_char + 1);
+    if (dictionary) {
+      FstType::StateId nextstate;
+      bool found = next_dictionary_state(dictionary, dictionary_state_, new_char + 1, &nextstate);
       if (!found) {
         // Adding this character causes word outside dictionary
-        auto FSTZERO = fst::TropicalWeight::Zero();
-        auto final_weight = dictionary_->Final(dictionary_state_);
-        bool is_final = (final_weight != FSTZERO);
+        bool is_final = is_final_dictionary_state(dictionary, dictionary_state_);
         if (is_final && reset) {
-          dictionary_state_ = dictionary_->Start();
+          dictionary_state_ = dictionary.fst->Start();
         }
         return nullptr;
       } else {
         PathTrie* new_path = new PathTrie;
         new_path->character = new_char;
         new_path->parent = this;
-        new_path->dictionary_ = dictionary_;
-        new_path->has_dictionary_ = true;
-        new_path->matcher_ = matcher_;
         new_path->log_prob_c = cur_log_prob_c;
+        new_path->beam_id = beams.allocate(new_path, new_char);
+        decode_utf8_byte(*this, new_path);
 
         // set spell checker state
         // check to see if next state is final
-        auto FSTZERO = fst::TropicalWeight::Zero();
-        auto final_weight = dictionary_->Final(matcher_->Value().nextstate);
-        bool is_final = (final_weight != FSTZERO);
+        bool is_final = is_final_dictionary_state(dictionary, nextstate);
         if (is_final && reset) {
           // restart spell checker at the start state
-          new_path->dictionary_state_ = dictionary_->Start();
+          new_path->dictionary_state_ = dictionary.fst->Start();
         } else {
           // go to next state
-          new_path->dictionary_state_ = matcher_->Value().nextstate;
+          new_path->dictionary_state_ = nextstate;
+        }
+        if (dictionary.lookahead) {
+          new_path->lookahead = dictionary.lookahead[new_path->dictionary_state_];
         }
 
         children_.push_back(std::make_pair(new_char, new_path));
@@ -93,6 +165,8 @@ PathTrie* PathTrie::get_path_trie(unsigned int new_char, float cur_log_prob_c, b
       new_path->character = new_char;
       new_path->parent = this;
       new_path->log_prob_c = cur_log_prob_c;
+      new_path->beam_id = beams.allocate(new_path, new_char);
+      decode_utf8_byte(*this, new_path);
       children_.push_back(std::make_pair(new_char, new_path));
       return new_path;
     }
@@ -100,44 +174,37 @@ PathTrie* PathTrie::get_path_trie(unsigned int new_char, float cur_log_prob_c, b
 }
 
 void PathTrie::get_path_vec(std::vector<unsigned int>& output) {
-  // Recursive call: recurse back until stop condition, then append data in
-  // correct order as we walk back down the stack in the lines below.
-  if (parent != nullptr) {
-    parent->get_path_vec(output);
+  // Walk up to the root to size the output, then fill it backwards
+  size_t length = 0;
+  for (PathTrie* node = this; node->character != ROOT_; node = node->parent) {
+    ++length;
   }
-  if (character != ROOT_) {
-    output.push_back(character);
+  size_t end = output.size() + length;
+  output.resize(end);
+  for (PathTrie* node = this; node->character != ROOT_; node = node->parent) {
+    output[--end] = node->character;
   }
 }
 
-PathTrie* PathTrie::get_prev_grapheme(std::vector<unsigned int>& output,
-                                      const Alphabet& alphabet)
+PathTrie* PathTrie::get_prev_grapheme(std::vector<unsigned int>& output)
 {
-  PathTrie* stop = this;
   if (character == ROOT_) {
-    return stop;
-  }
-  // Recursive call: recurse back until stop condition, then append data in
-  // correct order as we walk back down the stack in the lines below.
-  if (!byte_is_codepoint_boundary(alphabet.DecodeSingle(character)[0])) {
-    stop = parent->get_prev_grapheme(output, alphabet);
+    return this;
   }
-  output.push_back(character);
-  return stop;
-}
-
-int PathTrie::distance_to_codepoint_boundary(unsigned char *first_byte,
-                                             const Alphabet& alphabet)
-{
-  if (byte_is_codepoint_boundary(alphabet.DecodeSingle(character)[0])) {
-    *first_byte = (unsigned char)character + 1;
-    return 1;
+  // Walk back to the leading byte, or to the root if there is none, then
+  // append the bytes from there on
+  PathTrie* stop = this;
+  size_t length = 1;
+  while (!byte_is_codepoint_boundary(stop->character + 1) && stop->parent->character != ROOT_) {
+    stop = stop->parent;
+    ++length;
   }
-  if (parent != nullptr && parent->character != ROOT_) {
-    return 1 + parent->distance_to_codepoint_boundary(first_byte, alphabet);
+  size_t end = output.size() + length;
+  output.resize(end);
+  for (PathTrie* node = this; length > 0; node = node->parent, --length) {
+    output[--end] = node->character;
   }
-  assert(false); // unreachable
-  return 0;
+  return byte_is_codepoint_boundary(stop->character + 1) ? stop : stop->parent;
 }
 
 PathTrie* PathTrie::get_prev_word(std::vector<unsigned int>& output,
@@ -156,21 +223,13 @@ PathTrie* PathTrie::get_prev_word(std::vector<unsigned int>& output,
   return stop;
 }
 
-void PathTrie::iterate_to_vec(std::vector<PathTrie*>& output) {
+void PathTrie::iterate_to_vec(std::vector<BeamTable::BeamId>& output) {
   // previous_timesteps might point to ancestors' timesteps
   // therefore, children must be uptaded first
   for (auto child : children_) {
     child.second->iterate_to_vec(output);
   }
   if (exists_) {
-    log_prob_b_prev = log_prob_b_cur;
-    log_prob_nb_prev = log_prob_nb_cur;
-
-    log_prob_b_cur = -NUM_FLT_INF;
-    log_prob_nb_cur = -NUM_FLT_INF;
-
-    score = log_sum_exp(log_prob_b_prev, log_prob_nb_prev);
-
     if (previous_timesteps != nullptr) {
       timesteps = nullptr;
       for (auto const& child : previous_timesteps->children) {
@@ -182,14 +241,15 @@ void PathTrie::iterate_to_vec(std::vector<PathTrie*>& output) {
       if (timesteps == nullptr) {
           timesteps = add_child(previous_timesteps, new_timestep);
       }
+      log_prob_c = new_log_prob_c;
     }
     previous_timesteps = nullptr;
 
-    output.push_back(this);
+    output.push_back(beam_id);
   }
 }
 
-void PathTrie::remove() {
+void PathTrie::remove(BeamTable& beams) {
   exists_ = false;
 
   if (children_.size() == 0) {
@@ -201,23 +261,14 @@ void PathTrie::remove() {
     }
 
     if (parent->children_.size() == 0 && !parent->exists_) {
-      parent->remove();
+      parent->remove(beams);
     }
 
+    beams.release(beam_id);
     delete this;
   }
 }
 
-void PathTrie::set_dictionary(std::shared_ptr<PathTrie::FstType> dictionary) {
-  dictionary_ = dictionary;
-  dictionary_state_ = dictionary_->Start();
-  has_dictionary_ = true;
-}
-
-void PathTrie::set_matcher(std::shared_ptr<fst::SortedMatcher<FstType>> matcher) {
-  matcher_ = matcher;
-}
-
 #ifdef DEBUG
 void PathTrie::vec(std::vector<PathTrie*>& out) {
   if (parent != nullptr) {
@@ -2,6 +2,7 @@
 #define PATH_TRIE_H
 
 #include <algorithm>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <utility>
@@ -9,6 +10,8 @@
 
 #include "fst/fstlib.h"
 #include "alphabet.h"
+#include "beam_table.h"
+#include "dense_dictionary.h"
 #include "object_pool.h"
 
 /* Tree structure with parent and children information
@@ -39,77 +42,113 @@ std::vector<DataT> get_history(TreeNode<DataT> const* tree_node, TreeNode<DataT>
 using TimestepTreeNode = TreeNode<unsigned int>;
 
 /* Trie tree for prefix storing and manipulating, with a dictionary in
- * finite-state transducer for spelling correction.
+ * finite-state transducer for spelling correction. The scores of each node
+ * live in a BeamTable, at the node's beam_id.
  */
 class PathTrie {
 public:
   using FstType = fst::ConstFst<fst::StdArc>;
 
+  // Dictionary owned by the Scorer, transitions are looked up in the dense
+  // table when the scorer package has one. Both pointers null if there is no
+  // dictionary.
+  struct Dictionary {
+    const FstType* fst = nullptr;
+    const DenseDictionary* dense = nullptr;
+    // best unigram score below each state, null if there is none
+    const float* lookahead = nullptr;
+
+    explicit operator bool() const { return fst != nullptr; }
+  };
+
+  // word_index of prefixes whose word hasn't been looked up
+  static const unsigned int NO_WORD_INDEX = std::numeric_limits<unsigned int>::max();
+
   PathTrie();
   ~PathTrie();
 
   // get new prefix after appending new char
-  PathTrie* get_path_trie(unsigned int new_char, float log_prob_c, bool reset = true);
+  PathTrie* get_path_trie(BeamTable& beams,
+                          const Dictionary& dictionary,
+                          unsigned int new_char,
+                          float log_prob_c,
+                          bool reset = true);
 
   // get the prefix data in correct time order from root to current node
   void get_path_vec(std::vector<unsigned int>& output);
 
-  // get the prefix data in correct time order from beginning of last grapheme to current node
-  PathTrie* get_prev_grapheme(std::vector<unsigned int>& output,
-                              const Alphabet& alphabet);
+  // get the prefix data in correct time order from beginning of last grapheme
+  // to current node, labels being bytes
+  PathTrie* get_prev_grapheme(std::vector<unsigned int>& output);
 
-  // get the distance from current node to the first codepoint boundary, and the byte value at the boundary
-  int distance_to_codepoint_boundary(unsigned char *first_byte, const Alphabet& alphabet);
+  // whether the prefix ends with a complete codepoint, labels being bytes
+  bool ends_codepoint() const {
+    return codepoint_length != 0 && codepoint_bytes == codepoint_length;
+  }
 
   // get the prefix data in correct time order from beginning of last word to current node
   PathTrie* get_prev_word(std::vector<unsigned int>& output,
                           const Alphabet& alphabet);
 
-  // update log probs
-  void iterate_to_vec(std::vector<PathTrie*>& output);
+  // collect the beam ids of the existing prefixes, children first, and update
+  // their timesteps
+  void iterate_to_vec(std::vector<BeamTable::BeamId>& output);
 
-  // set dictionary for FST
-  void set_dictionary(std::shared_ptr<FstType> dictionary);
+  // set state of the dictionary FST reached by this prefix
+  void set_dictionary_state(FstType::StateId state) { dictionary_state_ = state; }
+  FstType::StateId dictionary_state() const { return dictionary_state_; }
 
-  void set_matcher(std::shared_ptr<fst::SortedMatcher<FstType>>);
-
-  bool is_empty() { return ROOT_ == character; }
+  bool is_empty() const { return ROOT_ == character; }
 
   // remove current path from root
-  void remove();
+  void remove(BeamTable& beams);
 
 #ifdef DEBUG
   void vec(std::vector<PathTrie*>& out);
   void print(const Alphabet& a);
 #endif // DEBUG
 
-  float log_prob_b_prev;
-  float log_prob_nb_prev;
-  float log_prob_b_cur;
-  float log_prob_nb_cur;
+  BeamTable::BeamId beam_id;
+  // log probability of character at the timestep it is emitted at in
+  // timesteps
   float log_prob_c;
-  float score;
-  float approx_ctc;
   unsigned int character;
   TimestepTreeNode* timesteps = nullptr;
 
   // timestep temporary storage for each decoding step. 
   TimestepTreeNode* previous_timesteps = nullptr; 
   unsigned int new_timestep;
+  float new_log_prob_c;
+
+  // state of the hot-word trie reached by the word this prefix is spelling
+  int hot_word_state;
+
+  // best unigram score of a word completing the one this prefix is spelling,
+  // or of any word at word boundaries. Zero without dictionary look-ahead.
+  float lookahead;
+
+  // index in the vocabulary of the language model of the word ending at this
+  // prefix, set by the Scorer when it is first scored in word based LMs
+  unsigned int word_index;
+
+  // UTF-8 decoding of the prefix when labels are bytes, as with UTF8Alphabet:
+  // the length of the codepoint the last byte belongs to, or zero if it
+  // doesn't start with a valid leading byte, how many of its bytes the
+  // prefix ends with, and its value decoded from them
+  uint8_t codepoint_length;
+  uint8_t codepoint_bytes;
+  uint32_t codepoint;
 
   PathTrie* parent;
 
 private:
   int ROOT_;
   bool exists_;
-  bool has_dictionary_;
 
   std::vector<std::pair<unsigned int, PathTrie*>> children_;
 
-  // pointer to dictionary of FST
-  std::shared_ptr<FstType> dictionary_;
+  // state of the dictionary FST, which is owned by the Scorer
   FstType::StateId dictionary_state_;
-  std::shared_ptr<fst::SortedMatcher<FstType>> matcher_;
 };
 
 // TreeNode implementation
@@ -120,18 +159,19 @@ TreeNode<NodeDataT>* add_child(TreeNode<NodeDataT>* tree_node, ChildDataT&& data
     return tree_node->children.back().get();
 }
 
-template<class DataT>
-void get_history_helper(TreeNode<DataT> const* tree_node, TreeNode<DataT> const* root, std::vector<DataT>* output) {
-    if (tree_node == root) return;
-    assert(tree_node != nullptr);
-    assert(tree_node->parent != tree_node);
-    get_history_helper(tree_node->parent, root, output);
-    output->push_back(tree_node->data);
-}
 template<class DataT>
 std::vector<DataT> get_history(TreeNode<DataT> const* tree_node, TreeNode<DataT> const* root) {
-    std::vector<DataT> output;
-    get_history_helper(tree_node, root, &output);
+    // Walk up to the root to size the output, then fill it backwards
+    size_t length = 0;
+    for (TreeNode<DataT> const* node = tree_node; node != root; node = node->parent) {
+        assert(node != nullptr);
+        assert(node->parent != node);
+        ++length;
+    }
+    std::vector<DataT> output(length);
+    for (TreeNode<DataT> const* node = tree_node; node != root; node = node->parent) {
+        output[--length] = node->data;
+    }
     return output;
 }
 
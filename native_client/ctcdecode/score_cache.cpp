@@ -0,0 +1,157 @@
+#include "score_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "util/murmur_hash.hh"
+
+// Number of stripes of the statistics, must be a power of two
+static const size_t NUM_STRIPES = 64;
+
+// shape of empty entries, no n-gram is empty
+static const uint32_t EMPTY_SHAPE = 0;
+
+static uint32_t
+ngram_shape(size_t length, bool bos, bool eos)
+{
+  return static_cast<uint32_t>(length) | (bos ? 1 << 8 : 0) | (eos ? 1 << 9 : 0);
+}
+
+void
+ScoreCache::resize(size_t num_entries)
+{
+  entries_.reset();
+  counters_.reset();
+  num_entries_ = 0;
+  if (num_entries == 0) {
+    return;
+  }
+
+  entries_.reset(new Entry[num_entries]);
+  for (size_t i = 0; i < num_entries; ++i) {
+    entries_[i].sequence.store(0, std::memory_order_relaxed);
+    entries_[i].shape.store(EMPTY_SHAPE, std::memory_order_relaxed);
+    for (size_t j = 0; j < MAX_NGRAM_LENGTH; ++j) {
+      entries_[i].words[j].store(0, std::memory_order_relaxed);
+    }
+    entries_[i].score.store(0, std::memory_order_relaxed);
+  }
+  counters_.reset(new Counters[NUM_STRIPES]);
+  num_entries_ = num_entries;
+  reset_stats();
+}
+
+ScoreCache::Counters&
+ScoreCache::thread_counters()
+{
+  static std::atomic<size_t> next_stripe(0);
+  thread_local const size_t stripe =
+    next_stripe.fetch_add(1, std::memory_order_relaxed) & (NUM_STRIPES - 1);
+  return counters_[stripe];
+}
+
+uint64_t
+ScoreCache::hash_ngram(const lm::WordIndex* words, size_t length, bool bos, bool eos)
+{
+  // Only picks the slot of the n-gram, entries keep all of its words. The
+  // flags are hashed along with its words rather than as the seed, which
+  // MurmurHash only xors with the data of short keys.
+  lm::WordIndex context[MAX_NGRAM_LENGTH];
+  context[0] = (bos ? 1 : 0) | (eos ? 2 : 0);
+  std::copy(words, words + length - 1, context + 1);
+  const uint64_t state = util::MurmurHashNative(context, length * sizeof(lm::WordIndex));
+  return state ^ (words[length - 1] * 0x9E3779B97F4A7C15ULL);
+}
+
+bool
+ScoreCache::find(const lm::WordIndex* words,
+                 size_t length,
+                 bool bos,
+                 bool eos,
+                 float* score)
+{
+  if (!enabled() || length == 0 || length > MAX_NGRAM_LENGTH) {
+    return false;
+  }
+
+  const Entry& entry = entries_[hash_ngram(words, length, bos, eos) % num_entries_];
+  const uint32_t sequence = entry.sequence.load(std::memory_order_acquire);
+  bool hit = (sequence & 1) == 0 &&
+             entry.shape.load(std::memory_order_relaxed) == ngram_shape(length, bos, eos);
+  for (size_t i = 0; hit && i < length; ++i) {
+    hit = entry.words[i].load(std::memory_order_relaxed) == words[i];
+  }
+  const uint32_t bits = entry.score.load(std::memory_order_relaxed);
+  // an insert that began while the entry was read changed its sequence
+  std::atomic_thread_fence(std::memory_order_acquire);
+  hit = hit && entry.sequence.load(std::memory_order_relaxed) == sequence;
+
+  Counters& counters = thread_counters();
+  if (hit) {
+    memcpy(score, &bits, sizeof(bits));
+    counters.hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  counters.misses.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void
+ScoreCache::insert(const lm::WordIndex* words,
+                   size_t length,
+                   bool bos,
+                   bool eos,
+                   float score)
+{
+  if (!enabled() || length == 0 || length > MAX_NGRAM_LENGTH) {
+    return;
+  }
+
+  Entry& entry = entries_[hash_ngram(words, length, bos, eos) % num_entries_];
+  uint32_t sequence = entry.sequence.load(std::memory_order_relaxed);
+  if ((sequence & 1) != 0 ||
+      !entry.sequence.compare_exchange_strong(sequence, sequence + 1,
+                                              std::memory_order_relaxed)) {
+    // another insert is writing the slot, leave it to that one
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+
+  uint32_t bits;
+  memcpy(&bits, &score, sizeof(bits));
+  entry.shape.store(ngram_shape(length, bos, eos), std::memory_order_relaxed);
+  for (size_t i = 0; i < length; ++i) {
+    entry.words[i].store(words[i], std::memory_order_relaxed);
+  }
+  entry.score.store(bits, std::memory_order_relaxed);
+  entry.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+uint64_t
+ScoreCache::hits() const
+{
+  uint64_t total = 0;
+  for (size_t i = 0; counters_ && i < NUM_STRIPES; ++i) {
+    total += counters_[i].hits.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+uint64_t
+ScoreCache::misses() const
+{
+  uint64_t total = 0;
+  for (size_t i = 0; counters_ && i < NUM_STRIPES; ++i) {
+    total += counters_[i].misses.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+void
+ScoreCache::reset_stats()
+{
+  for (size_t i = 0; counters_ && i < NUM_STRIPES; ++i) {
+    counters_[i].hits.store(0, std::memory_order_relaxed);
+    counters_[i].misses.store(0, std::memory_order_relaxed);
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef SCORE_CACHE_H_
+#define SCORE_CACHE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "lm/word_index.hh"
+
+/* Bounded cache of language model scores, shared by every DecoderState that
+ * uses the same Scorer.
+ *
+ * An entry is keyed by the whole n-gram: the vocabulary indices of its words
+ * and the begin/end of sentence flags, which determine the language model
+ * state the last word is scored in. A hash of the n-gram only picks the slot,
+ * so n-grams hashing alike evict each other but never return each other's
+ * score. The cache is a direct-mapped table: inserting into an occupied slot
+ * evicts the previous entry, which keeps the memory usage fixed no matter how
+ * long the process runs.
+ *
+ * Lookups and inserts don't lock. Each entry carries a sequence number which
+ * is odd while an insert writes it. A lookup that sees it odd or changed
+ * while it read the entry misses rather than returning a torn entry, and an
+ * insert finding another one writing the slot gives up.
+ */
+class ScoreCache {
+public:
+  // maximum number of words of an n-gram that can be cached
+  static const size_t MAX_NGRAM_LENGTH = KENLM_MAX_ORDER;
+
+  ScoreCache() = default;
+  ~ScoreCache() = default;
+
+  // disallow copying
+  ScoreCache(const ScoreCache&) = delete;
+  ScoreCache& operator=(const ScoreCache&) = delete;
+
+  // (Re-)allocate the cache to hold up to num_entries scores, dropping all
+  // cached values. Zero disables the cache. Must not be called concurrently
+  // with lookups.
+  void resize(size_t num_entries);
+
+  bool enabled() const { return num_entries_ != 0; }
+
+  // Look up the score of the n-gram in words[0, length). Returns true and
+  // stores the score on a hit.
+  bool find(const lm::WordIndex* words, size_t length, bool bos, bool eos,
+            float* score);
+
+  // Store the score of the n-gram in words[0, length).
+  void insert(const lm::WordIndex* words, size_t length, bool bos, bool eos,
+              float score);
+
+  // number of lookups answered from the cache
+  uint64_t hits() const;
+
+  // number of lookups that had to query the language model
+  uint64_t misses() const;
+
+  void reset_stats();
+
+private:
+  // shape is the length of the n-gram, with the begin and end of sentence
+  // flags above it, score holds the bits of the float
+  struct Entry {
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> shape;
+    std::atomic<lm::WordIndex> words[MAX_NGRAM_LENGTH];
+    std::atomic<uint32_t> score;
+  };
+
+  // Statistics are counted in stripes, each on its own cache line. Threads
+  // take turns picking a stripe, so that concurrent streams rarely write to
+  // the same one.
+  struct Counters {
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    char padding[64 - 2 * sizeof(std::atomic<uint64_t>)];
+  };
+
+  std::unique_ptr<Entry[]> entries_;
+  size_t num_entries_ = 0;
+  std::unique_ptr<Counters[]> counters_;
+
+  Counters& thread_counters();
+
+  static uint64_t hash_ngram(const lm::WordIndex* words, size_t length, bool bos, bool eos);
+};
+
+#endif  // SCORE_CACHE_H_
@@ -0,0 +1,157 @@
+#include "score_cache.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Checks that the score cache only answers with the score of the very n-gram
+// looked up, when n-grams share a slot and when threads insert and look up
+// concurrently, and that its statistics count every lookup.
+
+struct Ngram {
+  lm::WordIndex words[ScoreCache::MAX_NGRAM_LENGTH];
+  size_t length;
+  bool bos;
+  bool eos;
+};
+
+// Score only that n-gram has, so that a hit returning another one's shows
+static float ngram_score(const Ngram& ngram)
+{
+  uint32_t mixed = ngram.length * 2 + ngram.bos + (ngram.eos ? 4 : 0);
+  for (size_t i = 0; i < ngram.length; ++i) {
+    mixed = mixed * 1000003 + ngram.words[i];
+  }
+  return -static_cast<float>(mixed % 1000000) / 1000.f - 1.f;
+}
+
+// Random n-grams over a small vocabulary, so that they share words, prefixes
+// and lengths
+static std::vector<Ngram> make_ngrams(size_t count, unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::vector<Ngram> ngrams(count);
+  for (Ngram& ngram : ngrams) {
+    ngram.length = 1 + rng() % ScoreCache::MAX_NGRAM_LENGTH;
+    for (size_t i = 0; i < ngram.length; ++i) {
+      ngram.words[i] = rng() % 8;
+    }
+    ngram.bos = rng() % 2;
+    ngram.eos = rng() % 2;
+  }
+  return ngrams;
+}
+
+static bool find(ScoreCache& cache, const Ngram& ngram, float* score)
+{
+  return cache.find(ngram.words, ngram.length, ngram.bos, ngram.eos, score);
+}
+
+static void insert(ScoreCache& cache, const Ngram& ngram)
+{
+  cache.insert(ngram.words, ngram.length, ngram.bos, ngram.eos, ngram_score(ngram));
+}
+
+static void test_shared_slots()
+{
+  // With a single entry every n-gram goes to the same slot.
+  ScoreCache cache;
+  cache.resize(1);
+  Ngram ngram = {{3, 1, 4}, 3, false, false};
+  insert(cache, ngram);
+  float score = 0.f;
+  EXPECT(find(cache, ngram, &score) && score == ngram_score(ngram),
+         "shared slot: inserted n-gram not found");
+
+  Ngram other = ngram;
+  other.words[1] = 5;
+  EXPECT(!find(cache, other, &score), "shared slot: n-gram with another word found");
+  other = ngram;
+  other.length = 2;
+  EXPECT(!find(cache, other, &score), "shared slot: prefix of the n-gram found");
+  other = ngram;
+  other.bos = true;
+  EXPECT(!find(cache, other, &score), "shared slot: n-gram at the beginning of sentence found");
+  other = ngram;
+  other.eos = true;
+  EXPECT(!find(cache, other, &score), "shared slot: n-gram at the end of sentence found");
+
+  other = ngram;
+  other.words[2] = 9;
+  insert(cache, other);
+  EXPECT(!find(cache, ngram, &score), "shared slot: evicted n-gram found");
+  EXPECT(find(cache, other, &score) && score == ngram_score(other),
+         "shared slot: n-gram evicting another one not found");
+
+  // Many n-grams over a few slots: whatever is found has its own score.
+  for (size_t num_entries : {1, 7, 64}) {
+    cache.resize(num_entries);
+    const std::vector<Ngram> ngrams = make_ngrams(20000, num_entries);
+    size_t wrong = 0, hits = 0;
+    for (size_t i = 0; i < ngrams.size(); ++i) {
+      insert(cache, ngrams[i]);
+      // look up an earlier n-gram, which may have been evicted
+      const Ngram& earlier = ngrams[i / 2];
+      if (find(cache, earlier, &score)) {
+        ++hits;
+        wrong += score != ngram_score(earlier);
+      }
+    }
+    EXPECT(hits > 0, "cache of %zu: nothing found", num_entries);
+    EXPECT(wrong == 0, "cache of %zu: %zu of %zu hits have the score of another n-gram",
+           num_entries, wrong, hits);
+    EXPECT(cache.hits() == hits && cache.misses() == ngrams.size() - hits,
+           "cache of %zu: %zu hits and %zu misses counted, expected %zu and %zu",
+           num_entries, (size_t)cache.hits(), (size_t)cache.misses(), hits, ngrams.size() - hits);
+  }
+}
+
+static void test_concurrent()
+{
+  // Few slots, so that the threads keep inserting into the ones the others
+  // read.
+  ScoreCache cache;
+  cache.resize(16);
+  const std::vector<Ngram> ngrams = make_ngrams(1000, 1);
+  const size_t NUM_THREADS = 8;
+  const size_t LOOKUPS = 200000;
+  std::atomic<size_t> wrong(0), hits(0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < NUM_THREADS; ++t) {
+    threads.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      size_t thread_wrong = 0, thread_hits = 0;
+      for (size_t i = 0; i < LOOKUPS; ++i) {
+        const Ngram& ngram = ngrams[rng() % ngrams.size()];
+        float score;
+        if (find(cache, ngram, &score)) {
+          ++thread_hits;
+          thread_wrong += score != ngram_score(ngram);
+        } else {
+          insert(cache, ngram);
+        }
+      }
+      wrong += thread_wrong;
+      hits += thread_hits;
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT(hits > 0, "concurrent: nothing found");
+  EXPECT(wrong == 0, "concurrent: %zu of %zu hits have the score of another n-gram",
+         wrong.load(), hits.load());
+  EXPECT(cache.hits() + cache.misses() == NUM_THREADS * LOOKUPS,
+         "concurrent: %zu lookups counted, expected %zu",
+         (size_t)(cache.hits() + cache.misses()), NUM_THREADS * LOOKUPS);
+}
+
+int main()
+{
+  test_shared_slots();
+  test_concurrent();
+  return test_result();
+}
@@ -14,8 +14,11 @@
 #endif
 
 #include "scorer.h"
+#include <chrono>
 #include <iostream>
+#include <cstring>
 #include <fstream>
+#include <sstream>
 
 #include "lm/config.hh"
 #include "lm/model.hh"
@@ -23,9 +26,133 @@
 #include "util/string_piece.hh"
 
 #include "decoder_utils.h"
+#include "dictionary_builder.h"
+#include "ThreadPool.h"
 
 static const int32_t MAGIC = 'TRIE';
-static const int32_t FILE_VERSION = 6;
+static const int32_t FILE_VERSION = 8;
+// oldest version that can be loaded, versions before 7 have no flags field
+// and versions before 8 have no section table
+static const int32_t MIN_FILE_VERSION = 6;
+
+// flags of the version 7 package header
+static const int32_t FLAG_DENSE_DICTIONARY = 1;
+static const int32_t FLAG_LOOKAHEAD = 2;
+
+// sections of the version 8 package header
+static const uint32_t SECTION_LANGUAGE_MODEL = 1;
+static const uint32_t SECTION_DICTIONARY = 2;
+static const uint32_t SECTION_DENSE_DICTIONARY = 3;
+static const uint32_t SECTION_LOOKAHEAD = 4;
+
+// Sections start at multiples of this offset in the file, so that they can
+// be mapped in place on every system, including those mapping files with a
+// 64 KiB granularity
+static const uint64_t SECTION_ALIGNMENT = 1 << 16;
+
+// largest Unicode codepoint
+static const uint32_t MAX_CODEPOINT = 0x10FFFF;
+
+// size of the table of codepoint indices in UTF-8 mode, and its empty entry
+static const size_t CODEPOINT_SLOTS = 1 << 14;
+static const uint64_t NO_CODEPOINT = ~uint64_t(0);
+
+// Prefaulting reads a byte of each page of this size, and checks whether
+// it should stop after each chunk of this many bytes
+static const size_t PREFAULT_PAGE_SIZE = 1 << 12;
+static const size_t PREFAULT_CHUNK_SIZE = 1 << 20;
+
+// size of the version 8 header before the section table, and of each entry
+// of the table
+static const size_t HEADER_FIELDS_SIZE = 40;
+static const size_t SECTION_ENTRY_SIZE = 24;
+
+// Input stream over a memory region holding the bytes of a file from offset
+// base on. Positions are those of the file, so that OpenFst can map the
+// arrays it reads in place instead of copying them.
+class FileRegionBuf : public std::streambuf {
+public:
+  FileRegionBuf(const char* data, size_t size, uint64_t base)
+    : base_(base)
+  {
+    char* begin = const_cast<char*>(data);
+    setg(begin, begin, begin + size);
+  }
+
+protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode /*which*/) override
+  {
+    off_type pos;
+    if (dir == std::ios_base::beg) {
+      pos = off - base_;
+    } else if (dir == std::ios_base::cur) {
+      pos = gptr() - eback() + off;
+    } else {
+      pos = egptr() - eback() + off;
+    }
+    if (pos < 0 || pos > egptr() - eback()) {
+      return pos_type(off_type(-1));
+    }
+    setg(eback(), eback() + pos, egptr());
+    return pos_type(base_ + pos);
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override
+  {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+
+private:
+  off_type base_;
+};
+
+// CRC-32 (IEEE 802.3) of the bytes of a package header
+static uint32_t header_checksum(const char* data, size_t size)
+{
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= static_cast<uint8_t>(data[i]);
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+template<typename T>
+static T read_field(const char* data, size_t offset)
+{
+  T value;
+  memcpy(&value, data + offset, sizeof(value));
+  return value;
+}
+
+template<typename T>
+static void append_field(std::string& out, T value)
+{
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Share the values of a buffer, which lives as long as they are used
+static std::shared_ptr<const float> share_buffer(std::vector<float> values)
+{
+  auto buffer = std::make_shared<std::vector<float>>(std::move(values));
+  return std::shared_ptr<const float>(buffer, buffer->data());
+}
+
+Scorer::~Scorer()
+{
+  stop_prefault();
+}
+
+void
+Scorer::set_load_options(util::LoadMethod load_method, bool prefault, bool huge_pages)
+{
+  load_method_ = load_method;
+  prefault_ = prefault;
+  huge_pages_ = huge_pages;
+}
 
 int
 Scorer::init(const std::string& lm_path,
@@ -69,6 +196,13 @@ void Scorer::setup_char_map()
   }
 }
 
+// Memory KenLM holds a binary model of the given type in
+template<class Model>
+static const util::scoped_memory& model_mapping(const lm::base::Model& model)
+{
+  return static_cast<const Model&>(model).Mapping();
+}
+
 int Scorer::load_lm(const std::string& lm_path)
 {
   // Check if file is readable to avoid KenLM throwing an exception
@@ -83,30 +217,165 @@ int Scorer::load_lm(const std::string& lm_path)
     return DS_ERR_SCORER_INVALID_LM;
   }
 
+  const auto load_start = std::chrono::steady_clock::now();
+  stop_prefault();
+
+  // Huge pages can only back memory the package is read into
+  util::LoadMethod load_method = load_method_;
+  if (huge_pages_ && (load_method == util::LoadMethod::LAZY ||
+                      load_method == util::LoadMethod::POPULATE_OR_LAZY ||
+                      load_method == util::LoadMethod::POPULATE_OR_READ)) {
+    load_method = util::LoadMethod::READ;
+  }
+
   // Load the LM
   lm::ngram::Config config;
-  config.load_method = util::LoadMethod::LAZY;
-  language_model_.reset(lm::ngram::LoadVirtual(filename, config));
+  config.load_method = load_method;
+  language_model_.reset(lm::ngram::LoadVirtual(filename, config, model_type));
   max_order_ = language_model_->Order();
+  const util::scoped_memory* lm_mapping = nullptr;
+  switch (model_type) {
+    case lm::ngram::PROBING:
+      score_ngram_ = &Scorer::score_ngram<lm::ngram::ProbingModel>;
+      score_ngrams_ = &Scorer::score_ngrams<lm::ngram::ProbingModel>;
+      lm_mapping = &model_mapping<lm::ngram::ProbingModel>(*language_model_);
+      break;
+    case lm::ngram::REST_PROBING:
+      score_ngram_ = &Scorer::score_ngram<lm::ngram::RestProbingModel>;
+      score_ngrams_ = &Scorer::score_ngrams<lm::ngram::RestProbingModel>;
+      lm_mapping = &model_mapping<lm::ngram::RestProbingModel>(*language_model_);
+      break;
+    case lm::ngram::TRIE:
+      score_ngram_ = &Scorer::score_ngram<lm::ngram::TrieModel>;
+      score_ngrams_ = &Scorer::score_ngrams<lm::ngram::TrieModel>;
+      lm_mapping = &model_mapping<lm::ngram::TrieModel>(*language_model_);
+      break;
+    case lm::ngram::QUANT_TRIE:
+      score_ngram_ = &Scorer::score_ngram<lm::ngram::QuantTrieModel>;
+      score_ngrams_ = &Scorer::score_ngrams<lm::ngram::QuantTrieModel>;
+      lm_mapping = &model_mapping<lm::ngram::QuantTrieModel>(*language_model_);
+      break;
+    case lm::ngram::ARRAY_TRIE:
+      score_ngram_ = &Scorer::score_ngram<lm::ngram::ArrayTrieModel>;
+      score_ngrams_ = &Scorer::score_ngrams<lm::ngram::ArrayTrieModel>;
+      lm_mapping = &model_mapping<lm::ngram::ArrayTrieModel>(*language_model_);
+      break;
+    case lm::ngram::QUANT_ARRAY_TRIE:
+      score_ngram_ = &Scorer::score_ngram<lm::ngram::QuantArrayTrieModel>;
+      score_ngrams_ = &Scorer::score_ngrams<lm::ngram::QuantArrayTrieModel>;
+      lm_mapping = &model_mapping<lm::ngram::QuantArrayTrieModel>(*language_model_);
+      break;
+  }
+  // word indices are only meaningful for a given LM, start from a clean cache
+  score_cache_.resize(cache_size_);
+  words_numbered_ = false;
 
-  uint64_t package_size;
-  {
+  // Map the package from the trie on. Version 8 packages are then parsed
+  // from the mapping without reading the file. This is not the only mapping
+  // of the file: KenLM maps the language model itself, and with LAZY
+  // OpenFst maps the dictionary and the dense table from the file at the
+  // positions the stream over this mapping reports. Only the look-ahead is
+  // used from this mapping, other load methods copy it out.
+  const bool memorymap = load_method == util::LoadMethod::LAZY;
+  const uint64_t trie_offset = language_model_->GetEndOfSearchOffset();
+  const uint64_t package_offset = trie_offset - trie_offset % SECTION_ALIGNMENT;
+  lookahead_.reset();
+  package_ = std::make_shared<util::scoped_memory>();
+  try {
     util::scoped_fd fd(util::OpenReadOrThrow(filename));
-    package_size = util::SizeFile(fd.get());
+    const uint64_t package_size = util::SizeFile(fd.get());
+    if (package_size <= trie_offset) {
+      // File ends without a trie structure
+      return DS_ERR_SCORER_NO_TRIE;
+    }
+    util::MapRead(util::LoadMethod::LAZY, fd.get(), package_offset,
+                  package_size - package_offset, *package_);
+  } catch (const util::Exception& e) {
+    // Don't let KenLM exceptions reach the C API
+    std::cerr << "Error: Can't read scorer file: " << e.what() << std::endl;
+    return DS_ERR_SCORER_UNREADABLE;
   }
-  uint64_t trie_offset = language_model_->GetEndOfSearchOffset();
-  if (package_size <= trie_offset) {
-    // File ends without a trie structure
-    return DS_ERR_SCORER_NO_TRIE;
+  const char* trie = package_->begin() + (trie_offset - package_offset);
+  int err;
+  if (package_->end() - trie >= 8 &&
+      read_field<int32_t>(trie, 0) == MAGIC &&
+      read_field<int32_t>(trie, 4) == FILE_VERSION) {
+    err = load_sections(package_offset, trie_offset, lm_path, memorymap);
+  } else {
+    FileRegionBuf buf(trie, package_->end() - trie, trie_offset);
+    std::istream fin(&buf);
+    err = load_trie(fin, lm_path, memorymap);
   }
+  // Only a look-ahead mapped in place still refers to the package
+  package_.reset();
+
+  load_seconds_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
+  if (err == DS_ERR_OK && prefault_ && memorymap) {
+    start_prefault(lm_mapping);
+  }
+  return err;
+}
+
+// Read a byte of every page of a region, so that the mapping it belongs to
+// has them all mapped. Returns false if stop was set before the end.
+static bool touch_pages(const void* data, size_t size, const std::atomic<bool>& stop)
+{
+  if (stop) {
+    return false;
+  }
+  const volatile char* bytes = static_cast<const volatile char*>(data);
+  char sink = 0;
+  for (size_t chunk = 0; chunk < size; chunk += PREFAULT_CHUNK_SIZE) {
+    if (stop) {
+      return false;
+    }
+    const size_t end = std::min(size, chunk + PREFAULT_CHUNK_SIZE);
+    for (size_t i = chunk; i < end; i += PREFAULT_PAGE_SIZE) {
+      sink ^= bytes[i];
+    }
+  }
+  (void)sink;
+  return true;
+}
+
+void Scorer::start_prefault(const util::scoped_memory* lm_mapping)
+{
+  // KenLM, OpenFst and the scorer each map their part of the package, so
+  // the pages of every one of these mappings are touched. Lookups then
+  // find them mapped instead of faulting, possibly on the disk.
+  stop_prefault_ = false;
+  prefault_thread_ = std::thread([this, lm_mapping] {
+    if (lm_mapping && !touch_pages(lm_mapping->get(), lm_mapping->size(), stop_prefault_)) {
+      return;
+    }
+    // the states and arcs of the FST, through its arc iterators as OpenFst
+    // doesn't expose its regions
+    for (FstType::StateId state = 0; dictionary && state < dictionary->NumStates(); ++state) {
+      fst::ArcIteratorData<fst::StdArc> arcs;
+      dictionary->InitArcIterator(state, &arcs);
+      if (!touch_pages(arcs.arcs, arcs.narcs * sizeof(fst::StdArc), stop_prefault_)) {
+        return;
+      }
+    }
+    if (dense_dictionary &&
+        !touch_pages(dense_dictionary->Data(), dense_dictionary->Size(), stop_prefault_)) {
+      return;
+    }
+    if (lookahead_) {
+      touch_pages(lookahead_.get(), dictionary->NumStates() * sizeof(float), stop_prefault_);
+    }
+  });
+}
 
-  // Read metadata and trie from file
-  std::ifstream fin(lm_path, std::ios::binary);
-  fin.seekg(trie_offset);
-  return load_trie(fin, lm_path);
+void Scorer::stop_prefault()
+{
+  if (prefault_thread_.joinable()) {
+    stop_prefault_ = true;
+    prefault_thread_.join();
+  }
 }
 
-int Scorer::load_trie(std::ifstream& fin, const std::string& file_path)
+int Scorer::load_trie(std::istream& fin, const std::string& file_path, bool memorymap)
 {
   int magic;
   fin.read(reinterpret_cast<char*>(&magic), sizeof(magic));
@@ -118,11 +387,11 @@ int Scorer::load_trie(std::ifstream& fin, const std::string& file_path)
 
   int version;
   fin.read(reinterpret_cast<char*>(&version), sizeof(version));
-  if (version != FILE_VERSION) {
+  if (version < MIN_FILE_VERSION || version > FILE_VERSION) {
     std::cerr << "Error: Scorer file version mismatch (" << version
               << " instead of expected " << FILE_VERSION
               << "). ";
-    if (version < FILE_VERSION) {
+    if (version < MIN_FILE_VERSION) {
       std::cerr << "Update your scorer file.";
     } else {
       std::cerr << "Downgrade your scorer file or update your version of DeepSpeech.";
@@ -131,6 +400,11 @@ int Scorer::load_trie(std::ifstream& fin, const std::string& file_path)
     return DS_ERR_SCORER_VERSION_MISMATCH;
   }
 
+  int32_t flags = 0;
+  if (version >= 7) {
+    fin.read(reinterpret_cast<char*>(&flags), sizeof(flags));
+  }
+
   fin.read(reinterpret_cast<char*>(&is_utf8_mode_), sizeof(is_utf8_mode_));
 
   // Read hyperparameters from header
@@ -140,9 +414,153 @@ int Scorer::load_trie(std::ifstream& fin, const std::string& file_path)
   reset_params(alpha, beta);
 
   fst::FstReadOptions opt;
-  opt.mode = fst::FstReadOptions::MAP;
+  opt.mode = memorymap ? fst::FstReadOptions::MAP : fst::FstReadOptions::READ;
   opt.source = file_path;
   dictionary.reset(FstType::Read(fin, opt));
+
+  dense_dictionary.reset();
+  if (flags & FLAG_DENSE_DICTIONARY) {
+    dense_dictionary.reset(DenseDictionary::Read(fin, file_path, memorymap, huge_pages_));
+    if (!dense_dictionary) {
+      std::cerr << "Error: Can't read dense dictionary from scorer file."
+                << std::endl;
+      return DS_ERR_SCORER_INVALID_TRIE;
+    }
+  }
+
+  lookahead_.reset();
+  if (flags & FLAG_LOOKAHEAD) {
+    int32_t num_states = 0;
+    fin.read(reinterpret_cast<char*>(&num_states), sizeof(num_states));
+    if (!fin || !dictionary || num_states != dictionary->NumStates()) {
+      std::cerr << "Error: Can't read LM look-ahead from scorer file."
+                << std::endl;
+      return DS_ERR_SCORER_INVALID_TRIE;
+    }
+    std::vector<float> lookahead(num_states);
+    fin.read(reinterpret_cast<char*>(lookahead.data()), num_states * sizeof(float));
+    if (!fin) {
+      std::cerr << "Error: Can't read LM look-ahead from scorer file."
+                << std::endl;
+      return DS_ERR_SCORER_INVALID_TRIE;
+    }
+    lookahead_ = share_buffer(std::move(lookahead));
+  }
+  return DS_ERR_OK;
+}
+
+int Scorer::load_sections(uint64_t package_offset,
+                          uint64_t header_offset,
+                          const std::string& file_path,
+                          bool memorymap)
+{
+  const char* header = package_->begin() + (header_offset - package_offset);
+  const size_t available = package_->end() - header;
+  if (available < HEADER_FIELDS_SIZE) {
+    std::cerr << "Error: Can't parse scorer file, truncated header." << std::endl;
+    return DS_ERR_SCORER_INVALID_TRIE;
+  }
+  const uint32_t header_size = read_field<uint32_t>(header, 8);
+  const uint32_t num_sections = read_field<uint32_t>(header, 12);
+  if (header_size > available ||
+      header_size != HEADER_FIELDS_SIZE + num_sections * SECTION_ENTRY_SIZE + sizeof(uint32_t)) {
+    std::cerr << "Error: Can't parse scorer file, truncated header." << std::endl;
+    return DS_ERR_SCORER_INVALID_TRIE;
+  }
+  const size_t checksum_offset = header_size - sizeof(uint32_t);
+  if (read_field<uint32_t>(header, checksum_offset) != header_checksum(header, checksum_offset)) {
+    std::cerr << "Error: Can't parse scorer file, header checksum mismatch."
+              << std::endl;
+    return DS_ERR_SCORER_INVALID_TRIE;
+  }
+
+  reset_params(read_field<double>(header, 16), read_field<double>(header, 24));
+  is_utf8_mode_ = read_field<uint8_t>(header, 32) != 0;
+
+  // offset and size of each section, by type
+  uint64_t offsets[SECTION_LOOKAHEAD + 1] = {0};
+  uint64_t sizes[SECTION_LOOKAHEAD + 1] = {0};
+  bool present[SECTION_LOOKAHEAD + 1] = {false};
+  const uint64_t package_end = package_offset + package_->size();
+  for (uint32_t i = 0; i < num_sections; ++i) {
+    const size_t entry = HEADER_FIELDS_SIZE + i * SECTION_ENTRY_SIZE;
+    const uint32_t type = read_field<uint32_t>(header, entry);
+    const uint64_t offset = read_field<uint64_t>(header, entry + 8);
+    const uint64_t size = read_field<uint64_t>(header, entry + 16);
+    if (type == SECTION_LANGUAGE_MODEL) {
+      // loaded by KenLM, which expects it at the start of the file
+      if (offset != 0 || size != header_offset) {
+        std::cerr << "Error: Can't parse scorer file, invalid language model section."
+                  << std::endl;
+        return DS_ERR_SCORER_INVALID_TRIE;
+      }
+      continue;
+    }
+    if (type > SECTION_LOOKAHEAD) {
+      // unknown sections are ignored
+      continue;
+    }
+    if (offset % SECTION_ALIGNMENT != 0 || offset < header_offset + header_size ||
+        offset > package_end || size > package_end - offset) {
+      std::cerr << "Error: Can't parse scorer file, invalid section table."
+                << std::endl;
+      return DS_ERR_SCORER_INVALID_TRIE;
+    }
+    offsets[type] = offset;
+    sizes[type] = size;
+    present[type] = true;
+  }
+
+  dictionary.reset();
+  dense_dictionary.reset();
+  lookahead_.reset();
+
+  if (!present[SECTION_DICTIONARY]) {
+    std::cerr << "Error: Can't parse scorer file, no dictionary." << std::endl;
+    return DS_ERR_SCORER_INVALID_TRIE;
+  }
+  {
+    FileRegionBuf buf(package_->begin() + (offsets[SECTION_DICTIONARY] - package_offset),
+                      sizes[SECTION_DICTIONARY], offsets[SECTION_DICTIONARY]);
+    std::istream strm(&buf);
+    fst::FstReadOptions opt;
+    opt.mode = memorymap ? fst::FstReadOptions::MAP : fst::FstReadOptions::READ;
+    opt.source = file_path;
+    dictionary.reset(FstType::Read(strm, opt));
+    if (!dictionary) {
+      std::cerr << "Error: Can't read dictionary from scorer file." << std::endl;
+      return DS_ERR_SCORER_INVALID_TRIE;
+    }
+  }
+
+  if (present[SECTION_DENSE_DICTIONARY]) {
+    FileRegionBuf buf(package_->begin() + (offsets[SECTION_DENSE_DICTIONARY] - package_offset),
+                      sizes[SECTION_DENSE_DICTIONARY], offsets[SECTION_DENSE_DICTIONARY]);
+    std::istream strm(&buf);
+    dense_dictionary.reset(DenseDictionary::Read(strm, file_path, memorymap, huge_pages_));
+    if (!dense_dictionary) {
+      std::cerr << "Error: Can't read dense dictionary from scorer file."
+                << std::endl;
+      return DS_ERR_SCORER_INVALID_TRIE;
+    }
+  }
+
+  if (present[SECTION_LOOKAHEAD]) {
+    const size_t num_states = sizes[SECTION_LOOKAHEAD] / sizeof(float);
+    if (num_states * sizeof(float) != sizes[SECTION_LOOKAHEAD] ||
+        num_states != static_cast<size_t>(dictionary->NumStates())) {
+      std::cerr << "Error: Can't read LM look-ahead from scorer file."
+                << std::endl;
+      return DS_ERR_SCORER_INVALID_TRIE;
+    }
+    const float* data = reinterpret_cast<const float*>(
+      package_->begin() + (offsets[SECTION_LOOKAHEAD] - package_offset));
+    if (memorymap) {
+      lookahead_ = std::shared_ptr<const float>(package_, data);
+    } else {
+      lookahead_ = share_buffer(std::vector<float>(data, data + num_states));
+    }
+  }
   return DS_ERR_OK;
 }
 
@@ -159,59 +577,110 @@ bool Scorer::save_dictionary(const std::string& path, bool append_instead_of_ove
     std::cerr << "Error opening '" << path << "'" << std::endl;
     return false;
   }
-  fout.write(reinterpret_cast<const char*>(&MAGIC), sizeof(MAGIC));
-  if (fout.bad()) {
-    std::cerr << "Error writing MAGIC '" << path << "'" << std::endl;
-    return false;
+
+  // Packages without a dense dictionary or look-ahead are written in the
+  // version 6 format, so that releases before the section table still load
+  // them
+  if (!dense_dictionary && !lookahead_) {
+    const int32_t version = MIN_FILE_VERSION;
+    fout.write(reinterpret_cast<const char*>(&MAGIC), sizeof(MAGIC));
+    fout.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    fout.write(reinterpret_cast<const char*>(&is_utf8_mode_), sizeof(is_utf8_mode_));
+    fout.write(reinterpret_cast<const char*>(&alpha), sizeof(alpha));
+    fout.write(reinterpret_cast<const char*>(&beta), sizeof(beta));
+    if (fout.bad()) {
+      std::cerr << "Error writing header '" << path << "'" << std::endl;
+      return false;
+    }
+    fst::FstWriteOptions opt;
+    opt.align = true;
+    opt.source = path;
+    return dictionary->Write(fout, opt);
   }
-  fout.write(reinterpret_cast<const char*>(&FILE_VERSION), sizeof(FILE_VERSION));
-  if (fout.bad()) {
-    std::cerr << "Error writing FILE_VERSION '" << path << "'" << std::endl;
-    return false;
+
+  // Serialize the sections first, their sizes are part of the header
+  std::vector<std::pair<uint32_t, std::string>> sections;
+  {
+    std::ostringstream strm;
+    fst::FstWriteOptions opt;
+    opt.align = true;
+    opt.source = path;
+    if (!dictionary->Write(strm, opt)) {
+      return false;
+    }
+    sections.emplace_back(SECTION_DICTIONARY, strm.str());
   }
-  fout.write(reinterpret_cast<const char*>(&is_utf8_mode_), sizeof(is_utf8_mode_));
-  if (fout.bad()) {
-    std::cerr << "Error writing is_utf8_mode '" << path << "'" << std::endl;
-    return false;
+  if (dense_dictionary) {
+    std::ostringstream strm;
+    if (!dense_dictionary->Write(strm)) {
+      std::cerr << "Error writing dense dictionary '" << path << "'" << std::endl;
+      return false;
+    }
+    sections.emplace_back(SECTION_DENSE_DICTIONARY, strm.str());
   }
-  fout.write(reinterpret_cast<const char*>(&alpha), sizeof(alpha));
-  if (fout.bad()) {
-    std::cerr << "Error writing alpha '" << path << "'" << std::endl;
-    return false;
+  if (lookahead_) {
+    sections.emplace_back(SECTION_LOOKAHEAD,
+                          std::string(reinterpret_cast<const char*>(lookahead_.get()),
+                                      dictionary->NumStates() * sizeof(float)));
+  }
+
+  const uint64_t header_offset = fout.tellp();
+  const uint32_t num_sections = sections.size() + (header_offset > 0 ? 1 : 0);
+  const uint32_t header_size = HEADER_FIELDS_SIZE + num_sections * SECTION_ENTRY_SIZE +
+                               sizeof(uint32_t);
+
+  std::string header;
+  append_field<int32_t>(header, MAGIC);
+  append_field<int32_t>(header, FILE_VERSION);
+  append_field<uint32_t>(header, header_size);
+  append_field<uint32_t>(header, num_sections);
+  append_field<double>(header, alpha);
+  append_field<double>(header, beta);
+  append_field<uint8_t>(header, is_utf8_mode_);
+  header.append(HEADER_FIELDS_SIZE - header.size(), '\0');
+  if (header_offset > 0) {
+    // the language model this dictionary is appended to
+    append_field<uint32_t>(header, SECTION_LANGUAGE_MODEL);
+    append_field<uint32_t>(header, 0);
+    append_field<uint64_t>(header, 0);
+    append_field<uint64_t>(header, header_offset);
+  }
+  std::vector<uint64_t> offsets;
+  uint64_t offset = header_offset + header_size;
+  for (const auto& section : sections) {
+    offset = (offset + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT;
+    offsets.push_back(offset);
+    append_field<uint32_t>(header, section.first);
+    append_field<uint32_t>(header, 0);
+    append_field<uint64_t>(header, offset);
+    append_field<uint64_t>(header, section.second.size());
+    offset += section.second.size();
   }
-  fout.write(reinterpret_cast<const char*>(&beta), sizeof(beta));
+  append_field<uint32_t>(header, header_checksum(header.data(), header.size()));
+
+  fout.write(header.data(), header.size());
   if (fout.bad()) {
-    std::cerr << "Error writing beta '" << path << "'" << std::endl;
+    std::cerr << "Error writing header '" << path << "'" << std::endl;
     return false;
   }
-  fst::FstWriteOptions opt;
-  opt.align = true;
-  opt.source = path;
-  return dictionary->Write(fout, opt);
+  for (size_t i = 0; i < sections.size(); ++i) {
+    const std::string padding(offsets[i] - static_cast<uint64_t>(fout.tellp()), '\0');
+    fout.write(padding.data(), padding.size());
+    fout.write(sections[i].second.data(), sections[i].second.size());
+    if (fout.bad()) {
+      std::cerr << "Error writing section " << sections[i].first << " '"
+                << path << "'" << std::endl;
+      return false;
+    }
+  }
+  return true;
 }
 
 bool Scorer::is_scoring_boundary(PathTrie* prefix, size_t new_label)
 {
   if (is_utf8_mode()) {
-    if (prefix->character == -1) {
-      return false;
-    }
-    unsigned char first_byte;
-    int distance_to_boundary = prefix->distance_to_codepoint_boundary(&first_byte, alphabet_);
-    int needed_bytes;
-    if ((first_byte >> 3) == 0x1E) {
-      needed_bytes = 4;
-    } else if ((first_byte >> 4) == 0x0E) {
-      needed_bytes = 3;
-    } else if ((first_byte >> 5) == 0x06) {
-      needed_bytes = 2;
-    } else if ((first_byte >> 7) == 0x00) {
-      needed_bytes = 1;
-    } else {
-      assert(false); // invalid byte sequence. should be unreachable, disallowed by vocabulary/trie
-      return false;
-    }
-    return distance_to_boundary == needed_bytes;
+    // codepoint boundaries are tracked by the prefixes as they are built
+    return prefix->ends_codepoint();
   } else {
     return new_label == SPACE_ID_;
   }
@@ -229,38 +698,162 @@ double Scorer::get_log_cond_prob(const std::vector<std::string>::const_iterator&
                                  bool bos,
                                  bool eos)
 {
-  const auto& vocab = language_model_->BaseVocabulary();
-  lm::ngram::State state_vec[2];
-  lm::ngram::State *in_state = &state_vec[0];
-  lm::ngram::State *out_state = &state_vec[1];
+  return (this->*score_ngram_)(begin, end, bos, eos);
+}
 
-  if (bos) {
-    language_model_->BeginSentenceWrite(in_state);
-  } else {
-    language_model_->NullContextWrite(in_state);
+template<class Model>
+double Scorer::score_ngram(const std::vector<std::string>::const_iterator& begin,
+                           const std::vector<std::string>::const_iterator& end,
+                           bool bos,
+                           bool eos)
+{
+  const Model& model = *static_cast<const Model*>(language_model_.get());
+  const typename Model::Vocabulary& vocab = model.GetVocabulary();
+
+  lm::WordIndex word_indices[ScoreCache::MAX_NGRAM_LENGTH];
+  const size_t length = end - begin;
+  const bool cacheable = length <= ScoreCache::MAX_NGRAM_LENGTH;
+  if (cacheable) {
+    for (size_t i = 0; i < length; ++i) {
+      word_indices[i] = vocab.Index(begin[i]);
+      // encounter OOV
+      if (word_indices[i] == lm::kUNK) {
+        return OOV_SCORE;
+      }
+    }
+
+    float cached_prob;
+    if (score_cache_.find(word_indices, length, bos, eos, &cached_prob)) {
+      return static_cast<double>(cached_prob)/NUM_FLT_LOGE;
+    }
   }
 
+  typename Model::State state_vec[2];
+  typename Model::State *in_state = &state_vec[0];
+  typename Model::State *out_state = &state_vec[1];
+
+  *in_state = bos ? model.BeginSentenceState() : model.NullContextState();
+
   double cond_prob = 0.0;
   for (auto it = begin; it != end; ++it) {
-    lm::WordIndex word_index = vocab.Index(*it);
+    lm::WordIndex word_index = cacheable ? word_indices[it - begin] : vocab.Index(*it);
 
     // encounter OOV
     if (word_index == lm::kUNK) {
       return OOV_SCORE;
     }
 
-    cond_prob = language_model_->BaseScore(in_state, word_index, out_state);
+    cond_prob = model.Score(*in_state, word_index, *out_state);
     std::swap(in_state, out_state);
   }
 
   if (eos) {
-    cond_prob = language_model_->BaseScore(in_state, vocab.EndSentence(), out_state);
+    cond_prob = model.Score(*in_state, vocab.EndSentence(), *out_state);
+  }
+
+  if (cacheable) {
+    score_cache_.insert(word_indices, length, bos, eos, cond_prob);
   }
 
   // return loge prob
   return cond_prob/NUM_FLT_LOGE;
 }
 
+void Scorer::get_log_cond_probs(NgramQuery* queries, size_t count)
+{
+  (this->*score_ngrams_)(queries, count);
+}
+
+template<class Model>
+void Scorer::score_ngrams(NgramQuery* queries, size_t count)
+{
+  // Queries scored after prefetching the lookups of this many next ones
+  const size_t PREFETCH_DISTANCE = 8;
+
+  const Model& model = *static_cast<const Model*>(language_model_.get());
+  const typename Model::Vocabulary& vocab = model.GetVocabulary();
+
+  // Queries missing from the cache, with the words of their n-gram and
+  // their context in reverse order, as FullScoreForgotState() takes it
+  struct Pending {
+    NgramQuery* query;
+    lm::WordIndex words[ScoreCache::MAX_NGRAM_LENGTH];
+    lm::WordIndex context[ScoreCache::MAX_NGRAM_LENGTH];
+    size_t length;
+    size_t context_length;
+  };
+  // They wait in a ring while their lookups are prefetched, and are scored
+  // in order once it is full
+  Pending pending[PREFETCH_DISTANCE];
+  size_t num_pending = 0;
+  size_t num_scored = 0;
+  typename Model::State out_state;
+  auto score_oldest = [&]() {
+    const Pending& entry = pending[num_scored++ % PREFETCH_DISTANCE];
+    double cond_prob = model.FullScoreForgotState(entry.context,
+                                                  entry.context + entry.context_length,
+                                                  entry.words[entry.length - 1],
+                                                  out_state).prob;
+    score_cache_.insert(entry.words, entry.length, entry.query->bos, false, cond_prob);
+    entry.query->score = cond_prob/NUM_FLT_LOGE;
+  };
+
+  for (size_t i = 0; i < count; ++i) {
+    NgramQuery& query = queries[i];
+    const size_t length = query.num_words ? query.num_words : query.ngram.size();
+    if (length == 0 || length > ScoreCache::MAX_NGRAM_LENGTH) {
+      query.score = score_ngram<Model>(query.ngram.begin(), query.ngram.end(), query.bos, false);
+      continue;
+    }
+
+    Pending entry;
+    entry.query = &query;
+    entry.length = length;
+    bool oov = false;
+    for (size_t j = 0; j < length && !oov; ++j) {
+      entry.words[j] = query.num_words ? query.words[j] : vocab.Index(query.ngram[j]);
+      // encounter OOV
+      oov = entry.words[j] == lm::kUNK;
+    }
+    if (oov) {
+      query.score = OOV_SCORE;
+      continue;
+    }
+
+    float cached_prob;
+    if (score_cache_.find(entry.words, length, query.bos, false, &cached_prob)) {
+      query.score = static_cast<double>(cached_prob)/NUM_FLT_LOGE;
+      continue;
+    }
+
+    entry.context_length = 0;
+    for (size_t j = length - 1; j > 0; --j) {
+      entry.context[entry.context_length++] = entry.words[j - 1];
+    }
+    if (query.bos && entry.context_length < ScoreCache::MAX_NGRAM_LENGTH) {
+      entry.context[entry.context_length++] = vocab.BeginSentence();
+    }
+
+    if (num_pending - num_scored == PREFETCH_DISTANCE) {
+      score_oldest();
+    }
+    model.PrefetchForgotState(entry.context, entry.context + entry.context_length,
+                              entry.words[entry.length - 1]);
+    pending[num_pending++ % PREFETCH_DISTANCE] = entry;
+  }
+  while (num_scored < num_pending) {
+    score_oldest();
+  }
+}
+
+void Scorer::set_cache_size(size_t num_entries)
+{
+  cache_size_ = num_entries;
+  if (language_model_) {
+    score_cache_.resize(cache_size_);
+  }
+}
+
 void Scorer::reset_params(float alpha, float beta)
 {
   this->alpha = alpha;
@@ -295,7 +888,7 @@ std::vector<std::string> Scorer::make_ngram(PathTrie* prefix)
     std::vector<unsigned int> prefix_vec;
 
     if (is_utf8_mode_) {
-      new_node = current_node->get_prev_grapheme(prefix_vec, alphabet_);
+      new_node = current_node->get_prev_grapheme(prefix_vec);
     } else {
       new_node = current_node->get_prev_word(prefix_vec, alphabet_);
     }
@@ -309,41 +902,309 @@ std::vector<std::string> Scorer::make_ngram(PathTrie* prefix)
   return ngram;
 }
 
-void Scorer::fill_dictionary(const std::unordered_set<std::string>& vocabulary)
+// length of the UTF-8 encoding of a codepoint
+static uint8_t utf8_length(uint32_t codepoint)
 {
-  // ConstFst is immutable, so we need to use a MutableFst to create the trie,
-  // and then we convert to a ConstFst for the decoder and for storing on disk.
-  fst::StdVectorFst dictionary;
-  // For each unigram convert to ints and put in trie
-  for (const auto& word : vocabulary) {
-    if (word != START_TOKEN && word != UNK_TOKEN && word != END_TOKEN) {
-      add_word_to_dictionary(word, char_map_, is_utf8_mode_, SPACE_ID_ + 1, &dictionary);
+  if (codepoint < 0x80) {
+    return 1;
+  } else if (codepoint < 0x800) {
+    return 2;
+  } else if (codepoint < 0x10000) {
+    return 3;
+  }
+  return 4;
+}
+
+static std::string encode_utf8(uint32_t codepoint)
+{
+  static const unsigned char LEADING_BITS[] = {0x00, 0x00, 0xC0, 0xE0, 0xF0};
+  const uint8_t length = utf8_length(codepoint);
+  std::string bytes(length, '\0');
+  for (uint8_t i = length - 1; i > 0; --i) {
+    bytes[i] = 0x80 | (codepoint & 0x3F);
+    codepoint >>= 6;
+  }
+  bytes[0] = LEADING_BITS[length] | codepoint;
+  return bytes;
+}
+
+size_t Scorer::make_ngram_indices(PathTrie* prefix, lm::WordIndex* words)
+{
+  if (is_utf8_mode_) {
+    return make_codepoint_indices(prefix, words);
+  }
+  if (!dictionary || dictionary->Start() == fst::kNoStateId) {
+    return 0;
+  }
+  number_words();
+
+  size_t length = 0;
+  PathTrie* current_node = prefix;
+  for (int order = 0; order < max_order_; order++) {
+    if (!current_node || current_node->character == -1) {
+      break;
+    }
+    if (current_node->character == SPACE_ID_) {
+      // empty word, which the dictionary doesn't have
+      return 0;
     }
+
+    // Words are looked up once per prefix. Only the scored word is memoized,
+    // as it is the only one a single extension scores and the n-grams of a
+    // step can be made concurrently.
+    lm::WordIndex index = current_node->word_index;
+    if (index == PathTrie::NO_WORD_INDEX) {
+      if (!find_word_index(current_node, &index)) {
+        return 0;
+      }
+      if (order == 0) {
+        current_node->word_index = index;
+      }
+    }
+    words[length++] = index;
+
+    while (current_node->character != SPACE_ID_ && current_node->character != -1) {
+      current_node = current_node->parent;
+    }
+    current_node = current_node->parent;
   }
+  std::reverse(words, words + length);
+  return length;
+}
 
-  /* Simplify FST
+size_t Scorer::make_codepoint_indices(PathTrie* prefix, lm::WordIndex* words)
+{
+  number_words();
 
-   * This gets rid of "epsilon" transitions in the FST.
-   * These are transitions that don't require a string input to be taken.
-   * Getting rid of them is necessary to make the FST deterministic, but
-   * can greatly increase the size of the FST
-   */
-  fst::RmEpsilon(&dictionary);
-  std::unique_ptr<fst::StdVectorFst> new_dict(new fst::StdVectorFst);
+  size_t length = 0;
+  PathTrie* current_node = prefix;
+  for (int order = 0; order < max_order_; order++) {
+    if (!current_node || current_node->character == -1) {
+      break;
+    }
+    // Incomplete and overlong byte sequences are left to make_ngram(), which
+    // scores them as they are
+    const uint32_t codepoint = current_node->codepoint;
+    if (!current_node->ends_codepoint() || codepoint > MAX_CODEPOINT ||
+        utf8_length(codepoint) != current_node->codepoint_length) {
+      return 0;
+    }
+
+    std::atomic<uint64_t>& slot = codepoint_indices_[codepoint % CODEPOINT_SLOTS];
+    const uint64_t entry = slot.load(std::memory_order_relaxed);
+    lm::WordIndex index;
+    if (entry >> 32 == codepoint) {
+      index = static_cast<lm::WordIndex>(entry);
+    } else {
+      index = language_model_->BaseVocabulary().Index(encode_utf8(codepoint));
+      slot.store(static_cast<uint64_t>(codepoint) << 32 | index, std::memory_order_relaxed);
+    }
+    words[length++] = index;
+
+    for (uint8_t i = current_node->codepoint_length; i > 0; --i) {
+      current_node = current_node->parent;
+    }
+  }
+  std::reverse(words, words + length);
+  return length;
+}
+
+// Count the words accepted from state that come before those going through
+// its arc for label, and tell whether there is such an arc
+static uint32_t count_words_before(const Scorer::FstType& dictionary,
+                                   const std::vector<uint32_t>& word_counts,
+                                   Scorer::FstType::StateId state,
+                                   Scorer::FstType::Arc::Label label,
+                                   bool* found)
+{
+  uint32_t count = dictionary.Final(state) != fst::TropicalWeight::Zero() ? 1 : 0;
+  *found = false;
+  for (fst::ArcIterator<Scorer::FstType> aiter(dictionary, state); !aiter.Done(); aiter.Next()) {
+    const fst::StdArc& arc = aiter.Value();
+    if (arc.ilabel >= label) {
+      *found = arc.ilabel == label;
+      break;
+    }
+    count += word_counts[arc.nextstate];
+  }
+  return count;
+}
+
+// Count the words accepted from state and the states below it
+static uint32_t count_words(const Scorer::FstType& dictionary,
+                            Scorer::FstType::StateId state,
+                            std::vector<uint32_t>& word_counts,
+                            std::vector<bool>& counted)
+{
+  if (!counted[state]) {
+    uint32_t count = dictionary.Final(state) != fst::TropicalWeight::Zero() ? 1 : 0;
+    for (fst::ArcIterator<Scorer::FstType> aiter(dictionary, state); !aiter.Done(); aiter.Next()) {
+      count += count_words(dictionary, aiter.Value().nextstate, word_counts, counted);
+    }
+    word_counts[state] = count;
+    counted[state] = true;
+  }
+  return word_counts[state];
+}
+
+void Scorer::number_words()
+{
+  if (words_numbered_.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(word_numbering_mutex_);
+  if (words_numbered_.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  if (is_utf8_mode_) {
+    word_counts_.clear();
+    word_indices_.reset();
+    codepoint_indices_.reset(new std::atomic<uint64_t>[CODEPOINT_SLOTS]);
+    for (size_t i = 0; i < CODEPOINT_SLOTS; ++i) {
+      codepoint_indices_[i].store(NO_CODEPOINT, std::memory_order_relaxed);
+    }
+  } else {
+    word_counts_.assign(dictionary->NumStates(), 0);
+    std::vector<bool> counted(dictionary->NumStates(), false);
+    uint32_t num_words = count_words(*dictionary, dictionary->Start(), word_counts_, counted);
+    codepoint_indices_.reset();
+    word_indices_.reset(new std::atomic<lm::WordIndex>[num_words]);
+    for (uint32_t i = 0; i < num_words; ++i) {
+      word_indices_[i].store(PathTrie::NO_WORD_INDEX, std::memory_order_relaxed);
+    }
+  }
+  words_numbered_.store(true, std::memory_order_release);
+}
+
+bool Scorer::find_word_index(PathTrie* last, lm::WordIndex* index)
+{
+  // The word is followed by a space in the dictionary
+  bool found;
+  uint32_t number = count_words_before(*dictionary, word_counts_, last->dictionary_state(),
+                                       SPACE_ID_ + 1, &found);
+  if (!found) {
+    return false;
+  }
+  for (PathTrie* node = last; node->character != SPACE_ID_ && node->character != -1; node = node->parent) {
+    number += count_words_before(*dictionary, word_counts_, node->parent->dictionary_state(),
+                                 node->character + 1, &found);
+    if (!found) {
+      return false;
+    }
+  }
 
-  /* This makes the FST deterministic, meaning for any string input there's
-   * only one possible state the FST could be in.  It is assumed our
-   * dictionary is deterministic when using it.
-   * (lest we'd have to check for multiple transitions at each state)
-   */
-  fst::Determinize(dictionary, new_dict.get());
+  // Concurrent lookups of a new word find the same index
+  *index = word_indices_[number].load(std::memory_order_relaxed);
+  if (*index == PathTrie::NO_WORD_INDEX) {
+    std::vector<unsigned int> labels;
+    last->get_prev_word(labels, alphabet_);
+    *index = language_model_->BaseVocabulary().Index(alphabet_.Decode(labels));
+    word_indices_[number].store(*index, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+void Scorer::fill_dictionary(const std::unordered_set<std::string>& vocabulary,
+                             size_t num_threads)
+{
+  std::vector<const std::string*> entries;
+  entries.reserve(vocabulary.size());
+  for (const auto& word : vocabulary) {
+    if (word != START_TOKEN && word != UNK_TOKEN && word != END_TOKEN) {
+      entries.push_back(&word);
+    }
+  }
 
-  /* Finds the simplest equivalent fst. This is unnecessary but decreases
-   * memory usage of the dictionary
-   */
-  fst::Minimize(new_dict.get());
+  // Convert each unigram to ints, in shards. Words with characters outside
+  // of the alphabet are left empty and dropped after sorting.
+  num_threads = std::max<size_t>(1, std::min(num_threads, entries.size()));
+  std::vector<DictionaryBuilder::Word> words(entries.size());
+  {
+    ThreadPool pool(num_threads);
+    std::vector<std::future<void>> tasks;
+    for (size_t t = 0; t < num_threads; ++t) {
+      const size_t begin = entries.size() * t / num_threads;
+      const size_t end = entries.size() * (t + 1) / num_threads;
+      tasks.push_back(pool.enqueue([this, &entries, &words, begin, end] {
+        for (size_t i = begin; i < end; ++i) {
+          if (!word_to_labels(*entries[i], char_map_, is_utf8_mode_, SPACE_ID_ + 1, &words[i])) {
+            words[i].clear();
+          }
+        }
+      }));
+    }
+    for (auto& task : tasks) {
+      task.get();
+    }
+  }
+  DictionaryBuilder::Sort(&words, num_threads);
+
+  // Build the minimal dictionary from the sorted words, which makes it
+  // deterministic without RmEpsilon, Determinize and Minimize
+  DictionaryBuilder builder;
+  for (auto& word : words) {
+    if (!word.empty()) {
+      builder.Add(word);
+    }
+    DictionaryBuilder::Word().swap(word);
+  }
+  std::unique_ptr<fst::StdVectorFst> new_dict = builder.Finish();
 
   // Now we convert the MutableFst to a ConstFst (Scorer::FstType) via its ctor
   std::unique_ptr<FstType> converted(new FstType(*new_dict));
   this->dictionary = std::move(converted);
+  this->dense_dictionary.reset();
+  this->lookahead_.reset();
+  words_numbered_ = false;
+}
+
+void Scorer::build_dense_dictionary()
+{
+  dense_dictionary.reset(new DenseDictionary(*dictionary));
+}
+
+// Walk every word of the dictionary, raising the look-ahead of each state on
+// its path to the unigram score of the word. Returns the best score of the
+// words below state on this path.
+static float visit_lookahead(const Scorer::FstType& dictionary,
+                             Scorer::FstType::StateId state,
+                             unsigned int space_label,
+                             const Alphabet& alphabet,
+                             Scorer& scorer,
+                             std::vector<unsigned int>& labels,
+                             std::vector<float>& lookahead)
+{
+  float best = -NUM_FLT_INF;
+  for (fst::ArcIterator<Scorer::FstType> aiter(dictionary, state); !aiter.Done(); aiter.Next()) {
+    const fst::StdArc& arc = aiter.Value();
+    if (arc.ilabel == space_label) {
+      std::vector<std::string> word{alphabet.Decode(labels)};
+      best = std::max(best, static_cast<float>(scorer.get_log_cond_prob(word)));
+    } else {
+      labels.push_back(arc.ilabel - 1);
+      best = std::max(best, visit_lookahead(dictionary, arc.nextstate, space_label,
+                                            alphabet, scorer, labels, lookahead));
+      labels.pop_back();
+    }
+  }
+  lookahead[state] = std::max(lookahead[state], best);
+  return best;
+}
+
+bool Scorer::build_lookahead()
+{
+  lookahead_.reset();
+  if (is_utf8_mode_ || !dictionary || dictionary->Start() == fst::kNoStateId) {
+    return false;
+  }
+
+  // The dictionary is minimized, so a state can be shared by words with
+  // different prefixes and its look-ahead is the best score over all of them
+  std::vector<float> best(dictionary->NumStates(), -NUM_FLT_INF);
+  std::vector<unsigned int> labels;
+  visit_lookahead(*dictionary, dictionary->Start(), SPACE_ID_ + 1, alphabet_,
+                  *this, labels, best);
+  lookahead_ = share_buffer(std::move(best));
+  return true;
 }
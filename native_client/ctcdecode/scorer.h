@@ -1,17 +1,23 @@
 #ifndef SCORER_H_
 #define SCORER_H_
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "lm/virtual_interface.hh"
 #include "lm/word_index.hh"
+#include "util/mmap.hh"
 #include "util/string_piece.hh"
 
 #include "path_trie.h"
+#include "dense_dictionary.h"
+#include "score_cache.h"
 #include "alphabet.h"
 #include "deepspeech.h"
 
@@ -19,6 +25,7 @@ const double OOV_SCORE = -1000.0;
 const std::string START_TOKEN = "<s>";
 const std::string UNK_TOKEN = "<unk>";
 const std::string END_TOKEN = "</s>";
+const size_t DEFAULT_SCORE_CACHE_SIZE = 1 << 16;
 
 /* External scorer to query score for n-gram or sentence, including language
  * model scoring and word insertion.
@@ -32,12 +39,30 @@ public:
   using FstType = PathTrie::FstType;
 
   Scorer() = default;
-  ~Scorer() = default;
+  ~Scorer();
 
   // disallow copying
   Scorer(const Scorer&) = delete;
   Scorer& operator=(const Scorer&) = delete;
 
+  /* Set how init() and load_lm() bring the package into memory.
+   *
+   * Parameters:
+   *     load_method: KenLM load method of the language model, also applied
+   *                  to the dictionary: it is memory mapped with LAZY and
+   *                  read into memory otherwise.
+   *     prefault: With LAZY, touch every page of the mappings of the
+   *               package in a background thread after loading it, so that
+   *               they are mapped by the time decoding looks them up.
+   *     huge_pages: Back the tables with transparent huge pages where the
+   *                 system supports them. They don't apply to file mappings,
+   *                 so LAZY and POPULATE_OR_READ are then replaced by READ.
+  */
+  void set_load_options(util::LoadMethod load_method, bool prefault, bool huge_pages);
+
+  // seconds taken by the last load_lm(), not including prefaulting
+  double get_load_seconds() const { return load_seconds_; }
+
   int init(const std::string &lm_path,
            const Alphabet &alphabet);
 
@@ -53,6 +78,23 @@ public:
                            bool bos = false,
                            bool eos = false);
 
+  // An n-gram scored by get_log_cond_probs()
+  struct NgramQuery {
+    std::vector<std::string> ngram;
+    // language model indices of the words of the n-gram, used instead of
+    // ngram when num_words isn't zero
+    lm::WordIndex words[ScoreCache::MAX_NGRAM_LENGTH];
+    size_t num_words = 0;
+    bool bos = false;
+    // log probability of the last word, as given by get_log_cond_prob()
+    double score = 0.0;
+  };
+
+  // Score a batch of independent n-grams. Memory lookups of the language
+  // model are issued for several queries ahead of scoring them, so that
+  // their cache misses overlap instead of being paid one after the other.
+  void get_log_cond_probs(NgramQuery* queries, size_t count);
+
   // return the max order
   size_t get_max_order() const { return max_order_; }
 
@@ -63,11 +105,19 @@ public:
   void reset_params(float alpha, float beta);
 
   // force set UTF-8 mode, ignore value read from file
-  void set_utf8_mode(bool utf8) { is_utf8_mode_ = utf8; }
+  void set_utf8_mode(bool utf8) { is_utf8_mode_ = utf8; words_numbered_ = false; }
 
   // make ngram for a given prefix
   std::vector<std::string> make_ngram(PathTrie *prefix);
 
+  // Fill words with the language model indices of the n-gram make_ngram()
+  // returns for prefix, which must have been built with the dictionary of
+  // this scorer. Returns the length of the n-gram, or zero if a word can't
+  // be found in the dictionary, a codepoint isn't valid UTF-8 or there is no
+  // dictionary in word based LMs, in which case the n-gram has to be made
+  // with make_ngram().
+  size_t make_ngram_indices(PathTrie *prefix, lm::WordIndex *words);
+
   // trransform the labels in index to the vector of words (word based lm) or
   // the vector of characters (character based lm)
   std::vector<std::string> split_labels_into_scored_units(const std::vector<unsigned int> &labels);
@@ -80,30 +130,139 @@ public:
   // return weather this step represents a boundary where beam scoring should happen
   bool is_scoring_boundary(PathTrie* prefix, size_t new_label);
 
-  // fill dictionary FST from a vocabulary
-  void fill_dictionary(const std::unordered_set<std::string> &vocabulary);
+  // fill dictionary FST from a vocabulary, converting and sorting the words
+  // on num_threads threads
+  void fill_dictionary(const std::unordered_set<std::string> &vocabulary,
+                       size_t num_threads = 1);
+
+  // build a dense transition table of the dictionary, which is used for
+  // decoding and saved along with the dictionary
+  void build_dense_dictionary();
+
+  // compute the LM look-ahead of every dictionary state, which is used for
+  // decoding and saved along with the dictionary. Only word based LMs are
+  // supported, returns false in UTF-8 mode.
+  bool build_lookahead();
 
   // load language model from given path
   int load_lm(const std::string &lm_path);
 
+  // set the number of n-gram scores kept in the cache shared by every decoder
+  // using this scorer, zero disables caching. Not safe to call while decoding.
+  void set_cache_size(size_t num_entries);
+
+  // number of n-gram scores served from / missing in the cache
+  uint64_t get_cache_hits() const { return score_cache_.hits(); }
+  uint64_t get_cache_misses() const { return score_cache_.misses(); }
+
+  void reset_cache_stats() { score_cache_.reset_stats(); }
+
   // language model weight
   double alpha = 0.;
   // word insertion weight
   double beta = 0.;
 
+  // The dictionary tables are shared with the decoders using them, which
+  // keeps them valid for running streams if another package or dictionary
+  // is loaded. Scoring still goes through the scorer though, so the scorer
+  // of running streams must not be changed.
+
   // pointer to the dictionary of FST
-  std::unique_ptr<FstType> dictionary;
+  std::shared_ptr<FstType> dictionary;
+
+  // dense transition table of the dictionary, null if the package has none
+  std::shared_ptr<DenseDictionary> dense_dictionary;
+
+  // best unigram score (natural log) of the words going through each
+  // dictionary state, null if the package has no look-ahead
+  const std::shared_ptr<const float>& get_lookahead() const { return lookahead_; }
 
 protected:
   // necessary setup after setting alphabet
   void setup_char_map();
 
-  int load_trie(std::ifstream& fin, const std::string& file_path);
+  // read the dictionary of version 6 and 7 packages
+  int load_trie(std::istream& fin, const std::string& file_path, bool memorymap);
+
+  // read the sections of a version 8 package, whose header is at
+  // header_offset of the file and mapped in package_ from package_offset on
+  int load_sections(uint64_t package_offset,
+                    uint64_t header_offset,
+                    const std::string& file_path,
+                    bool memorymap);
 
 private:
+  // touch the pages of the mappings of the package in a background thread,
+  // including lm_mapping, the one of the language model
+  void start_prefault(const util::scoped_memory* lm_mapping);
+  void stop_prefault();
+
+  // Score an n-gram with language_model_ as its concrete KenLM model type,
+  // so that vocabulary lookups and scoring are inlined
+  template<class Model>
+  double score_ngram(const std::vector<std::string>::const_iterator& begin,
+                     const std::vector<std::string>::const_iterator& end,
+                     bool bos,
+                     bool eos);
+
+  template<class Model>
+  void score_ngrams(NgramQuery* queries, size_t count);
+
+  // number the words of the dictionary, or clear the codepoint indices in
+  // UTF-8 mode, unless it is done already
+  void number_words();
+
+  // make_ngram_indices() in UTF-8 mode, where prefixes know the codepoints
+  // they end with
+  size_t make_codepoint_indices(PathTrie* prefix, lm::WordIndex* words);
+
+  // Look up the index of the word ending at last, whose number in the
+  // dictionary is computed from the states of its prefixes. Returns false
+  // if the word isn't in the dictionary.
+  bool find_word_index(PathTrie* last, lm::WordIndex* index);
+
   std::unique_ptr<lm::base::Model> language_model_;
+  // instantiations of score_ngram() and score_ngrams() for the type of
+  // language_model_, chosen once when loading it
+  double (Scorer::*score_ngram_)(const std::vector<std::string>::const_iterator&,
+                                 const std::vector<std::string>::const_iterator&,
+                                 bool,
+                                 bool) = nullptr;
+  void (Scorer::*score_ngrams_)(NgramQuery*, size_t) = nullptr;
   bool is_utf8_mode_ = true;
   size_t max_order_ = 0;
+  size_t cache_size_ = DEFAULT_SCORE_CACHE_SIZE;
+  ScoreCache score_cache_;
+
+  util::LoadMethod load_method_ = util::LoadMethod::LAZY;
+  bool prefault_ = false;
+  bool huge_pages_ = false;
+  double load_seconds_ = 0.0;
+  std::thread prefault_thread_;
+  std::atomic<bool> stop_prefault_{false};
+
+  // mapping of the package from its dictionary on while loading it, kept
+  // alive by a look-ahead pointing into it
+  std::shared_ptr<util::scoped_memory> package_;
+  // either into package_ or into a buffer it owns
+  std::shared_ptr<const float> lookahead_;
+
+  // Words of the dictionary are numbered in label order on first use: the
+  // number of a word is the count of words before it, which is the sum of
+  // the words accepted by the arcs left aside by its path. The minimal
+  // dictionary shares the states words end in, so these can't identify them.
+  std::mutex word_numbering_mutex_;
+  std::atomic<bool> words_numbered_{false};
+  // number of words accepted from each dictionary state
+  std::vector<uint32_t> word_counts_;
+  // vocabulary index of each word by number, looked up the first time the
+  // word is scored
+  std::unique_ptr<std::atomic<lm::WordIndex>[]> word_indices_;
+  // In UTF-8 mode, vocabulary index of the scored codepoints instead, in a
+  // direct mapped table of (codepoint << 32 | index) entries. LMs know a few
+  // scripts rather than all of Unicode, colliding codepoints are looked up
+  // in the vocabulary again.
+  std::unique_ptr<std::atomic<uint64_t>[]> codepoint_indices_;
 
   int SPACE_ID_;
   Alphabet alphabet_;
@@ -0,0 +1,241 @@
+#include "scorer.h"
+#include "test_util.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Checks that scorer packages are written as version 8 only when they have
+// a dense dictionary or look-ahead, that they load to the same dictionary,
+// dense dictionary, look-ahead and scores as the version 7 package of the
+// same content, with every load method, and that damaged packages are
+// rejected with an error code.
+
+// Write the version 7 package of the content of scorer, appended to the
+// language model at lm_path, as save_dictionary() used to
+static bool write_v7_package(Scorer& scorer, const std::string& lm_path, const std::string& path)
+{
+  {
+    std::ifstream lm_src(lm_path, std::ios::binary);
+    std::ofstream package_dest(path, std::ios::binary);
+    package_dest << lm_src.rdbuf();
+  }
+  std::fstream fout(path, std::ios::in|std::ios::out|std::ios::binary|std::ios::ate);
+  const int32_t magic = 'T' << 24 | 'R' << 16 | 'I' << 8 | 'E';
+  const int32_t version = 7;
+  const int32_t flags = (scorer.dense_dictionary ? 1 : 0) | (scorer.get_lookahead() ? 2 : 0);
+  const bool utf8 = scorer.is_utf8_mode();
+  fout.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+  fout.write(reinterpret_cast<const char*>(&version), sizeof(version));
+  fout.write(reinterpret_cast<const char*>(&flags), sizeof(flags));
+  fout.write(reinterpret_cast<const char*>(&utf8), sizeof(utf8));
+  fout.write(reinterpret_cast<const char*>(&scorer.alpha), sizeof(scorer.alpha));
+  fout.write(reinterpret_cast<const char*>(&scorer.beta), sizeof(scorer.beta));
+  fst::FstWriteOptions opt;
+  opt.align = true;
+  opt.source = path;
+  if (!scorer.dictionary->Write(fout, opt)) {
+    return false;
+  }
+  if (scorer.dense_dictionary && !scorer.dense_dictionary->Write(fout)) {
+    return false;
+  }
+  if (scorer.get_lookahead()) {
+    const int32_t num_states = scorer.dictionary->NumStates();
+    fout.write(reinterpret_cast<const char*>(&num_states), sizeof(num_states));
+    fout.write(reinterpret_cast<const char*>(scorer.get_lookahead().get()),
+               num_states * sizeof(float));
+  }
+  return !fout.bad();
+}
+
+// Version of the package at path, whose header follows the language model
+// at lm_path
+static int32_t package_version(const std::string& path, const std::string& lm_path)
+{
+  uint64_t header_offset;
+  {
+    std::unique_ptr<lm::base::Model> model(lm::ngram::LoadVirtual(lm_path.c_str()));
+    header_offset = model->GetEndOfSearchOffset();
+  }
+  std::ifstream in(path, std::ios::binary);
+  in.seekg(header_offset + sizeof(int32_t));
+  int32_t version = 0;
+  in.read(reinterpret_cast<char*>(&version), sizeof(version));
+  return version;
+}
+
+static void expect_same_dense_dictionary(const DenseDictionary& a, const DenseDictionary& b)
+{
+  EXPECT(a.NumStates() == b.NumStates() && a.NumLabels() == b.NumLabels() &&
+         a.Start() == b.Start(), "dense dictionaries differ in size");
+  if (a.NumStates() != b.NumStates() || a.NumLabels() != b.NumLabels()) {
+    return;
+  }
+  size_t differences = 0;
+  for (int32_t s = 0; s < a.NumStates(); ++s) {
+    differences += a.IsFinal(s) != b.IsFinal(s);
+    for (int32_t l = 0; l < a.NumLabels(); ++l) {
+      differences += a.Next(s, l) != b.Next(s, l);
+    }
+  }
+  EXPECT(differences == 0, "%zu dense dictionary entries differ", differences);
+}
+
+static void expect_same_scores(Scorer& a, Scorer& b, const std::vector<std::string>& words)
+{
+  std::mt19937 rng(7);
+  size_t differences = 0;
+  for (int i = 0; i < 2000; ++i) {
+    std::vector<std::string> ngram(1 + rng() % a.get_max_order());
+    for (std::string& word : ngram) {
+      word = words[rng() % words.size()];
+    }
+    const bool bos = rng() % 2;
+    differences += a.get_log_cond_prob(ngram, bos) != b.get_log_cond_prob(ngram, bos);
+  }
+  EXPECT(differences == 0, "%zu n-gram scores differ", differences);
+}
+
+static void test_v7_equivalence(const Alphabet& alphabet,
+                                const std::string& lm_path,
+                                const std::vector<std::string>& words,
+                                bool dense,
+                                bool lookahead)
+{
+  const std::string v8_path = test_file("v8.scorer");
+  const std::string v7_path = test_file("v7.scorer");
+  EXPECT(write_test_package(lm_path, v8_path, alphabet, false, words, dense, lookahead),
+         "can't write package");
+  // packages with nothing version 6 lacks are readable by older releases
+  const int32_t version = package_version(v8_path, lm_path);
+  EXPECT(version == (dense || lookahead ? 8 : 6), "package written as version %d", version);
+  {
+    Scorer scorer;
+    EXPECT(scorer.init(v8_path, alphabet) == DS_ERR_OK, "can't load version 8 package");
+    EXPECT(write_v7_package(scorer, lm_path, v7_path), "can't write version 7 package");
+  }
+
+  for (util::LoadMethod method : {util::LoadMethod::LAZY,
+                                  util::LoadMethod::POPULATE_OR_READ,
+                                  util::LoadMethod::READ,
+                                  util::LoadMethod::PARALLEL_READ}) {
+    Scorer v7, v8;
+    v7.set_load_options(method, false, false);
+    v8.set_load_options(method, false, false);
+    int err7 = v7.init(v7_path, alphabet);
+    int err8 = v8.init(v8_path, alphabet);
+    EXPECT(err7 == DS_ERR_OK && err8 == DS_ERR_OK,
+           "load method %d: errors %d and %d", (int)method, err7, err8);
+    if (err7 != DS_ERR_OK || err8 != DS_ERR_OK) {
+      continue;
+    }
+
+    EXPECT(v7.alpha == v8.alpha && v7.beta == v8.beta, "weights differ");
+    EXPECT(v7.is_utf8_mode() == v8.is_utf8_mode(), "UTF-8 modes differ");
+    EXPECT(fst::Equal(*v7.dictionary, *v8.dictionary), "dictionaries differ");
+
+    EXPECT(!v7.dense_dictionary == !dense && !v8.dense_dictionary == !dense,
+           "dense dictionary not loaded as stored");
+    if (v7.dense_dictionary && v8.dense_dictionary) {
+      expect_same_dense_dictionary(*v7.dense_dictionary, *v8.dense_dictionary);
+    }
+
+    EXPECT(!v7.get_lookahead() == !lookahead && !v8.get_lookahead() == !lookahead,
+           "look-ahead not loaded as stored");
+    if (v7.get_lookahead() && v8.get_lookahead()) {
+      EXPECT(memcmp(v7.get_lookahead().get(), v8.get_lookahead().get(),
+                    v8.dictionary->NumStates() * sizeof(float)) == 0,
+             "look-aheads differ");
+    }
+
+    expect_same_scores(v7, v8, words);
+  }
+}
+
+// Prefaulting runs alongside decoding, and stops when the scorer is
+// reloaded or destroyed
+static void test_prefault(const Alphabet& alphabet, const std::vector<std::string>& words)
+{
+  const std::string path = test_file("v8.scorer");
+  Scorer reference;
+  EXPECT(reference.init(path, alphabet) == DS_ERR_OK, "can't load package");
+  Scorer scorer;
+  scorer.set_load_options(util::LoadMethod::LAZY, true, false);
+  EXPECT(scorer.init(path, alphabet) == DS_ERR_OK, "can't load package with prefaulting");
+  EXPECT(scorer.get_load_seconds() > 0.0, "load time not recorded");
+  expect_same_scores(reference, scorer, words);
+  EXPECT(scorer.init(path, alphabet) == DS_ERR_OK, "can't reload package with prefaulting");
+  expect_same_scores(reference, scorer, words);
+}
+
+static void test_damaged_packages(const Alphabet& alphabet, const std::string& lm_path)
+{
+  const std::string path = test_file("v8.scorer");
+  std::string package;
+  {
+    std::ifstream in(path, std::ios::binary);
+    package.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  uint64_t header_offset;
+  {
+    std::unique_ptr<lm::base::Model> model(lm::ngram::LoadVirtual(lm_path.c_str()));
+    header_offset = model->GetEndOfSearchOffset();
+  }
+
+  // a flipped bit in the header fails its checksum
+  {
+    std::string damaged(package);
+    damaged[header_offset + 20] ^= 1;
+    std::ofstream(test_file("damaged.scorer"), std::ios::binary) << damaged;
+    Scorer scorer;
+    EXPECT(scorer.init(test_file("damaged.scorer"), alphabet) == DS_ERR_SCORER_INVALID_TRIE,
+           "damaged header accepted");
+  }
+
+  // sections past the end of the file
+  {
+    std::ofstream(test_file("truncated.scorer"), std::ios::binary)
+      << package.substr(0, package.size() - 1);
+    Scorer scorer;
+    EXPECT(scorer.init(test_file("truncated.scorer"), alphabet) == DS_ERR_SCORER_INVALID_TRIE,
+           "truncated package accepted");
+  }
+
+  // no dictionary at all
+  {
+    Scorer scorer;
+    EXPECT(scorer.init(lm_path, alphabet) == DS_ERR_SCORER_NO_TRIE,
+           "language model without dictionary accepted");
+  }
+
+  {
+    Scorer scorer;
+    EXPECT(scorer.init(test_file("missing.scorer"), alphabet) == DS_ERR_SCORER_UNREADABLE,
+           "missing package accepted");
+  }
+}
+
+int main()
+{
+  Alphabet alphabet;
+  if (!make_test_alphabet(alphabet)) {
+    fprintf(stderr, "can't write alphabet\n");
+    return 1;
+  }
+  const std::vector<std::string> words = make_test_words(2000, 1);
+  const std::string arpa_path = test_file("package_test.arpa");
+  const std::string lm_path = test_file("package_test.binary");
+  write_test_arpa(arpa_path, words, 3, 2);
+  build_test_lm(arpa_path, lm_path);
+
+  test_v7_equivalence(alphabet, lm_path, words, false, false);
+  test_v7_equivalence(alphabet, lm_path, words, true, true);
+  test_prefault(alphabet, words);
+  test_damaged_packages(alphabet, lm_path);
+  return test_result();
+}
@@ -0,0 +1,262 @@
+#include "beam_table.h"
+#include "path_trie.h"
+#include "scorer.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// Checks that the batched, prefetched scoring of n-grams gives bitwise the
+// same scores as scoring them one by one, for several KenLM model types and
+// with or without the score cache, and that the n-grams of prefixes made of
+// language model indices score like the ones made of words or codepoints.
+
+static const size_t ORDER = 4;
+
+static std::vector<Scorer::NgramQuery> make_queries(const std::vector<std::string>& words,
+                                                    size_t count,
+                                                    unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::vector<Scorer::NgramQuery> queries(count);
+  for (Scorer::NgramQuery& query : queries) {
+    // n-grams up to longer than the cache keys, some with a word the LM
+    // doesn't know, some repeated
+    const size_t length = rng() % 50 == 0 ? ScoreCache::MAX_NGRAM_LENGTH + 1 : 1 + rng() % (ORDER + 1);
+    for (size_t i = 0; i < length; ++i) {
+      query.ngram.push_back(rng() % 200 == 0 ? "notaword" : words[rng() % std::min<size_t>(words.size(), 300)]);
+    }
+    query.bos = rng() % 2;
+  }
+  for (size_t i = 1; i < count; i += 17) {
+    queries[i].ngram = queries[i-1].ngram;
+    queries[i].bos = queries[i-1].bos;
+  }
+  return queries;
+}
+
+template<class Model>
+void test_batched_scores(const char* name,
+                         const Alphabet& alphabet,
+                         const std::string& arpa_path,
+                         const std::vector<std::string>& words)
+{
+  const std::string lm_path = test_file("scorer_test.binary");
+  const std::string package_path = test_file("scorer_test.scorer");
+  build_test_lm<Model>(arpa_path, lm_path);
+  EXPECT(write_test_package(lm_path, package_path, alphabet, false, words, false, false),
+         "%s: can't write package", name);
+
+  Scorer reference;
+  reference.set_cache_size(0);
+  EXPECT(reference.init(package_path, alphabet) == DS_ERR_OK, "%s: can't load package", name);
+  std::vector<Scorer::NgramQuery> queries = make_queries(words, 5000, 11);
+  std::vector<double> expected(queries.size());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    expected[i] = reference.get_log_cond_prob(queries[i].ngram, queries[i].bos);
+  }
+
+  for (size_t cache_size : {0, 1 << 16}) {
+    Scorer scorer;
+    scorer.set_cache_size(cache_size);
+    EXPECT(scorer.init(package_path, alphabet) == DS_ERR_OK, "%s: can't load package", name);
+    // batches shorter and longer than the prefetch distance, twice so that
+    // the second pass is served by the cache if there is one
+    for (size_t batch_size : {1, 7, 8, 9, 100, 5000, 100}) {
+      for (Scorer::NgramQuery& query : queries) {
+        query.score = 0.0;
+      }
+      for (size_t begin = 0; begin < queries.size(); begin += batch_size) {
+        scorer.get_log_cond_probs(&queries[begin], std::min(batch_size, queries.size() - begin));
+      }
+      size_t differences = 0;
+      for (size_t i = 0; i < queries.size(); ++i) {
+        differences += queries[i].score != expected[i];
+      }
+      EXPECT(differences == 0, "%s, cache of %zu, batches of %zu: %zu scores differ",
+             name, cache_size, batch_size, differences);
+    }
+    // single scores are still the same once the batches filled the cache
+    size_t differences = 0;
+    for (size_t i = 0; i < queries.size(); ++i) {
+      differences += scorer.get_log_cond_prob(queries[i].ngram, queries[i].bos) != expected[i];
+    }
+    EXPECT(differences == 0, "%s, cache of %zu: %zu single scores differ", name, cache_size, differences);
+  }
+}
+
+// Check that the n-gram of prefix scores the same from the language model
+// indices make_ngram_indices() gives as from the words make_ngram() gives,
+// and return the number of indices
+static size_t expect_indices_score_like_words(Scorer& scorer, PathTrie* prefix, const char* name)
+{
+  Scorer::NgramQuery by_index, by_words;
+  by_index.num_words = scorer.make_ngram_indices(prefix, by_index.words);
+  by_words.ngram = scorer.make_ngram(prefix);
+  if (by_index.num_words == 0) {
+    return 0;
+  }
+  EXPECT(by_index.num_words == by_words.ngram.size(), "%s: %zu indices for %zu words",
+         name, by_index.num_words, by_words.ngram.size());
+  by_index.bos = by_words.bos = by_words.ngram.size() < scorer.get_max_order();
+  scorer.get_log_cond_probs(&by_index, 1);
+  scorer.get_log_cond_probs(&by_words, 1);
+  EXPECT(by_index.score == by_words.score, "%s: n-gram ending with \"%s\" scores %f from indices, %f from words",
+         name, by_words.ngram.back().c_str(), by_index.score, by_words.score);
+  return by_index.num_words;
+}
+
+// Spell random sentences of dictionary words into a prefix tree, as the
+// decoder does, and check the n-gram of each word from its indices
+static void test_word_indices(const Alphabet& alphabet,
+                              const std::string& arpa_path,
+                              const std::vector<std::string>& words,
+                              bool dense)
+{
+  const char* name = dense ? "words, dense dictionary" : "words";
+  const std::string lm_path = test_file("scorer_test_words.binary");
+  const std::string package_path = test_file("scorer_test_words.scorer");
+  build_test_lm(arpa_path, lm_path);
+  // the dictionary also has words the language model doesn't know
+  std::vector<std::string> dictionary_words(words);
+  const std::set<std::string> lm_words(words.begin(), words.end());
+  for (const std::string& word : make_test_words(200, 9)) {
+    if (!lm_words.count(word)) {
+      dictionary_words.push_back(word);
+    }
+  }
+  EXPECT(write_test_package(lm_path, package_path, alphabet, false, dictionary_words, dense, false),
+         "%s: can't write package", name);
+
+  Scorer scorer;
+  scorer.set_cache_size(0);
+  EXPECT(scorer.init(package_path, alphabet) == DS_ERR_OK, "%s: can't load package", name);
+  if (!scorer.dictionary) {
+    return;
+  }
+  PathTrie::Dictionary dictionary;
+  dictionary.fst = scorer.dictionary.get();
+  dictionary.dense = scorer.dense_dictionary.get();
+
+  BeamTable beams;
+  std::unique_ptr<PathTrie> root(new PathTrie);
+  root->beam_id = beams.allocate(root.get(), root->character);
+  root->set_dictionary_state(dictionary.fst->Start());
+
+  std::mt19937 rng(13);
+  size_t scored = 0;
+  for (int sentence = 0; sentence < 300; ++sentence) {
+    PathTrie* prefix = root.get();
+    for (int i = 0, length = 1 + rng() % 8; i < length && prefix; ++i) {
+      const std::string& word = dictionary_words[rng() % dictionary_words.size()];
+      for (unsigned int label : alphabet.Encode(word)) {
+        prefix = prefix->get_path_trie(beams, dictionary, label, 0.f);
+        if (!prefix) {
+          break;
+        }
+      }
+      EXPECT(prefix, "%s: can't spell \"%s\"", name, word.c_str());
+      if (!prefix) {
+        break;
+      }
+      // a word is scored when the space after it comes
+      const size_t num_words = expect_indices_score_like_words(scorer, prefix, name);
+      EXPECT(num_words == std::min<size_t>(i + 1, ORDER), "%s: %zu indices for word %d of a sentence",
+             name, num_words, i + 1);
+      scored += num_words != 0;
+      prefix = prefix->get_path_trie(beams, dictionary, alphabet.GetSpaceLabel(), 0.f);
+    }
+  }
+  EXPECT(scored > 0, "%s: no n-gram was scored", name);
+}
+
+// Append the bytes of text to prefix, without a dictionary as in UTF-8 mode,
+// checking the n-gram of every complete codepoint from its indices
+static PathTrie* append_bytes(Scorer& scorer, BeamTable& beams, PathTrie* prefix,
+                              const std::string& text, size_t* scored)
+{
+  for (unsigned char byte : text) {
+    prefix = prefix->get_path_trie(beams, PathTrie::Dictionary(), byte - 1, 0.f);
+    const size_t num_codepoints = expect_indices_score_like_words(scorer, prefix, "codepoints");
+    EXPECT(prefix->ends_codepoint() == (num_codepoints != 0),
+           "codepoints: %zu indices after byte 0x%02x", num_codepoints, byte);
+    *scored += num_codepoints != 0;
+  }
+  return prefix;
+}
+
+static void test_codepoint_indices()
+{
+  const std::vector<std::string> codepoints = {
+    "a", "b", "c", "d", "e", "f", "'", "\xc3\xa9", "\xc3\x9f", "\xe6\x97\xa5", "\xe6\x9c\xac", "\xf0\x9f\x99\x82"
+  };
+  const std::string arpa_path = test_file("scorer_test_codepoints.arpa");
+  const std::string lm_path = test_file("scorer_test_codepoints.binary");
+  const std::string package_path = test_file("scorer_test_codepoints.scorer");
+  write_test_arpa(arpa_path, codepoints, ORDER, 5);
+  build_test_lm(arpa_path, lm_path);
+  UTF8Alphabet alphabet;
+  EXPECT(write_test_package(lm_path, package_path, alphabet, true, codepoints, false, false),
+         "codepoints: can't write package");
+
+  Scorer scorer;
+  scorer.set_cache_size(0);
+  EXPECT(scorer.init(package_path, alphabet) == DS_ERR_OK, "codepoints: can't load package");
+  if (!scorer.is_utf8_mode()) {
+    return;
+  }
+
+  BeamTable beams;
+  std::unique_ptr<PathTrie> root(new PathTrie);
+  root->beam_id = beams.allocate(root.get(), root->character);
+
+  // codepoints of the language model and one it doesn't know
+  std::vector<std::string> text_codepoints(codepoints);
+  text_codepoints.push_back("\xc3\xb1");
+  std::mt19937 rng(17);
+  size_t scored = 0;
+  for (int i = 0; i < 200; ++i) {
+    PathTrie* prefix = root.get();
+    for (int j = 0, length = 1 + rng() % 10; j < length; ++j) {
+      prefix = append_bytes(scorer, beams, prefix, text_codepoints[rng() % text_codepoints.size()], &scored);
+    }
+  }
+  EXPECT(scored > 0, "codepoints: no n-gram was scored");
+
+  // n-grams with an incomplete, overlong or stray byte sequence are left to
+  // make_ngram()
+  for (const char* text : {"ab\xc3" "c", "a\xc0\x80" "b", "\x80" "ab", "a\xe6\x97" "b", "ab\xf8\x88\x80\x80\x80"}) {
+    PathTrie* prefix = root.get();
+    for (unsigned char byte : std::string(text)) {
+      prefix = prefix->get_path_trie(beams, PathTrie::Dictionary(), byte - 1, 0.f);
+    }
+    lm::WordIndex words[ScoreCache::MAX_NGRAM_LENGTH];
+    EXPECT(scorer.make_ngram_indices(prefix, words) == 0,
+           "codepoints: indices for an invalid sequence of %zu bytes", strlen(text));
+  }
+}
+
+int main()
+{
+  Alphabet alphabet;
+  if (!make_test_alphabet(alphabet)) {
+    fprintf(stderr, "can't write alphabet\n");
+    return 1;
+  }
+  const std::vector<std::string> words = make_test_words(3000, 3);
+  const std::string arpa_path = test_file("scorer_test.arpa");
+  write_test_arpa(arpa_path, words, ORDER, 4);
+
+  test_batched_scores<lm::ngram::ProbingModel>("probing", alphabet, arpa_path, words);
+  test_batched_scores<lm::ngram::TrieModel>("trie", alphabet, arpa_path, words);
+  test_batched_scores<lm::ngram::QuantArrayTrieModel>("quantized array trie", alphabet, arpa_path, words);
+  test_word_indices(alphabet, arpa_path, words, false);
+  test_word_indices(alphabet, arpa_path, words, true);
+  test_codepoint_indices();
+  return test_result();
+}
@@ -8,6 +8,7 @@
 %}
 
 %include <pyabc.i>
+%include <stdint.i>
 %include <std_string.i>
 %include <std_vector.i>
 %include <std_shared_ptr.i>
@@ -27,6 +28,7 @@ namespace std {
 }
 
 %shared_ptr(Scorer);
+%shared_ptr(HotWordTrie);
 
 // Convert NumPy arrays to pointer+lengths
 %apply (double* IN_ARRAY2, int DIM1, int DIM2) {(const double *probs, int time_dim, int class_dim)};
@@ -35,10 +37,15 @@ namespace std {
 %apply (unsigned int* IN_ARRAY1, int DIM1) {(const unsigned int *input, int length)};
 
 %ignore Scorer::dictionary;
+%ignore Scorer::set_load_options;
+%ignore Scorer::get_lookahead;
+%ignore Scorer::get_log_cond_probs;
+%ignore Scorer::make_ngram_indices;
 
 %include "../alphabet.h"
 %include "output.h"
 %include "scorer.h"
+%include "hot_words.h"
 %include "ctc_beam_search_decoder.h"
 
 %constant const char* __version__ = ds_version();
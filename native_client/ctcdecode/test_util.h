@@ -0,0 +1,231 @@
+#ifndef TEST_UTIL_H_
+#define TEST_UTIL_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "lm/model.hh"
+
+#include "scorer.h"
+
+/* Minimal checks for the decoder tests, which are plain programs so that they
+ * build wherever the decoder does. EXPECT() reports a failed condition with a
+ * printf-style message and lets the test go on, test_result() gives the exit
+ * status of the test.
+ */
+
+static int test_failures = 0;
+
+#define EXPECT(cond, ...)                                 \
+  do {                                                    \
+    if (!(cond)) {                                        \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);     \
+      fprintf(stderr, __VA_ARGS__);                       \
+      fprintf(stderr, "\n");                              \
+      ++test_failures;                                    \
+    }                                                     \
+  } while (0)
+
+static inline int test_result()
+{
+  if (test_failures) {
+    fprintf(stderr, "%d checks failed\n", test_failures);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
+
+/* The tests needing a scorer make their own from a random language model, so
+ * that they don't depend on data files.
+ */
+
+// Path of a file written by a test, in the directory Bazel gives tests
+static inline std::string test_file(const std::string& name)
+{
+  const char* dir = getenv("TEST_TMPDIR");
+  return std::string(dir ? dir : "/tmp") + "/" + name;
+}
+
+// Write an alphabet of space, apostrophe and a-z, and initialize alphabet
+// with it
+static inline bool make_test_alphabet(Alphabet& alphabet)
+{
+  const std::string path = test_file("alphabet.txt");
+  {
+    std::ofstream out(path);
+    out << " \n'\n";
+    for (char c = 'a'; c <= 'z'; ++c) {
+      out << c << "\n";
+    }
+  }
+  return alphabet.init(path.c_str()) == 0;
+}
+
+// num_words distinct random words over a-z
+static inline std::vector<std::string> make_test_words(size_t num_words, unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::set<std::string> words;
+  while (words.size() < num_words) {
+    std::string word;
+    const size_t length = 1 + rng() % 9;
+    for (size_t i = 0; i < length; ++i) {
+      word += static_cast<char>('a' + rng() % 26);
+    }
+    words.insert(word);
+  }
+  return std::vector<std::string>(words.begin(), words.end());
+}
+
+/* Write a random ARPA language model of the given order over words. Each
+ * n-gram is in it with its context and the n-gram of its last n - 1 words,
+ * as ARPA files require.
+ */
+static inline void write_test_arpa(const std::string& path,
+                                   const std::vector<std::string>& words,
+                                   size_t order,
+                                   unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> prob(-4.f, -0.5f);
+  std::uniform_real_distribution<float> backoff(-1.f, 0.f);
+
+  std::vector<std::string> unigrams = words;
+  unigrams.push_back("<s>");
+  unigrams.push_back("</s>");
+  unigrams.push_back("<unk>");
+
+  // n-grams of each order, as words
+  std::vector<std::set<std::vector<std::string>>> ngrams(order);
+  for (const std::string& word : unigrams) {
+    ngrams[0].insert({word});
+  }
+  for (size_t n = 1; n < order; ++n) {
+    for (const auto& context : ngrams[n-1]) {
+      if (context.back() == "</s>" || context.back() == "<unk>") {
+        continue;
+      }
+      for (int i = 0; i < 3; ++i) {
+        const std::string& next = unigrams[rng() % (unigrams.size() - 1)];
+        if (next == "<s>") {
+          continue;
+        }
+        std::vector<std::string> ngram(context);
+        ngram.push_back(next);
+        if (n > 1 && !ngrams[n-1].count(std::vector<std::string>(ngram.begin() + 1, ngram.end()))) {
+          continue;
+        }
+        ngrams[n].insert(ngram);
+      }
+    }
+  }
+
+  std::ofstream out(path);
+  out << "\\data\\\n";
+  for (size_t n = 0; n < order; ++n) {
+    out << "ngram " << n + 1 << "=" << ngrams[n].size() << "\n";
+  }
+  for (size_t n = 0; n < order; ++n) {
+    out << "\n\\" << n + 1 << "-grams:\n";
+    for (const auto& ngram : ngrams[n]) {
+      out << (ngram == std::vector<std::string>{"<s>"} ? -99.f : prob(rng));
+      for (const std::string& word : ngram) {
+        out << (&word == &ngram[0] ? "\t" : " ") << word;
+      }
+      if (n + 1 < order && ngram.back() != "</s>") {
+        out << "\t" << backoff(rng);
+      }
+      out << "\n";
+    }
+  }
+  out << "\n\\end\\\n";
+}
+
+// Build the binary language model of an ARPA file, without its vocabulary
+// like generate_lm.py does
+template<class Model = lm::ngram::TrieModel>
+void build_test_lm(const std::string& arpa_path, const std::string& lm_path)
+{
+  lm::ngram::Config config;
+  config.write_mmap = lm_path.c_str();
+  config.write_method = lm::ngram::Config::WRITE_AFTER;
+  config.include_vocab = false;
+  config.messages = nullptr;
+  Model model(arpa_path.c_str(), config);
+}
+
+// Make a scorer package of a binary language model, like
+// generate_scorer_package does
+static inline bool write_test_package(const std::string& lm_path,
+                                      const std::string& package_path,
+                                      const Alphabet& alphabet,
+                                      bool utf8,
+                                      const std::vector<std::string>& words,
+                                      bool dense_dictionary,
+                                      bool lookahead)
+{
+  Scorer scorer;
+  scorer.set_alphabet(alphabet);
+  scorer.set_utf8_mode(utf8);
+  scorer.reset_params(0.93f, 1.18f);
+  if (scorer.load_lm(lm_path) != DS_ERR_SCORER_NO_TRIE) {
+    return false;
+  }
+  scorer.fill_dictionary(std::unordered_set<std::string>(words.begin(), words.end()));
+  if (dense_dictionary) {
+    scorer.build_dense_dictionary();
+  }
+  if (lookahead && !scorer.build_lookahead()) {
+    return false;
+  }
+  {
+    std::ifstream lm_src(lm_path, std::ios::binary);
+    std::ofstream package_dest(package_path, std::ios::binary);
+    package_dest << lm_src.rdbuf();
+  }
+  return scorer.save_dictionary(package_path, true);
+}
+
+/* Frames of class probabilities spelling text, as an acoustic model would
+ * output them for the decoder tests: each character is the most probable
+ * class of two frames followed by a blank one, and the rest of the mass is
+ * spread randomly over the other classes, so that the beam has competing
+ * prefixes to expand.
+ */
+static inline std::vector<double> make_test_probs(const std::string& text,
+                                                  const Alphabet& alphabet,
+                                                  unsigned seed,
+                                                  double peak = 0.6)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> noise(0.0, 1.0);
+  const size_t class_dim = alphabet.GetSize() + 1;
+  const unsigned int blank = alphabet.GetSize();
+
+  std::vector<unsigned int> labels;
+  for (unsigned int label : alphabet.Encode(text)) {
+    labels.insert(labels.end(), {label, label, blank});
+  }
+  std::vector<double> probs;
+  std::vector<double> frame(class_dim);
+  for (unsigned int label : labels) {
+    double total = 0.0;
+    for (size_t c = 0; c < class_dim; ++c) {
+      frame[c] = c == label ? 0.0 : noise(rng);
+      total += frame[c];
+    }
+    for (size_t c = 0; c < class_dim; ++c) {
+      probs.push_back(c == label ? peak : frame[c] * (1.0 - peak) / total);
+    }
+  }
+  return probs;
+}
+
+#endif // TEST_UTIL_H_
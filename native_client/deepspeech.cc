@@ -2,6 +2,7 @@
 #ifdef _MSC_VER
   #define _USE_MATH_DEFINES
 #endif
+#include <chrono>
 #include <cmath>
 #include <iostream>
 #include <memory>
@@ -12,6 +13,8 @@
 #include "deepspeech.h"
 #include "alphabet.h"
 #include "modelstate.h"
+#include "qos_controller.h"
+#include "scorer_registry.h"
 
 #include "workspace_status.h"
 
@@ -22,6 +25,7 @@
 #endif // USE_TFLITE
 
 #include "ctcdecode/ctc_beam_search_decoder.h"
+#include "ThreadPool.h"
 
 #ifdef __ANDROID__
 #include <android/log.h>
@@ -72,6 +76,17 @@ struct StreamingState {
 
   ModelState* model_;
   DecoderState decoder_state_;
+  // load control of model_ when the stream was created, can be null
+  std::shared_ptr<QosController> qos_;
+  // beam width and class cutoff at full quality
+  unsigned int beam_width_;
+  unsigned int cutoff_top_n_;
+  // latency budget of each call processing audio, zero for none, the time
+  // by which the current call has to return and the number of batches it
+  // still has to process, which share what is left of the budget
+  float deadline_seconds_;
+  std::chrono::steady_clock::time_point deadline_;
+  unsigned int batches_left_;
 
   StreamingState();
   ~StreamingState();
@@ -82,15 +97,21 @@ struct StreamingState {
   void finalizeStream();
   char* finishStream();
   Metadata* finishStreamWithMetadata(unsigned int num_results);
+  WordLattice* finishStreamWithLattice(unsigned int num_results);
 
   void processAudioWindow(const vector<float>& buf);
   void processMfccWindow(const vector<float>& buf);
   void pushMfccBuffer(const vector<float>& buf);
   void addZeroMfccWindow();
   void processBatch(const vector<float>& buf, unsigned int n_steps);
+
+  void startDeadline(unsigned int n_samples, bool finalize);
+  unsigned int countBatches(unsigned int n_samples, bool finalize) const;
 };
 
 StreamingState::StreamingState()
+  : deadline_seconds_(0.f)
+  , batches_left_(0)
 {
 }
 
@@ -110,6 +131,8 @@ void
 StreamingState::feedAudioContent(const short* buffer,
                                  unsigned int buffer_size)
 {
+  startDeadline(buffer_size, false);
+
   // Consume all the data that was passed in, processing full buffers if needed
   while (buffer_size > 0) {
     while (buffer_size > 0 && audio_buffer_.size() < model_->audio_win_len_) {
@@ -157,6 +180,13 @@ StreamingState::finishStreamWithMetadata(unsigned int num_results)
   return model_->decode_metadata(decoder_state_, num_results);
 }
 
+WordLattice*
+StreamingState::finishStreamWithLattice(unsigned int num_results)
+{
+  finalizeStream();
+  return model_->decode_lattice(decoder_state_, num_results);
+}
+
 void
 StreamingState::processAudioWindow(const vector<float>& buf)
 {
@@ -170,6 +200,8 @@ StreamingState::processAudioWindow(const vector<float>& buf)
 void
 StreamingState::finalizeStream()
 {
+  startDeadline(0, true);
+
   // Flush audio buffer
   processAudioWindow(audio_buffer_);
 
@@ -184,6 +216,44 @@ StreamingState::finalizeStream()
   }
 }
 
+void
+StreamingState::startDeadline(unsigned int n_samples, bool finalize)
+{
+  if (deadline_seconds_ > 0.f) {
+    deadline_ = std::chrono::steady_clock::now() +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                  std::chrono::duration<float>(deadline_seconds_));
+    batches_left_ = countBatches(n_samples, finalize);
+  }
+}
+
+unsigned int
+StreamingState::countBatches(unsigned int n_samples, bool finalize) const
+{
+  // Each full audio window gives a feature vector, and finalizing the
+  // stream adds the flushed window and the zero ones
+  unsigned int n_windows = 0;
+  const size_t n_audio = audio_buffer_.size() + n_samples;
+  if (n_audio >= model_->audio_win_len_) {
+    n_windows = (n_audio - model_->audio_win_len_) / model_->audio_win_step_ + 1;
+  }
+  if (finalize) {
+    n_windows += 1 + model_->n_context_;
+  }
+
+  // Each full context window of feature vectors gives a timestep
+  const size_t context_len = model_->mfcc_feats_per_timestep_ / model_->n_features_;
+  const size_t n_vectors = mfcc_buffer_.size() / model_->n_features_ + n_windows;
+  const size_t n_timesteps = batch_buffer_.size() / model_->mfcc_feats_per_timestep_ +
+                             (n_vectors >= context_len ? n_vectors - context_len + 1 : 0);
+
+  // and the last batch is processed even if it isn't full
+  if (finalize) {
+    return (n_timesteps + model_->n_steps_ - 1) / model_->n_steps_;
+  }
+  return n_timesteps / model_->n_steps_;
+}
+
 void
 StreamingState::addZeroMfccWindow()
 {
@@ -242,6 +312,14 @@ StreamingState::processMfccWindow(const vector<float>& buf)
 void
 StreamingState::processBatch(const vector<float>& buf, unsigned int n_steps)
 {
+  std::chrono::steady_clock::time_point start;
+  if (qos_) {
+    decoder_state_.set_beam_size(qos_->beam_width(beam_width_));
+    decoder_state_.set_cutoff_top_n(qos_->cutoff_top_n(cutoff_top_n_));
+    qos_->begin_batch();
+    start = std::chrono::steady_clock::now();
+  }
+
   vector<float> logits;
   model_->infer(buf,
                 n_steps,
@@ -257,9 +335,26 @@ StreamingState::processBatch(const vector<float>& buf, unsigned int n_steps)
   // Convert logits to double
   vector<double> inputs(logits.begin(), logits.end());
 
+  // the decoder gets its share of what the acoustic model left of the
+  // budget, so that the batches after it have theirs, and at least enough
+  // to decode with the narrowest beam
+  double time_budget = 0.0;
+  if (deadline_seconds_ > 0.f) {
+    const unsigned int n_batches = std::max(1u, batches_left_);
+    time_budget = std::max(1e-6, std::chrono::duration<double>(
+      deadline_ - std::chrono::steady_clock::now()).count() / n_batches);
+    batches_left_ = n_batches - 1;
+  }
+
   decoder_state_.next(inputs.data(),
                       n_frames,
-                      num_classes);
+                      num_classes,
+                      time_budget);
+
+  if (qos_) {
+    qos_->end_batch(std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count());
+  }
 }
 
 int
@@ -317,6 +412,60 @@ DS_SetModelBeamWidth(ModelState* aCtx, unsigned int aBeamWidth)
   return 0;
 }
 
+int
+DS_SetModelBeamThreshold(ModelState* aCtx,
+                         float aThreshold,
+                         unsigned int aMaxActive)
+{
+  aCtx->beam_threshold_ = aThreshold;
+  aCtx->max_active_ = aMaxActive;
+  return 0;
+}
+
+int
+DS_SetModelFastLogAdd(ModelState* aCtx,
+                      int aEnable)
+{
+  aCtx->fast_log_add_ = aEnable != 0;
+  return 0;
+}
+
+int
+DS_SetModelDecoderThreads(ModelState* aCtx,
+                          unsigned int aNumThreads)
+{
+  // the stream's own thread is one of them
+  aCtx->decoder_threads_ = std::max(1u, aNumThreads);
+  aCtx->decoder_pool_.reset();
+  if (aCtx->decoder_threads_ > 1) {
+    aCtx->decoder_pool_ = std::make_shared<ThreadPool>(aCtx->decoder_threads_ - 1);
+  }
+  return DS_ERR_OK;
+}
+
+int
+DS_EnableDecoderQoS(ModelState* aCtx,
+                    unsigned int aMinBeamWidth,
+                    unsigned int aMinCutoffTopN,
+                    float aMaxLoad)
+{
+  if (!(aMaxLoad > 0.f && aMaxLoad <= 1.f)) {
+    return DS_ERR_INVALID_QOS_LOAD;
+  }
+  aCtx->qos_.reset(new QosController(aMinBeamWidth, aMinCutoffTopN, aMaxLoad, 0));
+  return DS_ERR_OK;
+}
+
+int
+DS_DisableDecoderQoS(ModelState* aCtx)
+{
+  if (aCtx->qos_) {
+    aCtx->qos_.reset();
+    return DS_ERR_OK;
+  }
+  return DS_ERR_QOS_NOT_ENABLED;
+}
+
 int
 DS_GetModelSampleRate(const ModelState* aCtx)
 {
@@ -329,19 +478,65 @@ DS_FreeModel(ModelState* ctx)
   delete ctx;
 }
 
+int
+DS_SetScorerLoadOptions(ModelState* aCtx,
+                        int aLoadMethod,
+                        int aPrefault,
+                        int aHugePages)
+{
+  switch (aLoadMethod) {
+    case DS_SCORER_LOAD_LAZY:
+      aCtx->scorer_load_method_ = util::LoadMethod::LAZY;
+      break;
+    case DS_SCORER_LOAD_POPULATE_OR_READ:
+      aCtx->scorer_load_method_ = util::LoadMethod::POPULATE_OR_READ;
+      break;
+    case DS_SCORER_LOAD_READ:
+      aCtx->scorer_load_method_ = util::LoadMethod::READ;
+      break;
+    case DS_SCORER_LOAD_PARALLEL_READ:
+      aCtx->scorer_load_method_ = util::LoadMethod::PARALLEL_READ;
+      break;
+    default:
+      return DS_ERR_INVALID_LOAD_METHOD;
+  }
+  aCtx->scorer_prefault_ = aPrefault != 0;
+  aCtx->scorer_huge_pages_ = aHugePages != 0;
+  return DS_ERR_OK;
+}
+
 int
 DS_EnableExternalScorer(ModelState* aCtx,
                         const char* aScorerPath)
 {
-  std::unique_ptr<Scorer> scorer(new Scorer());
-  int err = scorer->init(aScorerPath, aCtx->alphabet_);
+  std::shared_ptr<Scorer> scorer;
+  int err = ScorerRegistry::instance().acquire(aScorerPath,
+                                               aCtx->alphabet_,
+                                               aCtx->scorer_load_method_,
+                                               aCtx->scorer_prefault_,
+                                               aCtx->scorer_huge_pages_,
+                                               &scorer);
   if (err != 0) {
     return DS_ERR_INVALID_SCORER;
   }
-  aCtx->scorer_ = std::move(scorer);
+  aCtx->scorer_ = scorer;
+  aCtx->scorer_alpha_ = scorer->alpha;
+  aCtx->scorer_beta_ = scorer->beta;
   return DS_ERR_OK;
 }
 
+// Recompile the hot-words after a change, streams that are already running
+// keep using the trie they were created with.
+static void
+compile_hot_words(ModelState* aCtx)
+{
+  if (aCtx->hot_words_.empty()) {
+    aCtx->compiled_hot_words_.reset();
+  } else {
+    aCtx->compiled_hot_words_ = std::make_shared<HotWordTrie>(aCtx->hot_words_, aCtx->alphabet_);
+  }
+}
+
 int
 DS_AddHotWord(ModelState* aCtx,
               const char* word,
@@ -354,6 +549,7 @@ DS_AddHotWord(ModelState* aCtx,
     if (size_before == size_after) {
       return DS_ERR_FAIL_INSERT_HOTWORD;
     }
+    compile_hot_words(aCtx);
     return DS_ERR_OK;
   }
   return DS_ERR_SCORER_NOT_ENABLED;
@@ -370,6 +566,7 @@ DS_EraseHotWord(ModelState* aCtx,
     if (size_before == size_after) {
       return DS_ERR_FAIL_ERASE_HOTWORD;
     }
+    compile_hot_words(aCtx);
     return DS_ERR_OK;
   }
   return DS_ERR_SCORER_NOT_ENABLED;
@@ -384,6 +581,7 @@ DS_ClearHotWords(ModelState* aCtx)
     if (size_after != 0) {
       return DS_ERR_FAIL_CLEAR_HOTWORD;
     }
+    compile_hot_words(aCtx);
     return DS_ERR_OK;
   }
   return DS_ERR_SCORER_NOT_ENABLED;
@@ -404,12 +602,56 @@ int DS_SetScorerAlphaBeta(ModelState* aCtx,
                           float aBeta)
 {
   if (aCtx->scorer_) {
-    aCtx->scorer_->reset_params(aAlpha, aBeta);
+    aCtx->scorer_alpha_ = aAlpha;
+    aCtx->scorer_beta_ = aBeta;
     return DS_ERR_OK;
   }
   return DS_ERR_SCORER_NOT_ENABLED;
 }
 
+int
+DS_EnableRescoringScorer(ModelState* aCtx,
+                         const char* aScorerPath)
+{
+  std::shared_ptr<Scorer> scorer;
+  int err = ScorerRegistry::instance().acquire(aScorerPath,
+                                               aCtx->alphabet_,
+                                               aCtx->scorer_load_method_,
+                                               aCtx->scorer_prefault_,
+                                               aCtx->scorer_huge_pages_,
+                                               &scorer);
+  if (err != 0) {
+    return DS_ERR_INVALID_SCORER;
+  }
+  aCtx->rescorer_ = scorer;
+  aCtx->rescorer_alpha_ = scorer->alpha;
+  aCtx->rescorer_beta_ = scorer->beta;
+  return DS_ERR_OK;
+}
+
+int
+DS_DisableRescoringScorer(ModelState* aCtx)
+{
+  if (aCtx->rescorer_) {
+    aCtx->rescorer_.reset();
+    return DS_ERR_OK;
+  }
+  return DS_ERR_RESCORER_NOT_ENABLED;
+}
+
+int
+DS_SetRescoringScorerAlphaBeta(ModelState* aCtx,
+                               float aAlpha,
+                               float aBeta)
+{
+  if (aCtx->rescorer_) {
+    aCtx->rescorer_alpha_ = aAlpha;
+    aCtx->rescorer_beta_ = aBeta;
+    return DS_ERR_OK;
+  }
+  return DS_ERR_RESCORER_NOT_ENABLED;
+}
+
 int
 DS_CreateStream(ModelState* aCtx,
                 StreamingState** retval)
@@ -429,6 +671,7 @@ DS_CreateStream(ModelState* aCtx,
   ctx->previous_state_c_.resize(aCtx->state_size_, 0.f);
   ctx->previous_state_h_.resize(aCtx->state_size_, 0.f);
   ctx->model_ = aCtx;
+  ctx->qos_ = aCtx->qos_;
 
   const int cutoff_top_n = 40;
   const double cutoff_prob = 1.0;
@@ -438,12 +681,45 @@ DS_CreateStream(ModelState* aCtx,
                            cutoff_prob,
                            cutoff_top_n,
                            aCtx->scorer_,
-                           aCtx->hot_words_);
+                           aCtx->compiled_hot_words_);
+  ctx->decoder_state_.set_beam_threshold(aCtx->beam_threshold_,
+                                         aCtx->max_active_);
+  ctx->decoder_state_.set_fast_log_add(aCtx->fast_log_add_);
+  ctx->decoder_state_.set_expansion_pool(aCtx->decoder_pool_, aCtx->decoder_threads_);
+  ctx->decoder_state_.set_scorer_weights(aCtx->scorer_alpha_, aCtx->scorer_beta_);
+  ctx->decoder_state_.set_rescorer(aCtx->rescorer_);
+  ctx->decoder_state_.set_rescorer_weights(aCtx->rescorer_alpha_, aCtx->rescorer_beta_);
+  ctx->beam_width_ = aCtx->beam_width_;
+  ctx->cutoff_top_n_ = cutoff_top_n;
 
   *retval = ctx.release();
   return DS_ERR_OK;
 }
 
+int
+DS_SetStreamDeadline(StreamingState* aSctx,
+                     float aSeconds)
+{
+  aSctx->deadline_seconds_ = std::max(0.f, aSeconds);
+  return DS_ERR_OK;
+}
+
+unsigned int
+DS_GetStreamDeadlineHits(const StreamingState* aSctx)
+{
+  return aSctx->decoder_state_.deadline_hits();
+}
+
+int
+DS_SetStreamGreedyDecoding(StreamingState* aSctx,
+                           int aGreedy)
+{
+  if (aSctx->decoder_state_.set_greedy(aGreedy != 0) != 0) {
+    return DS_ERR_STREAM_ALREADY_STARTED;
+  }
+  return DS_ERR_OK;
+}
+
 void
 DS_FeedAudioContent(StreamingState* aSctx,
                     const short* aBuffer,
@@ -482,6 +758,15 @@ DS_FinishStreamWithMetadata(StreamingState* aSctx,
   return result;
 }
 
+WordLattice*
+DS_FinishStreamWithLattice(StreamingState* aSctx,
+                           unsigned int aNumResults)
+{
+  WordLattice* result = aSctx->finishStreamWithLattice(aNumResults);
+  DS_FreeStream(aSctx);
+  return result;
+}
+
 StreamingState*
 CreateStreamAndFeedAudioContent(ModelState* aCtx,
                                 const short* aBuffer,
@@ -538,6 +823,21 @@ DS_FreeMetadata(Metadata* m)
   }
 }
 
+void
+DS_FreeLattice(WordLattice* l)
+{
+  if (l) {
+    for (int i = 0; i < l->num_arcs; ++i) {
+      free((void*)l->arcs[i].text);
+    }
+
+    free((void*)l->arcs);
+    free((void*)l->finals);
+    free((void*)l->serialized);
+    free(l);
+  }
+}
+
 void
 DS_FreeString(char* str)
 {
@@ -57,8 +57,72 @@ typedef struct Metadata {
   const CandidateTranscript* const transcripts;
   /** Size of the transcripts array */
   const unsigned int num_transcripts;
+  /** Smallest beam width used to decode the stream. Lower than the model's
+   * beam width if it was reduced under load, see {@link DS_EnableDecoderQoS()}.
+   */
+  const unsigned int beam_width;
+  /** Smallest number of classes expanded per timestep to decode the stream */
+  const unsigned int cutoff_top_n;
 } Metadata;
 
+/**
+ * @brief A word of a WordLattice, leading from one of its nodes to another.
+ */
+typedef struct LatticeArc {
+  /** Node the word starts from */
+  const unsigned int from_node;
+  /** Node the word leads to */
+  const unsigned int to_node;
+  /** The text of the word */
+  const char* const text;
+  /** Position of the first token of the word in units of 20ms */
+  const unsigned int start_timestep;
+  /** Position of the token ending the word in units of 20ms */
+  const unsigned int end_timestep;
+  /** Position of the first token of the word in seconds */
+  const float start_time;
+  /** Log probability of the tokens of the word, including the space ending
+   * it, at the timestep each of them is emitted at.
+   */
+  const float acoustic_score;
+  /** Log probability of the word given by the external scorer, before
+   * weighting by alpha. Zero without external scorer.
+   */
+  const float lm_score;
+} LatticeArc;
+
+/**
+ * @brief A node of a WordLattice where a candidate transcript ends.
+ */
+typedef struct LatticeFinal {
+  /** The node */
+  const unsigned int node;
+  /** Confidence of the transcript, as in CandidateTranscript */
+  const double confidence;
+} LatticeFinal;
+
+/**
+ * @brief Candidate transcripts as a tree of words rooted at node 0, where
+ *        transcripts share their common leading words. Arcs are in
+ *        topological order.
+ */
+typedef struct WordLattice {
+  /** Array of LatticeArc objects */
+  const LatticeArc* const arcs;
+  /** Size of the arcs array */
+  const unsigned int num_arcs;
+  /** Number of nodes */
+  const unsigned int num_nodes;
+  /** Array of LatticeFinal objects, one per transcript, best first */
+  const LatticeFinal* const finals;
+  /** Size of the finals array */
+  const unsigned int num_finals;
+  /** The lattice in a compact binary form, see ctcdecode/lattice.h */
+  const char* const serialized;
+  /** Size of the serialized lattice in bytes */
+  const unsigned int serialized_size;
+} WordLattice;
+
 // sphinx-doc: error_code_listing_start
 
 #define DS_FOR_EACH_ERROR(APPLY) \
@@ -74,6 +138,8 @@ typedef struct Metadata {
   APPLY(DS_ERR_SCORER_NO_TRIE,          0x2007, "Reached end of scorer file before loading vocabulary trie.") \
   APPLY(DS_ERR_SCORER_INVALID_TRIE,     0x2008, "Invalid magic in trie header.") \
   APPLY(DS_ERR_SCORER_VERSION_MISMATCH, 0x2009, "Scorer file version does not match expected version.") \
+  APPLY(DS_ERR_RESCORER_NOT_ENABLED,    0x200A, "Rescoring scorer is not enabled.") \
+  APPLY(DS_ERR_INVALID_LOAD_METHOD,     0x200B, "Invalid scorer load method.") \
   APPLY(DS_ERR_FAIL_INIT_MMAP,          0x3000, "Failed to initialize memory mapped model.") \
   APPLY(DS_ERR_FAIL_INIT_SESS,          0x3001, "Failed to initialize the session.") \
   APPLY(DS_ERR_FAIL_INTERPRETER,        0x3002, "Interpreter failed.") \
@@ -84,7 +150,10 @@ typedef struct Metadata {
   APPLY(DS_ERR_FAIL_CREATE_MODEL,       0x3007, "Could not allocate model state.") \
   APPLY(DS_ERR_FAIL_INSERT_HOTWORD,     0x3008, "Could not insert hot-word.") \
   APPLY(DS_ERR_FAIL_CLEAR_HOTWORD,      0x3009, "Could not clear hot-words.") \
-  APPLY(DS_ERR_FAIL_ERASE_HOTWORD,      0x3010, "Could not erase hot-word.")
+  APPLY(DS_ERR_FAIL_ERASE_HOTWORD,      0x3010, "Could not erase hot-word.") \
+  APPLY(DS_ERR_STREAM_ALREADY_STARTED,  0x3011, "Stream has already decoded audio.") \
+  APPLY(DS_ERR_INVALID_QOS_LOAD,        0x3012, "Invalid QoS maximum load, must be in (0, 1].") \
+  APPLY(DS_ERR_QOS_NOT_ENABLED,         0x3013, "Decoder QoS is not enabled.")
 
 // sphinx-doc: error_code_listing_end
 
@@ -95,6 +164,21 @@ DS_FOR_EACH_ERROR(DEFINE)
 #undef DEFINE
 };
 
+/**
+ * @brief How scorer files are brought into memory, see DS_SetScorerLoadOptions().
+ */
+enum DeepSpeech_Scorer_Load_Method
+{
+  /** Memory map the file, pages are read when decoding first touches them. */
+  DS_SCORER_LOAD_LAZY = 0,
+  /** Memory map the file and read all of it while loading on Linux, same as DS_SCORER_LOAD_READ elsewhere. */
+  DS_SCORER_LOAD_POPULATE_OR_READ = 1,
+  /** Allocate memory and read the file into it. */
+  DS_SCORER_LOAD_READ = 2,
+  /** Same as DS_SCORER_LOAD_READ, reading with several threads. */
+  DS_SCORER_LOAD_PARALLEL_READ = 3,
+};
+
 /**
  * @brief An object providing an interface to a trained DeepSpeech model.
  *
@@ -132,6 +216,93 @@ DEEPSPEECH_EXPORT
 int DS_SetModelBeamWidth(ModelState* aCtx,
                          unsigned int aBeamWidth);
 
+/**
+ * @brief Prune the beam of new streams by score in addition to its width.
+ *        After each frame, candidates scoring more than aThreshold below the
+ *        best one are dropped, so that clear audio is decoded with a narrower
+ *        beam and ambiguous audio with up to aMaxActive candidates.
+ *
+ * @param aCtx A ModelState pointer created with {@link DS_CreateModel}.
+ * @param aThreshold Maximum score difference (natural log) to the best
+ *                   candidate. Zero or negative disables threshold pruning,
+ *                   which is the default.
+ * @param aMaxActive Maximum number of candidates kept when threshold pruning
+ *                   is enabled, at most the beam width. Zero to use the
+ *                   beam width.
+ *
+ * @return Zero on success, non-zero on failure.
+ */
+DEEPSPEECH_EXPORT
+int DS_SetModelBeamThreshold(ModelState* aCtx,
+                             float aThreshold,
+                             unsigned int aMaxActive);
+
+/**
+ * @brief Merge the probabilities of the candidates of new streams with a
+ *        table-based approximation of log(exp(x) + exp(y)) instead of the
+ *        exact formula. It is faster, and its absolute error is below 1e-5
+ *        per merge. Disabled by default.
+ *
+ * @param aCtx A ModelState pointer created with {@link DS_CreateModel}.
+ * @param aEnable Non-zero to use the approximation, zero for the exact formula.
+ *
+ * @return Zero on success, non-zero on failure.
+ */
+DEEPSPEECH_EXPORT
+int DS_SetModelFastLogAdd(ModelState* aCtx,
+                          int aEnable);
+
+/**
+ * @brief Spread the language model lookups of each timestep of new streams
+ *        over a pool of threads shared by the streams of the model. This
+ *        lowers the latency of single streams decoded with wide beams, the
+ *        transcriptions are the same as without the pool. Disabled by default.
+ *
+ * @param aCtx A ModelState pointer created with {@link DS_CreateModel}.
+ * @param aNumThreads Number of threads a timestep is decoded on, including
+ *                    the one of the stream. Zero or one disables the pool.
+ *
+ * @return Zero on success, non-zero on failure.
+ */
+DEEPSPEECH_EXPORT
+int DS_SetModelDecoderThreads(ModelState* aCtx,
+                              unsigned int aNumThreads);
+
+/**
+ * @brief Lower the decoding accuracy of streams under load instead of letting
+ *        their processing fall behind. While the time streams spend
+ *        processing audio exceeds aMaxLoad of the machine's capacity, or more
+ *        of them are processing at once than there are hardware threads,
+ *        their beam width and the number of classes expanded per timestep
+ *        are lowered towards the given minimums. They are restored once the
+ *        load drops. Applies to streams created after this call, and the
+ *        values used are reported in {@link Metadata}.
+ *
+ * @param aCtx A ModelState pointer created with {@link DS_CreateModel}.
+ * @param aMinBeamWidth Smallest beam width streams can be lowered to.
+ * @param aMinCutoffTopN Smallest number of classes expanded per timestep.
+ * @param aMaxLoad Share of the processing capacity streams can use before
+ *                 they are degraded, in (0, 1].
+ *
+ * @return Zero on success, non-zero on failure (invalid arguments).
+ */
+DEEPSPEECH_EXPORT
+int DS_EnableDecoderQoS(ModelState* aCtx,
+                        unsigned int aMinBeamWidth,
+                        unsigned int aMinCutoffTopN,
+                        float aMaxLoad);
+
+/**
+ * @brief Stop degrading new streams under load. Streams already created keep
+ *        adapting until they are finished.
+ *
+ * @param aCtx A ModelState pointer created with {@link DS_CreateModel}.
+ *
+ * @return Zero on success, non-zero on failure.
+ */
+DEEPSPEECH_EXPORT
+int DS_DisableDecoderQoS(ModelState* aCtx);
+
 /**
  * @brief Return the sample rate expected by a model.
  *
@@ -148,9 +319,40 @@ int DS_GetModelSampleRate(const ModelState* aCtx);
 DEEPSPEECH_EXPORT
 void DS_FreeModel(ModelState* ctx);
 
+/**
+ * @brief Set how scorer files are loaded by the next calls to
+ *        {@link DS_EnableExternalScorer()} and {@link DS_EnableRescoringScorer()}.
+ *
+ * By default scorers are memory mapped, which loads quickly but makes the
+ * first decodes wait for their pages to be read from disk.
+ *
+ * @param aCtx The ModelState pointer for the model being changed.
+ * @param aLoadMethod One of the DS_SCORER_LOAD_* values.
+ * @param aPrefault With DS_SCORER_LOAD_LAZY, touch every page of the
+ *                  memory mapped scorer in a background thread after
+ *                  loading it, so that its pages are mapped by the time
+ *                  decoding needs them.
+ * @param aHugePages Back the language model and dictionary tables with
+ *                   transparent huge pages where the system supports them.
+ *                   Huge pages can't back memory mapped files, so the file
+ *                   is then read as with DS_SCORER_LOAD_READ unless
+ *                   DS_SCORER_LOAD_PARALLEL_READ is set.
+ *
+ * @return Zero on success, DS_ERR_INVALID_LOAD_METHOD if @p aLoadMethod is
+ *         not a DS_SCORER_LOAD_* value.
+ */
+DEEPSPEECH_EXPORT
+int DS_SetScorerLoadOptions(ModelState* aCtx,
+                            int aLoadMethod,
+                            int aPrefault,
+                            int aHugePages);
+
 /**
  * @brief Enable decoding using an external scorer.
  *
+ * Models of the process enabling the same scorer file with the same load
+ * options share a single copy of it, loaded by the first of them.
+ *
  * @param aCtx The ModelState pointer for the model being changed.
  * @param aScorerPath The path to the external scorer file.
  *
@@ -164,6 +366,8 @@ int DS_EnableExternalScorer(ModelState* aCtx,
  * @brief Add a hot-word and its boost.
  *
  * Words that don't occur in the scorer (e.g. proper nouns) or strings that contain spaces won't be taken into account.
+ * The boost is credited progressively while the word is being spelled, so partially decoded hot-words are less likely to be pruned.
+ * The boost is applied once per occurrence of the hot-word in a transcription. Up to version 0.9 it was applied once per scored n-gram containing the word, up to the order of the scorer times per occurrence, so boosts tuned for those versions may need to be raised.
  *
  * @param aCtx The ModelState pointer for the model being changed.
  * @param word The hot-word.
@@ -211,6 +415,9 @@ int DS_DisableExternalScorer(ModelState* aCtx);
 /**
  * @brief Set hyperparameters alpha and beta of the external scorer.
  *
+ * Only applies to this model, even if its scorer is shared with others, and
+ * to streams created after this call.
+ *
  * @param aCtx The ModelState pointer for the model being changed.
  * @param aAlpha The alpha hyperparameter of the decoder. Language model weight.
  * @param aLMBeta The beta hyperparameter of the decoder. Word insertion weight.
@@ -222,6 +429,51 @@ int DS_SetScorerAlphaBeta(ModelState* aCtx,
                           float aAlpha,
                           float aBeta);
 
+/**
+ * @brief Enable rescoring of the final transcripts with a second scorer.
+ *
+ * The external scorer is used during the search, while the rescoring scorer
+ * only re-ranks the transcripts of the beam when results are returned. This
+ * allows searching with a small, pruned language model that stays in cache
+ * and still ranking the results with a large one. Both scorers should be
+ * built from the same vocabulary, see ``data/lm/generate_lm.py``. Applies to
+ * streams created after this call.
+ *
+ * @param aCtx The ModelState pointer for the model being changed.
+ * @param aScorerPath The path to the rescoring scorer file.
+ *
+ * @return Zero on success, non-zero on failure (invalid arguments).
+ */
+DEEPSPEECH_EXPORT
+int DS_EnableRescoringScorer(ModelState* aCtx,
+                             const char* aScorerPath);
+
+/**
+ * @brief Disable rescoring of the final transcripts.
+ *
+ * @param aCtx The ModelState pointer for the model being changed.
+ *
+ * @return Zero on success, non-zero on failure.
+ */
+DEEPSPEECH_EXPORT
+int DS_DisableRescoringScorer(ModelState* aCtx);
+
+/**
+ * @brief Set hyperparameters alpha and beta of the rescoring scorer.
+ *
+ * Only applies to this model and to streams created after this call.
+ *
+ * @param aCtx The ModelState pointer for the model being changed.
+ * @param aAlpha Language model weight of the rescoring scorer.
+ * @param aBeta Word insertion weight of the rescoring scorer.
+ *
+ * @return Zero on success, non-zero on failure.
+ */
+DEEPSPEECH_EXPORT
+int DS_SetRescoringScorerAlphaBeta(ModelState* aCtx,
+                                   float aAlpha,
+                                   float aBeta);
+
 /**
  * @brief Use the DeepSpeech model to convert speech to text.
  *
@@ -274,6 +526,52 @@ DEEPSPEECH_EXPORT
 int DS_CreateStream(ModelState* aCtx,
                     StreamingState** retval);
 
+/**
+ * @brief Give each call processing audio of a stream a latency budget. When
+ *        decoding the audio of a call falls behind, the beam is narrowed for
+ *        the rest of that call so that it returns on time, at the cost of
+ *        accuracy. Each batch of timesteps a call processes gets an equal
+ *        share of what is left of the budget, so that the first ones can't
+ *        spend the time of the last. Applies to {@link DS_FeedAudioContent()}
+ *        and to the calls finishing the stream.
+ *
+ * @param aSctx A streaming state pointer returned by {@link DS_CreateStream()}.
+ * @param aSeconds Time each call may take, zero for no limit (the default).
+ *
+ * @return Zero on success, non-zero on failure.
+ */
+DEEPSPEECH_EXPORT
+int DS_SetStreamDeadline(StreamingState* aSctx,
+                         float aSeconds);
+
+/**
+ * @brief Number of times decoding had to narrow the beam to meet the deadline
+ *        set with {@link DS_SetStreamDeadline()}, since the stream was created.
+ *
+ * @param aSctx A streaming state pointer returned by {@link DS_CreateStream()}.
+ *
+ * @return Number of batches of audio decoded with a narrowed beam.
+ */
+DEEPSPEECH_EXPORT
+unsigned int DS_GetStreamDeadlineHits(const StreamingState* aSctx);
+
+/**
+ * @brief Decode a stream with the best path (greedy) decoder instead of the
+ *        beam search. The most probable character of each timestep is
+ *        taken, which is much faster but ignores the external scorer,
+ *        hot-words and beam width. Results still carry token timings, and a
+ *        single candidate transcript is returned.
+ *
+ * @param aSctx A streaming state pointer returned by {@link DS_CreateStream()}.
+ * @param aGreedy Non-zero to use the greedy decoder, zero for beam search.
+ *
+ * @return Zero on success, DS_ERR_STREAM_ALREADY_STARTED if audio has already
+ *         been decoded by this stream.
+ */
+DEEPSPEECH_EXPORT
+int DS_SetStreamGreedyDecoding(StreamingState* aSctx,
+                               int aGreedy);
+
 /**
  * @brief Feed audio samples to an ongoing streaming inference.
  *
@@ -347,6 +645,25 @@ DEEPSPEECH_EXPORT
 Metadata* DS_FinishStreamWithMetadata(StreamingState* aSctx,
                                       unsigned int aNumResults);
 
+/**
+ * @brief Compute the final decoding of an ongoing streaming inference and return
+ *        the candidate transcripts as a word lattice, for rescoring. Signals
+ *        the end of an ongoing streaming inference.
+ *
+ * @param aSctx A streaming state pointer returned by {@link DS_CreateStream()}.
+ * @param aNumResults The number of candidate transcripts to include.
+ *
+ * @return WordLattice struct whose size grows with the number of distinct
+ *         words of the transcripts rather than with their total length. The
+ *         user is responsible for freeing it by calling {@link DS_FreeLattice()}.
+ *         Returns NULL on error.
+ *
+ * @note This method will free the state pointer (@p aSctx).
+ */
+DEEPSPEECH_EXPORT
+WordLattice* DS_FinishStreamWithLattice(StreamingState* aSctx,
+                                        unsigned int aNumResults);
+
 /**
  * @brief Destroy a streaming state without decoding the computed logits. This
  *        can be used if you no longer need the result of an ongoing streaming
@@ -365,6 +682,12 @@ void DS_FreeStream(StreamingState* aSctx);
 DEEPSPEECH_EXPORT
 void DS_FreeMetadata(Metadata* m);
 
+/**
+ * @brief Free memory allocated for a word lattice.
+ */
+DEEPSPEECH_EXPORT
+void DS_FreeLattice(WordLattice* l);
+
 /**
  * @brief Free a char* string returned by the DeepSpeech API.
  */
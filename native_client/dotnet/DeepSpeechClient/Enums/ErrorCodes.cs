@@ -17,6 +17,8 @@
         DS_ERR_INVALID_SCORER = 0x2002,
         DS_ERR_MODEL_INCOMPATIBLE = 0x2003,
         DS_ERR_SCORER_NOT_ENABLED = 0x2004,
+        DS_ERR_RESCORER_NOT_ENABLED = 0x200A,
+        DS_ERR_INVALID_LOAD_METHOD = 0x200B,
 
         // Runtime failures
         DS_ERR_FAIL_INIT_MMAP = 0x3000,
@@ -28,6 +30,9 @@
         DS_ERR_FAIL_CREATE_SESS = 0x3006,
         DS_ERR_FAIL_INSERT_HOTWORD = 0x3008,
         DS_ERR_FAIL_CLEAR_HOTWORD = 0x3009,
-        DS_ERR_FAIL_ERASE_HOTWORD = 0x3010
+        DS_ERR_FAIL_ERASE_HOTWORD = 0x3010,
+        DS_ERR_STREAM_ALREADY_STARTED = 0x3011,
+        DS_ERR_INVALID_QOS_LOAD = 0x3012,
+        DS_ERR_QOS_NOT_ENABLED = 0x3013
     }
 }
@@ -14,5 +14,13 @@ namespace DeepSpeechClient.Structs
         /// Count of transcripts from the native side.
         /// </summary>
         internal unsafe int num_transcripts;
+        /// <summary>
+        /// Smallest beam width used to decode the stream.
+        /// </summary>
+        internal unsafe uint beam_width;
+        /// <summary>
+        /// Smallest number of classes expanded per timestep.
+        /// </summary>
+        internal unsafe uint cutoff_top_n;
     }
 }
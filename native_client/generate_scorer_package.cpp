@@ -3,6 +3,8 @@
 #include <fstream>
 #include <unordered_set>
 #include <iostream>
+#include <algorithm>
+#include <thread>
 using namespace std;
 
 #include "absl/types/optional.h"
@@ -22,7 +24,10 @@ create_package(absl::optional<string> alphabet_path,
                string package_path,
                absl::optional<bool> force_bytes_output_mode,
                float default_alpha,
-               float default_beta)
+               float default_beta,
+               bool dense_dictionary,
+               bool lookahead,
+               size_t num_threads)
 {
     // Read vocabulary
     unordered_set<string> words;
@@ -72,7 +77,20 @@ create_package(absl::optional<string> alphabet_path,
              << "\n";
         return 1;
     }
-    scorer.fill_dictionary(words);
+    scorer.fill_dictionary(words, num_threads);
+    if (dense_dictionary) {
+        scorer.build_dense_dictionary();
+        cerr << "Dense dictionary of " << scorer.dense_dictionary->NumStates()
+             << " states and " << scorer.dense_dictionary->NumLabels()
+             << " labels built.\n";
+    }
+    if (lookahead) {
+        if (!scorer.build_lookahead()) {
+            cerr << "LM look-ahead is only supported for word based models, can't continue.\n";
+            return 1;
+        }
+        cerr << "LM look-ahead computed.\n";
+    }
 
     // Copy LM file to final package file destination
     {
@@ -104,6 +122,9 @@ main(int argc, char** argv)
         ("default_alpha", po::value<float>(), "Default value of alpha hyperparameter (float).")
         ("default_beta", po::value<float>(), "Default value of beta hyperparameter (float).")
         ("force_bytes_output_mode", po::value<bool>(), "Boolean flag, force set or unset bytes output mode in the scorer package. If not set, infers from the vocabulary. See <https://deepspeech.readthedocs.io/en/master/Decoder.html#bytes-output-mode> for further explanation.")
+        ("dense_dictionary", po::value<bool>()->default_value(false), "Boolean flag, also store the vocabulary as a dense transition table, which makes dictionary lookups faster during decoding at the cost of a larger package. Worthwhile for small alphabets.")
+        ("lookahead", po::value<bool>()->default_value(false), "Boolean flag, store the best unigram score reachable from each vocabulary trie state, so that partial words are scored by the LM during decoding. Allows a smaller beam width for the same accuracy. Not supported in bytes output mode.")
+        ("num_threads", po::value<size_t>()->default_value(std::max(1u, thread::hardware_concurrency())), "Number of threads converting and sorting the vocabulary before building its trie.")
     ;
 
     po::variables_map vm;
@@ -141,7 +162,10 @@ main(int argc, char** argv)
                    vm["package"].as<string>(),
                    force_bytes_output_mode,
                    vm["default_alpha"].as<float>(),
-                   vm["default_beta"].as<float>());
+                   vm["default_beta"].as<float>(),
+                   vm["dense_dictionary"].as<bool>(),
+                   vm["lookahead"].as<bool>(),
+                   vm["num_threads"].as<size_t>());
 
     return 0;
 }
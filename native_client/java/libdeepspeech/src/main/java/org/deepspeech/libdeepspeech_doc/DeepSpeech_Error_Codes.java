@@ -21,6 +21,8 @@ public enum DeepSpeech_Error_Codes {
   ERR_SCORER_NO_TRIE(0x2007),
   ERR_SCORER_INVALID_TRIE(0x2008),
   ERR_SCORER_VERSION_MISMATCH(0x2009),
+  ERR_RESCORER_NOT_ENABLED(0x200A),
+  ERR_INVALID_LOAD_METHOD(0x200B),
   ERR_FAIL_INIT_MMAP(0x3000),
   ERR_FAIL_INIT_SESS(0x3001),
   ERR_FAIL_INTERPRETER(0x3002),
@@ -31,7 +33,10 @@ public enum DeepSpeech_Error_Codes {
   ERR_FAIL_CREATE_MODEL(0x3007),
   ERR_FAIL_INSERT_HOTWORD(0x3008),
   ERR_FAIL_CLEAR_HOTWORD(0x3009),
-  ERR_FAIL_ERASE_HOTWORD(0x3010);
+  ERR_FAIL_ERASE_HOTWORD(0x3010),
+  ERR_STREAM_ALREADY_STARTED(0x3011),
+  ERR_INVALID_QOS_LOAD(0x3012),
+  ERR_QOS_NOT_ENABLED(0x3013);
 
   public final int swigValue() {
     return swigValue;
@@ -61,6 +61,10 @@ class BinaryFormat {
       return vocab_string_offset_;
     }
 
+    // Memory holding the file, mapped or read depending on the load method.
+    // Empty if the data is only in memory.
+    const util::scoped_memory &Mapping() const { return mapping_; }
+
     // Writing a binary file or initializing in RAM from ARPA:
     // Size for vocabulary.
     void *SetupJustVocab(std::size_t memory_size, uint8_t order);
@@ -22,7 +22,7 @@ namespace ngram {
 namespace {
 
 void Usage(const char *name, const char *default_mem) {
-  std::cerr << "Usage: " << name << " [-u log10_unknown_probability] [-s] [-i] [-v] [-w mmap|after] [-p probing_multiplier] [-T trie_temporary] [-S trie_building_mem] [-q bits] [-b bits] [-a bits] [type] input.arpa [output.mmap]\n\n"
+  std::cerr << "Usage: " << name << " [-u log10_unknown_probability] [-s] [-i] [-v] [-w mmap|after] [-j threads] [-p probing_multiplier] [-T trie_temporary] [-S trie_building_mem] [-q bits] [-b bits] [-a bits] [type] input.arpa [output.mmap]\n\n"
 "-u sets the log10 probability for <unk> if the ARPA file does not have one.\n"
 "   Default is -100.  The ARPA file will always take precedence.\n"
 "-s allows models to be built even if they do not have <s> and </s>.\n"
@@ -34,7 +34,10 @@ void Usage(const char *name, const char *default_mem) {
 "-r \"order1.arpa order2 order3 order4\" adds lower-order rest costs from these\n"
 "   model files.  order1.arpa must be an ARPA file.  All others may be ARPA or\n"
 "   the same data structure as being built.  All files must have the same\n"
-"   vocabulary.  For probing, the unigrams must be in the same order.\n\n"
+"   vocabulary.  For probing, the unigrams must be in the same order.\n"
+"-j sets the number of threads parsing n-grams and sorting them for trie.\n"
+"   Default is 1.  Neither the output nor the rejection of invalid ARPA files,\n"
+"   such as with duplicate n-grams, depends on it.\n\n"
 "type is either probing or trie.  Default is probing.\n\n"
 "probing uses a probing hash table.  It is the fastest but uses the most memory.\n"
 "-p sets the space multiplier and must be >1.0.  The default is 1.5.\n\n"
@@ -112,7 +115,7 @@ int main(int argc, char *argv[]) {
     lm::ngram::Config config;
     config.building_memory = util::ParseSize(default_mem);
     int opt;
-    while ((opt = getopt(argc, argv, "q:b:a:u:p:t:T:m:S:w:sir:vh")) != -1) {
+    while ((opt = getopt(argc, argv, "q:b:a:u:p:t:T:m:S:w:j:sir:vh")) != -1) {
       switch(opt) {
         case 'q':
           config.prob_bits = ParseBitCount(optarg);
@@ -154,6 +157,9 @@ int main(int argc, char *argv[]) {
             Usage(argv[0], default_mem);
           }
           break;
+        case 'j':
+          config.building_threads = std::max(1UL, ParseUInt(optarg));
+          break;
         case 's':
           config.sentence_marker_missing = lm::SILENT;
           break;
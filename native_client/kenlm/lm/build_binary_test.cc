@@ -0,0 +1,150 @@
+#include "lm/model.hh"
+#include "lm/lm_exception.hh"
+#include "util/file.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#define BOOST_TEST_MODULE BuildBinaryTest
+#include <boost/test/unit_test.hpp>
+
+// Building with several threads must write the same bytes as building with
+// one, and reject the same ARPA files.
+
+namespace lm {
+namespace ngram {
+namespace {
+
+const char *TestLocation() {
+  if (boost::unit_test::framework::master_test_suite().argc < 2) {
+    return "test.arpa";
+  }
+  return boost::unit_test::framework::master_test_suite().argv[1];
+}
+
+typedef std::vector<std::string> NGram;
+
+// Random 4-gram model with every n-gram of random sentences, enough for
+// several chunks of the parallel reader.  If duplicate is set, the first
+// trigram is repeated next to itself and at the end of its section.
+std::string WriteRandomARPA(const char *name, bool duplicate = false) {
+  std::mt19937 rng(42);
+  std::vector<std::set<NGram> > ngrams(4);
+  ngrams[0].insert(NGram(1, "<s>"));
+  ngrams[0].insert(NGram(1, "</s>"));
+  ngrams[0].insert(NGram(1, "<unk>"));
+  while (ngrams[3].size() < 40000) {
+    NGram sentence(1, "<s>");
+    for (unsigned length = 3 + rng() % 12; length; --length) {
+      // Skewed towards the first words so that n-grams repeat.
+      sentence.push_back("w" + std::to_string(rng() % (1 + rng() % 3000)));
+    }
+    sentence.push_back("</s>");
+    for (std::size_t n = 1; n <= 4; ++n) {
+      for (std::size_t i = 0; i + n <= sentence.size(); ++i) {
+        ngrams[n - 1].insert(NGram(sentence.begin() + i, sentence.begin() + i + n));
+      }
+    }
+  }
+
+  std::vector<std::vector<NGram> > sections(4);
+  for (std::size_t n = 0; n < 4; ++n) {
+    sections[n].assign(ngrams[n].begin(), ngrams[n].end());
+    std::shuffle(sections[n].begin(), sections[n].end(), rng);
+  }
+  if (duplicate) {
+    NGram repeated(sections[2].front());
+    sections[2].insert(sections[2].begin() + 1, repeated);
+    sections[2].push_back(repeated);
+  }
+
+  std::uniform_real_distribution<float> prob(-5.0, -0.1), backoff(-1.0, 0.0);
+  std::ofstream out(name);
+  out << "\\data\\\n";
+  for (std::size_t n = 0; n < 4; ++n) {
+    out << "ngram " << (n + 1) << '=' << sections[n].size() << '\n';
+  }
+  for (std::size_t n = 0; n < 4; ++n) {
+    out << "\n\\" << (n + 1) << "-grams:\n";
+    for (std::vector<NGram>::const_iterator i = sections[n].begin(); i != sections[n].end(); ++i) {
+      out << (*i == NGram(1, "<s>") ? -99.0 : prob(rng)) << '\t' << (*i)[0];
+      for (std::size_t w = 1; w < i->size(); ++w) {
+        out << ' ' << (*i)[w];
+      }
+      if (n < 3 && i->back() != "</s>") {
+        out << '\t' << backoff(rng);
+      }
+      out << '\n';
+    }
+  }
+  out << "\n\\end\\\n";
+  return name;
+}
+
+// Contents of the binary file built from arpa.
+template <class Model> std::string Build(const std::string &arpa, std::size_t threads, std::size_t building_memory) {
+  Config config;
+  config.write_mmap = "build_binary_test.binary";
+  config.messages = NULL;
+  config.building_threads = threads;
+  config.building_memory = building_memory;
+  {
+    Model model(arpa.c_str(), config);
+  }
+  util::scoped_fd file(util::OpenReadOrThrow("build_binary_test.binary"));
+  std::string contents(util::SizeOrThrow(file.get()), '\0');
+  util::ReadOrThrow(file.get(), &contents[0], contents.size());
+  unlink("build_binary_test.binary");
+  return contents;
+}
+
+template <class Model> void SameBytes(const std::string &arpa, std::size_t building_memory) {
+  const std::string single = Build<Model>(arpa, 1, building_memory);
+  BOOST_REQUIRE(!single.empty());
+  const std::size_t threads[] = {2, 3, 8};
+  for (std::size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+    BOOST_CHECK_MESSAGE(Build<Model>(arpa, threads[i], building_memory) == single,
+                        arpa << " built with " << threads[i] << " threads differs");
+  }
+}
+
+template <class Model> void SameBytes() {
+  SameBytes<Model>(TestLocation(), 1 << 20);
+  const std::string arpa = WriteRandomARPA("build_binary_test.arpa");
+  SameBytes<Model>(arpa, 1 << 26);
+  // A sort buffer too small for a section, so that it is flushed to several
+  // files which are merged.
+  SameBytes<Model>(arpa, 1 << 20);
+  unlink(arpa.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(probing) {
+  SameBytes<ProbingModel>();
+}
+BOOST_AUTO_TEST_CASE(trie) {
+  SameBytes<TrieModel>();
+}
+BOOST_AUTO_TEST_CASE(quant_array_trie) {
+  SameBytes<QuantArrayTrieModel>();
+}
+
+BOOST_AUTO_TEST_CASE(duplicate) {
+  const std::string arpa = WriteRandomARPA("build_binary_test_dup.arpa", true);
+  const std::size_t threads[] = {1, 2, 3, 8};
+  for (std::size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+    BOOST_CHECK_THROW(Build<TrieModel>(arpa, threads[i], 1 << 26), FormatLoadException);
+    BOOST_CHECK_THROW(Build<TrieModel>(arpa, threads[i], 1 << 20), FormatLoadException);
+  }
+  unlink("build_binary_test.binary");
+  unlink(arpa.c_str());
+}
+
+} // namespace
+} // namespace ngram
+} // namespace lm
@@ -65,6 +65,11 @@ struct Config {
   // models.
   std::size_t building_memory;
 
+  // Number of threads parsing n-grams while building.  Trie models also sort
+  // with them.  Only effective when compiled with WITH_THREADS.  The binary
+  // is the same for any number of threads.
+  std::size_t building_threads;
+
   // Template for temporary directory appropriate for passing to mkdtemp.
   // The characters XXXXXX are appended before passing to mkdtemp.  Only
   // applies to trie.  If empty, defaults to write_mmap.  If that's NULL,
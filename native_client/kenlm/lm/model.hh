@@ -65,6 +65,14 @@ template <class Search, class VocabularyT> class GenericModel : public base::Mod
      */
     FullScoreReturn FullScoreForgotState(const WordIndex *context_rbegin, const WordIndex *context_rend, const WordIndex new_word, State &out_state) const;
 
+    /* Prefetch the memory FullScoreForgotState reads for the same arguments.
+     * Issue it for several independent queries before scoring them, so that
+     * their cache misses overlap.  Only the probing models prefetch.
+     */
+    void PrefetchForgotState(const WordIndex *context_rbegin, const WordIndex *context_rend, const WordIndex new_word) const {
+      search_.Prefetch(new_word, context_rbegin, std::min(context_rend, context_rbegin + P::Order() - 1));
+    }
+
     /* Get the state for a context.  Don't use this if you can avoid it.  Use
      * BeginSentenceState or NullContextState and extend from those.  If
      * you're only going to use this state to call FullScore once, use
@@ -104,6 +112,10 @@ template <class Search, class VocabularyT> class GenericModel : public base::Mod
 
     uint64_t GetEndOfSearchOffset() const;
 
+    // Memory holding the binary file the model was loaded from or written
+    // to, empty if the model only lives in memory.
+    const util::scoped_memory &Mapping() const { return backing_.Mapping(); }
+
   private:
     FullScoreReturn ScoreExceptBackoff(const WordIndex *const context_rbegin, const WordIndex *const context_rend, const WordIndex new_word, State &out_state) const;
 
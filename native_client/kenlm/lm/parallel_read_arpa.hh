@@ -0,0 +1,245 @@
+#ifndef LM_PARALLEL_READ_ARPA_H
+#define LM_PARALLEL_READ_ARPA_H
+
+#include "lm/read_arpa.hh"
+#include "lm/word_index.hh"
+#include "util/file_piece.hh"
+
+#include <cstddef>
+#include <iterator>
+#include <vector>
+
+#ifdef WITH_THREADS
+#include "util/pcqueue.hh"
+#include "util/thread_pool.hh"
+
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <atomic>
+#include <exception>
+#include <istream>
+#include <streambuf>
+#include <string>
+#endif
+
+namespace lm {
+
+/* Read the count n-grams of order n following their header and call
+ *   callback(const WordIndex *reversed, Weights &weights)
+ * for each of them in file order, with the vocab ids of its words in reverse
+ * order.
+ *
+ * With more than one thread, a reader thread cuts the section into chunks of
+ * lines and threads workers parse them, so that the expensive part (numbers
+ * and vocabulary lookups) scales.  Callbacks still run on the calling thread,
+ * in file order, so the caller gets exactly what a sequential read would give.
+ * Errors in a chunk are thrown once the n-grams before it are handled.
+ */
+template <class Weights, class Voc, class Callback> void ParallelReadNGrams(util::FilePiece &f, const unsigned char n, const std::size_t count, const Voc &vocab, PositiveProbWarn &warn, std::size_t threads, Callback &callback);
+
+namespace detail {
+
+template <class Weights, class Voc, class Callback> void SequentialReadNGrams(util::FilePiece &f, const unsigned char n, const std::size_t count, const Voc &vocab, PositiveProbWarn &warn, Callback &callback) {
+  std::vector<WordIndex> reversed(n);
+  Weights weights;
+  for (std::size_t i = 0; i < count; ++i) {
+    ReadNGram(f, n, vocab, reversed.rbegin(), weights, warn);
+    callback(&*reversed.begin(), weights);
+  }
+}
+
+#ifdef WITH_THREADS
+
+template <class Weights> struct NGramChunk {
+  NGramChunk() : parsed(0) {}
+
+  // Lines of n-grams, each ending with a newline.
+  std::string text;
+  // Byte offset of text in the ARPA file.
+  uint64_t offset;
+  std::size_t lines;
+  // Lines parsed before an error, if any.
+  std::size_t parsed_lines;
+
+  // Vocab ids in reverse order, n per line.
+  std::vector<WordIndex> ids;
+  std::vector<Weights> weights;
+
+  // Set when reading or parsing failed.  Lines before the error are parsed.
+  std::exception_ptr error;
+  // Posted once ids, weights and error are set.
+  util::Semaphore parsed;
+};
+
+// Memory as a stream, so that chunks are parsed by FilePiece like the file.
+class ChunkStreamBuf : public std::streambuf {
+  public:
+    ChunkStreamBuf(char *begin, char *end) {
+      setg(begin, begin, end);
+    }
+};
+
+// Workers share the warning, which only complains once.
+class LockedPositiveProbWarn {
+  public:
+    explicit LockedPositiveProbWarn(PositiveProbWarn &warn) : warn_(warn) {}
+
+    void Warn(float prob) {
+      boost::lock_guard<boost::mutex> lock(mutex_);
+      warn_.Warn(prob);
+    }
+
+  private:
+    PositiveProbWarn &warn_;
+    boost::mutex mutex_;
+};
+
+template <class Weights, class Voc> class NGramChunkParser {
+  public:
+    typedef NGramChunk<Weights> *Request;
+
+    NGramChunkParser(unsigned char n, const Voc &vocab, LockedPositiveProbWarn &warn)
+      : n_(n), vocab_(vocab), warn_(warn) {}
+
+    void operator()(Request chunk) {
+      chunk->ids.resize(chunk->lines * n_);
+      chunk->weights.resize(chunk->lines);
+      chunk->parsed_lines = 0;
+      try {
+        if (chunk->lines) {
+          ChunkStreamBuf buf(&chunk->text[0], &chunk->text[0] + chunk->text.size());
+          std::istream stream(&buf);
+          util::FilePiece in(stream, NULL, chunk->text.size());
+          for (; chunk->parsed_lines < chunk->lines; ++chunk->parsed_lines) {
+            std::reverse_iterator<WordIndex*> out(&chunk->ids[0] + (chunk->parsed_lines + 1) * n_);
+            ReadNGram(in, n_, vocab_, out, chunk->weights[chunk->parsed_lines], warn_);
+          }
+        }
+      } catch (util::Exception &e) {
+        // Offsets are relative to the chunk.
+        e << " of the chunk at byte " << chunk->offset;
+        chunk->error = std::current_exception();
+      } catch (...) {
+        chunk->error = std::current_exception();
+      }
+      chunk->parsed.post();
+    }
+
+  private:
+    unsigned char n_;
+    const Voc &vocab_;
+    LockedPositiveProbWarn &warn_;
+};
+
+template <class Weights, class Voc> class NGramChunkReader {
+  public:
+    typedef NGramChunk<Weights> Chunk;
+
+    NGramChunkReader(util::FilePiece &f, unsigned char n, std::size_t count, util::PCQueue<Chunk*> &free, util::ThreadPool<NGramChunkParser<Weights, Voc> > &parsers, util::PCQueue<Chunk*> &ordered, std::atomic<bool> &stop)
+      : f_(f), n_(n), count_(count), free_(free), parsers_(parsers), ordered_(ordered), stop_(stop) {}
+
+    void operator()() {
+      // Enough for parsing to outweigh handing chunks around.
+      const std::size_t kChunkLines = 8192;
+      for (std::size_t done = 0; done < count_ && !stop_;) {
+        Chunk *chunk;
+        free_.Consume(chunk);
+        chunk->text.clear();
+        chunk->offset = f_.Offset();
+        chunk->lines = 0;
+        chunk->error = std::exception_ptr();
+        try {
+          for (; chunk->lines < kChunkLines && done < count_; ++chunk->lines, ++done) {
+            // Blank lines between n-grams are skipped like ReadFloat would.
+            StringPiece line;
+            do {
+              line = f_.ReadLine();
+            } while (IsWhiteSpace(line));
+            chunk->text.append(line.data(), line.size());
+            chunk->text.push_back('\n');
+          }
+        } catch (util::Exception &e) {
+          e << " in the " << static_cast<unsigned int>(n_) << "-gram at byte " << f_.Offset();
+          chunk->error = std::current_exception();
+        } catch (...) {
+          chunk->error = std::current_exception();
+        }
+        // Parse what was read either way: an error in those lines comes first.
+        parsers_.Produce(chunk);
+        ordered_.Produce(chunk);
+        if (chunk->error) break;
+      }
+      ordered_.Produce(NULL);
+    }
+
+  private:
+    static bool IsWhiteSpace(const StringPiece &line) {
+      for (const char *i = line.data(); i != line.data() + line.size(); ++i) {
+        if (!util::kSpaces[static_cast<unsigned char>(*i)]) return false;
+      }
+      return true;
+    }
+
+    util::FilePiece &f_;
+    const unsigned char n_;
+    const std::size_t count_;
+    util::PCQueue<Chunk*> &free_;
+    util::ThreadPool<NGramChunkParser<Weights, Voc> > &parsers_;
+    util::PCQueue<Chunk*> &ordered_;
+    std::atomic<bool> &stop_;
+};
+
+#endif // WITH_THREADS
+
+} // namespace detail
+
+template <class Weights, class Voc, class Callback> void ParallelReadNGrams(util::FilePiece &f, const unsigned char n, const std::size_t count, const Voc &vocab, PositiveProbWarn &warn, std::size_t threads, Callback &callback) {
+#ifdef WITH_THREADS
+  if (threads <= 1) {
+    detail::SequentialReadNGrams<Weights>(f, n, count, vocab, warn, callback);
+    return;
+  }
+  typedef detail::NGramChunk<Weights> Chunk;
+  // Chunks being read, parsed or handed to callbacks.
+  const std::size_t kChunks = 2 * threads + 2;
+  boost::scoped_array<Chunk> chunks(new Chunk[kChunks]);
+  util::PCQueue<Chunk*> free(kChunks), ordered(kChunks + 1);
+  for (std::size_t i = 0; i < kChunks; ++i) {
+    free.Produce(&chunks[i]);
+  }
+  std::atomic<bool> stop(false);
+  std::exception_ptr error;
+  {
+    detail::LockedPositiveProbWarn locked_warn(warn);
+    util::ThreadPool<detail::NGramChunkParser<Weights, Voc> > parsers(kChunks, threads, detail::NGramChunkParser<Weights, Voc>(n, vocab, locked_warn), NULL);
+    boost::thread reader(detail::NGramChunkReader<Weights, Voc>(f, n, count, free, parsers, ordered, stop));
+    for (Chunk *chunk; ordered.Consume(chunk);) {
+      util::WaitSemaphore(chunk->parsed);
+      if (!error) {
+        try {
+          for (std::size_t i = 0; i < chunk->parsed_lines; ++i) {
+            callback(&chunk->ids[i * n], chunk->weights[i]);
+          }
+          if (chunk->error) std::rethrow_exception(chunk->error);
+        } catch (...) {
+          // Drain the chunks in flight before throwing.
+          error = std::current_exception();
+          stop = true;
+        }
+      }
+      free.Produce(chunk);
+    }
+    reader.join();
+  } // Joins the parsers.
+  if (error) std::rethrow_exception(error);
+#else
+  detail::SequentialReadNGrams<Weights>(f, n, count, vocab, warn, callback);
+  (void)threads;
+#endif
+}
+
+} // namespace lm
+
+#endif // LM_PARALLEL_READ_ARPA_H
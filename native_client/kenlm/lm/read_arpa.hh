@@ -67,8 +67,9 @@ template <class Voc, class Weights> void Read1Grams(util::FilePiece &f, std::siz
   vocab.FinishedLoading(unigrams);
 }
 
-// Read ngram, write vocab ids to indices_out.
-template <class Voc, class Weights, class Iterator> void ReadNGram(util::FilePiece &f, const unsigned char n, const Voc &vocab, Iterator indices_out, Weights &weights, PositiveProbWarn &warn) {
+// Read ngram, write vocab ids to indices_out.  Warn is PositiveProbWarn or a
+// wrapper around it with the same Warn(float).
+template <class Voc, class Weights, class Iterator, class Warn> void ReadNGram(util::FilePiece &f, const unsigned char n, const Voc &vocab, Iterator indices_out, Weights &weights, Warn &warn) {
   try {
     weights.prob = f.ReadFloat();
     if (weights.prob > 0.0) {
@@ -27,6 +27,14 @@ inline uint64_t CombineWordHash(uint64_t current, const WordIndex next) {
   return ret;
 }
 
+inline void PrefetchRead(const void *address) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(address);
+#else
+  (void)address;
+#endif
+}
+
 #pragma pack(push)
 #pragma pack(4)
 struct ProbEntry {
@@ -125,6 +133,18 @@ template <class Value> class HashedSearch {
       return LongestPointer(found->value.prob);
     }
 
+    // Prefetch the entries FullScoreForgotState reads to score word after the
+    // context [context_rbegin, context_rend), which must be shorter than the
+    // order.  Only hashing is needed to locate them, so a batch of queries
+    // can overlap their cache misses.
+    void Prefetch(WordIndex word, const WordIndex *context_rbegin, const WordIndex *context_rend) const {
+      PrefetchNgrams(word, context_rbegin, context_rend);
+      // backoffs of the context
+      if (context_rbegin != context_rend) {
+        PrefetchNgrams(*context_rbegin, context_rbegin + 1, context_rend);
+      }
+    }
+
     // Generate a node without necessarily checking that it actually exists.
     // Optionally return false if it's know to not exist.
     bool FastMakeNode(const WordIndex *begin, const WordIndex *end, Node &node) const {
@@ -137,10 +157,25 @@ template <class Value> class HashedSearch {
     }
 
   private:
+    // Prefetch the n-grams ending with word and extending left into [begin, end)
+    void PrefetchNgrams(WordIndex word, const WordIndex *begin, const WordIndex *end) const {
+      PrefetchRead(&unigram_.Lookup(word));
+      Node node = static_cast<Node>(word);
+      for (const WordIndex *i = begin; i < end; ++i) {
+        node = CombineWordHash(node, *i);
+        std::size_t order_minus_2 = i - begin;
+        if (order_minus_2 < middle_.size()) {
+          PrefetchRead(&*middle_[order_minus_2].Ideal(node));
+        } else {
+          PrefetchRead(&*longest_.Ideal(node));
+        }
+      }
+    }
+
     // Interpret config's rest cost build policy and pass the right template argument to ApplyBuild.
     void DispatchBuild(util::FilePiece &f, const std::vector<uint64_t> &counts, const Config &config, const ProbingVocabulary &vocab, PositiveProbWarn &warn);
 
-    template <class Build> void ApplyBuild(util::FilePiece &f, const std::vector<uint64_t> &counts, const ProbingVocabulary &vocab, PositiveProbWarn &warn, const Build &build);
+    template <class Build> void ApplyBuild(util::FilePiece &f, const std::vector<uint64_t> &counts, const Config &config, const ProbingVocabulary &vocab, PositiveProbWarn &warn, const Build &build);
 
     class Unigram {
       public:
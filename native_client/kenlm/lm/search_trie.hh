@@ -88,6 +88,10 @@ template <class Quant, class Bhiksha> class TrieSearch {
       return LongestPointer(quant_, longest_.Find(word, node));
     }
 
+    // Each level of the trie is located by the one before it, so there is
+    // nothing to fetch ahead of the lookup.
+    void Prefetch(WordIndex /*word*/, const WordIndex * /*context_rbegin*/, const WordIndex * /*context_rend*/) const {}
+
     bool FastMakeNode(const WordIndex *begin, const WordIndex *end, Node &node) const {
       assert(begin != end);
       bool independent_left;
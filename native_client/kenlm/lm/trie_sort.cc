@@ -2,6 +2,7 @@
 
 #include "lm/config.hh"
 #include "lm/lm_exception.hh"
+#include "lm/parallel_read_arpa.hh"
 #include "lm/read_arpa.hh"
 #include "lm/vocab.hh"
 #include "lm/weights.hh"
@@ -17,10 +18,16 @@
 #include <cstdio>
 #include <cstdlib>
 #include <deque>
+#include <exception>
+#include <functional>
 #include <iterator>
 #include <limits>
 #include <vector>
 
+#ifdef WITH_THREADS
+#include "util/thread_pool.hh"
+#endif
+
 namespace lm {
 namespace ngram {
 namespace trie {
@@ -164,6 +171,112 @@ template <class Combine> FILE *MergeSortedFiles(FILE *first_file, FILE *second_f
   return out_file.release();
 }
 
+// Independent pieces of sorting and merging, run concurrently when possible.
+struct Job {
+  std::function<void ()> run;
+  std::exception_ptr error;
+};
+
+class RunJob {
+  public:
+    typedef Job *Request;
+
+    void operator()(Job *job) {
+      try {
+        job->run();
+      } catch (...) {
+        job->error = std::current_exception();
+      }
+    }
+};
+
+// Run all jobs, even when one of them fails, and return the first error.
+std::exception_ptr RunJobs(std::vector<Job> &jobs, std::size_t threads) {
+  RunJob run;
+#ifdef WITH_THREADS
+  if (threads > 1 && jobs.size() > 1) {
+    // Destructor joins.
+    util::ThreadPool<RunJob> pool(jobs.size(), std::min(threads, jobs.size()), run, NULL);
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+      pool.Produce(&jobs[i]);
+    }
+  } else {
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+      run(&jobs[i]);
+    }
+  }
+#else
+  (void)threads;
+  for (std::size_t i = 0; i < jobs.size(); ++i) {
+    run(&jobs[i]);
+  }
+#endif
+  for (std::size_t i = 0; i < jobs.size(); ++i) {
+    if (jobs[i].error) return jobs[i].error;
+  }
+  return std::exception_ptr();
+}
+
+// Fills the sort buffer with n-grams as they are read and writes sorted files
+// whenever it is full, sorting a shard of the buffer per thread.
+template <class Weights> class SortBatches {
+  public:
+    SortBatches(uint8_t *begin, std::size_t batch_size, unsigned char order, const std::string &file_prefix, std::size_t threads, std::deque<FILE*> &files, std::deque<FILE*> &contexts)
+      : begin_(begin), out_(begin), entry_size_(sizeof(WordIndex) * order + sizeof(Weights)),
+        end_(begin + batch_size * entry_size_), order_(order), file_prefix_(file_prefix),
+        threads_(threads), files_(files), contexts_(contexts) {}
+
+    void operator()(const WordIndex *reversed, const Weights &weights) {
+      memcpy(out_, reversed, sizeof(WordIndex) * order_);
+      memcpy(out_ + sizeof(WordIndex) * order_, &weights, sizeof(Weights));
+      out_ += entry_size_;
+      if (out_ == end_) Flush();
+    }
+
+    void Flush() {
+      const std::size_t entries = (out_ - begin_) / entry_size_;
+      if (!entries) return;
+      const std::size_t shards = std::max<std::size_t>(1, std::min(threads_, entries));
+      std::vector<FILE*> files(shards), contexts(shards);
+      std::vector<Job> jobs(shards);
+      for (std::size_t i = 0; i < shards; ++i) {
+        uint8_t *shard_begin = begin_ + entries * i / shards * entry_size_;
+        uint8_t *shard_end = begin_ + entries * (i + 1) / shards * entry_size_;
+        jobs[i].run = [this, shard_begin, shard_end, &files, &contexts, i] {
+          // Sort full records by full n-gram.
+          EntryCompare less(order_);
+          util::SizedSort(shard_begin, shard_end, entry_size_, less);
+          // Duplicates in different shards are found when merging, so look
+          // for them within a shard too: whether an ARPA file is rejected
+          // must not depend on how its n-grams were split up.
+          for (uint8_t *entry = shard_begin; entry + entry_size_ < shard_end; entry += entry_size_) {
+            if (!less(entry, entry + entry_size_)) ThrowCombine()(entry_size_, order_, entry, entry + entry_size_, NULL);
+          }
+          files[i] = DiskFlush(shard_begin, shard_end, file_prefix_);
+          contexts[i] = WriteContextFile(shard_begin, shard_end, file_prefix_, entry_size_, order_);
+        };
+      }
+      std::exception_ptr error = RunJobs(jobs, threads_);
+      // Hand files to the closers, failed or not.
+      for (std::size_t i = 0; i < shards; ++i) {
+        if (files[i]) files_.push_back(files[i]);
+        if (contexts[i]) contexts_.push_back(contexts[i]);
+      }
+      if (error) std::rethrow_exception(error);
+      out_ = begin_;
+    }
+
+  private:
+    uint8_t *const begin_;
+    uint8_t *out_;
+    const std::size_t entry_size_;
+    uint8_t *const end_;
+    const unsigned char order_;
+    const std::string &file_prefix_;
+    const std::size_t threads_;
+    std::deque<FILE*> &files_, &contexts_;
+};
+
 } // namespace
 
 void RecordReader::Init(FILE *file, std::size_t entry_size) {
@@ -226,7 +339,7 @@ SortedFiles::SortedFiles(const Config &config, util::FilePiece &f, std::vector<u
   if (!mem.get()) UTIL_THROW(util::ErrnoException, "malloc failed for sort buffer size " << buffer);
 
   for (unsigned char order = 2; order <= counts.size(); ++order) {
-    ConvertToSorted(f, vocab, counts, file_prefix, order, warn, mem.get(), buffer);
+    ConvertToSorted(f, vocab, counts, file_prefix, order, warn, mem.get(), buffer, config.building_threads);
   }
   ReadEnd(f);
 }
@@ -251,7 +364,7 @@ class Closer {
 };
 } // namespace
 
-void SortedFiles::ConvertToSorted(util::FilePiece &f, const SortedVocabulary &vocab, const std::vector<uint64_t> &counts, const std::string &file_prefix, unsigned char order, PositiveProbWarn &warn, void *mem, std::size_t mem_size) {
+void SortedFiles::ConvertToSorted(util::FilePiece &f, const SortedVocabulary &vocab, const std::vector<uint64_t> &counts, const std::string &file_prefix, unsigned char order, PositiveProbWarn &warn, void *mem, std::size_t mem_size, std::size_t threads) {
   ReadNGramHeader(f, order);
   const size_t count = counts[order - 1];
   // Size of weights.  Does it include backoff?
@@ -264,37 +377,42 @@ void SortedFiles::ConvertToSorted(util::FilePiece &f, const SortedVocabulary &vo
   std::deque<FILE*> files, contexts;
   Closer files_closer(files), contexts_closer(contexts);
 
-  for (std::size_t batch = 0, done = 0; done < count; ++batch) {
-    uint8_t *out = begin;
-    uint8_t *out_end = out + std::min(count - done, batch_size) * entry_size;
-    if (order == counts.size()) {
-      for (; out != out_end; out += entry_size) {
-        std::reverse_iterator<WordIndex*> it(reinterpret_cast<WordIndex*>(out) + order);
-        ReadNGram(f, order, vocab, it, *reinterpret_cast<Prob*>(out + words_size), warn);
-      }
-    } else {
-      for (; out != out_end; out += entry_size) {
-        std::reverse_iterator<WordIndex*> it(reinterpret_cast<WordIndex*>(out) + order);
-        ReadNGram(f, order, vocab, it, *reinterpret_cast<ProbBackoff*>(out + words_size), warn);
-      }
-    }
-    // Sort full records by full n-gram.
-    util::SizedSort(begin, out_end, entry_size, EntryCompare(order));
-    files.push_back(DiskFlush(begin, out_end, file_prefix));
-    contexts.push_back(WriteContextFile(begin, out_end, file_prefix, entry_size, order));
-
-    done += (out_end - begin) / entry_size;
+  if (order == counts.size()) {
+    SortBatches<Prob> sort(begin, batch_size, order, file_prefix, threads, files, contexts);
+    ParallelReadNGrams<Prob>(f, order, count, vocab, warn, threads, sort);
+    sort.Flush();
+  } else {
+    SortBatches<ProbBackoff> sort(begin, batch_size, order, file_prefix, threads, files, contexts);
+    ParallelReadNGrams<ProbBackoff>(f, order, count, vocab, warn, threads, sort);
+    sort.Flush();
   }
 
-  // All individual files created.  Merge them.
-
+  // All individual files created.  Merge them pairwise, a round at a time.
   while (files.size() > 1) {
-    files.push_back(MergeSortedFiles(files[0], files[1], file_prefix, weights_size, order, ThrowCombine()));
-    files_closer.PopFront();
-    files_closer.PopFront();
-    contexts.push_back(MergeSortedFiles(contexts[0], contexts[1], file_prefix, 0, order - 1, FirstCombine()));
-    contexts_closer.PopFront();
-    contexts_closer.PopFront();
+    const std::size_t pairs = files.size() / 2;
+    std::vector<FILE*> merged_files(pairs), merged_contexts(pairs);
+    std::vector<Job> jobs(2 * pairs);
+    for (std::size_t i = 0; i < pairs; ++i) {
+      FILE *first = files[2 * i], *second = files[2 * i + 1];
+      FILE *first_context = contexts[2 * i], *second_context = contexts[2 * i + 1];
+      FILE *&merged = merged_files[i], *&merged_context = merged_contexts[i];
+      jobs[2 * i].run = [first, second, &merged, &file_prefix, weights_size, order] {
+        merged = MergeSortedFiles(first, second, file_prefix, weights_size, order, ThrowCombine());
+      };
+      jobs[2 * i + 1].run = [first_context, second_context, &merged_context, &file_prefix, order] {
+        merged_context = MergeSortedFiles(first_context, second_context, file_prefix, 0, order - 1, FirstCombine());
+      };
+    }
+    std::exception_ptr error = RunJobs(jobs, threads);
+    for (std::size_t i = 0; i < pairs; ++i) {
+      if (merged_files[i]) files.push_back(merged_files[i]);
+      files_closer.PopFront();
+      files_closer.PopFront();
+      if (merged_contexts[i]) contexts.push_back(merged_contexts[i]);
+      contexts_closer.PopFront();
+      contexts_closer.PopFront();
+    }
+    if (error) std::rethrow_exception(error);
   }
 
   if (!files.empty()) {
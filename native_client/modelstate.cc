@@ -7,7 +7,18 @@
 using std::vector;
 
 ModelState::ModelState()
-  : beam_width_(-1)
+  : scorer_alpha_(0.f)
+  , scorer_beta_(0.f)
+  , rescorer_alpha_(0.f)
+  , rescorer_beta_(0.f)
+  , scorer_load_method_(util::LoadMethod::LAZY)
+  , scorer_prefault_(false)
+  , scorer_huge_pages_(false)
+  , beam_width_(-1)
+  , beam_threshold_(0.f)
+  , max_active_(0)
+  , fast_log_add_(false)
+  , decoder_threads_(1)
   , n_steps_(-1)
   , n_context_(-1)
   , n_features_(-1)
@@ -69,7 +80,60 @@ ModelState::decode_metadata(const DecoderState& state,
   Metadata metadata {
     transcripts,  // transcripts
     num_returned, // num_transcripts
+    static_cast<unsigned int>(state.min_beam_size()),    // beam_width
+    static_cast<unsigned int>(state.min_cutoff_top_n()), // cutoff_top_n
   };
   memcpy(ret, &metadata, sizeof(Metadata));
   return ret;
 }
+
+WordLattice*
+ModelState::decode_lattice(const DecoderState& state,
+                           size_t num_results)
+{
+  Lattice lattice = state.decode_lattice(num_results);
+  unsigned int num_arcs = lattice.arcs.size();
+  unsigned int num_finals = lattice.finals.size();
+
+  LatticeArc* arcs = (LatticeArc*)malloc(sizeof(LatticeArc)*num_arcs);
+  for (unsigned int i = 0; i < num_arcs; ++i) {
+    const Lattice::Arc& in = lattice.arcs[i];
+    LatticeArc arc {
+      in.from,                                                  // from_node
+      in.to,                                                    // to_node
+      strdup(alphabet_.Decode(in.tokens).c_str()),              // text
+      in.start_timestep,                                        // start_timestep
+      in.end_timestep,                                          // end_timestep
+      in.start_timestep * ((float)audio_win_step_ / sample_rate_), // start_time
+      in.acoustic_score,                                        // acoustic_score
+      in.lm_score,                                              // lm_score
+    };
+    memcpy(&arcs[i], &arc, sizeof(LatticeArc));
+  }
+
+  LatticeFinal* finals = (LatticeFinal*)malloc(sizeof(LatticeFinal)*num_finals);
+  for (unsigned int i = 0; i < num_finals; ++i) {
+    LatticeFinal final {
+      lattice.finals[i].first,  // node
+      lattice.finals[i].second, // confidence
+    };
+    memcpy(&finals[i], &final, sizeof(LatticeFinal));
+  }
+
+  std::string bytes = lattice.serialize(alphabet_);
+  char* serialized = (char*)malloc(bytes.size());
+  memcpy(serialized, bytes.data(), bytes.size());
+
+  WordLattice* ret = (WordLattice*)malloc(sizeof(WordLattice));
+  WordLattice word_lattice {
+    arcs,                                      // arcs
+    num_arcs,                                  // num_arcs
+    lattice.num_nodes,                         // num_nodes
+    finals,                                    // finals
+    num_finals,                                // num_finals
+    serialized,                                // serialized
+    static_cast<unsigned int>(bytes.size()),   // serialized_size
+  };
+  memcpy(ret, &word_lattice, sizeof(WordLattice));
+  return ret;
+}
@@ -7,18 +7,45 @@
 #include "alphabet.h"
 
 #include "ctcdecode/scorer.h"
+#include "ctcdecode/hot_words.h"
 #include "ctcdecode/output.h"
 
 class DecoderState;
+class QosController;
+class ThreadPool;
 
 struct ModelState {
   //TODO: infer batch size from model/use dynamic batch size
   static constexpr unsigned int BATCH_SIZE = 1;
 
   Alphabet alphabet_;
+  // scorers can be shared with other models, see ScorerRegistry, and their
+  // weights in this model are kept here
   std::shared_ptr<Scorer> scorer_;
+  std::shared_ptr<Scorer> rescorer_;
+  float scorer_alpha_;
+  float scorer_beta_;
+  float rescorer_alpha_;
+  float rescorer_beta_;
+  // how scorers are loaded, see DS_SetScorerLoadOptions
+  util::LoadMethod scorer_load_method_;
+  bool scorer_prefault_;
+  bool scorer_huge_pages_;
   std::unordered_map<std::string, float> hot_words_;
+  // hot_words_ compiled for the decoder, shared by all streams of this model
+  std::shared_ptr<const HotWordTrie> compiled_hot_words_;
   unsigned int beam_width_;
+  // score threshold pruning of new streams, see DS_SetModelBeamThreshold
+  float beam_threshold_;
+  unsigned int max_active_;
+  // approximate probability merges of new streams, see DS_SetModelFastLogAdd
+  bool fast_log_add_;
+  // threads the timesteps of new streams are decoded on and the pool of the
+  // extra ones, see DS_SetModelDecoderThreads
+  unsigned int decoder_threads_;
+  std::shared_ptr<ThreadPool> decoder_pool_;
+  // load control of new streams, null if disabled
+  std::shared_ptr<QosController> qos_;
   unsigned int n_steps_;
   unsigned int n_context_;
   unsigned int n_features_;
@@ -75,6 +102,18 @@ struct ModelState {
    */
   virtual Metadata* decode_metadata(const DecoderState& state,
                                     size_t num_results);
+
+  /**
+   * @brief Return the candidate transcripts as a word lattice.
+   *
+   * @param state Decoder state to use when decoding.
+   * @param num_results Maximum number of candidate transcripts to include.
+   *
+   * @return A WordLattice struct. The user is responsible for freeing it by
+   * calling DS_FreeLattice().
+   */
+  virtual WordLattice* decode_lattice(const DecoderState& state,
+                                      size_t num_results);
 };
 
 #endif // MODELSTATE_H
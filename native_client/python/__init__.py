@@ -65,6 +65,45 @@ class Model(object):
         """
         return deepspeech.impl.SetModelBeamWidth(self._impl, beam_width)
 
+    def setBeamThreshold(self, threshold, max_active=0):
+        """
+        Prune the beam of new streams by score in addition to its width. Candidates scoring more than threshold below the best one are dropped after each frame.
+
+        :param threshold: Maximum score difference (natural log) to the best candidate. Zero or negative disables threshold pruning.
+        :type threshold: float
+
+        :param max_active: Maximum number of candidates kept when threshold pruning is enabled. Zero to use the beam width.
+        :type max_active: int
+
+        :return: Zero on success, non-zero on failure.
+        :type: int
+        """
+        return deepspeech.impl.SetModelBeamThreshold(self._impl, threshold, max_active)
+
+    def setFastLogAdd(self, enable):
+        """
+        Merge the probabilities of the candidates of new streams with a table-based approximation instead of the exact formula. It is faster, and its absolute error is below 1e-5 per merge.
+
+        :param enable: True to use the approximation, False for the exact formula, which is the default.
+        :type enable: bool
+
+        :return: Zero on success, non-zero on failure.
+        :type: int
+        """
+        return deepspeech.impl.SetModelFastLogAdd(self._impl, int(enable))
+
+    def setDecoderThreads(self, num_threads):
+        """
+        Spread the language model lookups of each timestep of new streams over a pool of threads shared by the streams of the model. This lowers the latency of single streams decoded with wide beams, the transcriptions are the same as without the pool.
+
+        :param num_threads: Number of threads a timestep is decoded on, including the one of the stream. Zero or one disables the pool, which is the default.
+        :type num_threads: int
+
+        :return: Zero on success, non-zero on failure.
+        :type: int
+        """
+        return deepspeech.impl.SetModelDecoderThreads(self._impl, num_threads)
+
     def sampleRate(self):
         """
         Return the sample rate expected by the model.
@@ -74,6 +113,25 @@ class Model(object):
         """
         return deepspeech.impl.GetModelSampleRate(self._impl)
 
+    def setScorerLoadOptions(self, load_method, prefault=False, huge_pages=False):
+        """
+        Set how scorer files are loaded by the next calls to enableExternalScorer and enableRescoringScorer.
+
+        :param load_method: One of the deepspeech.impl.DS_SCORER_LOAD_* values.
+        :type load_method: int
+
+        :param prefault: With DS_SCORER_LOAD_LAZY, touch every page of the memory mapped scorer in a background thread after loading it.
+        :type prefault: bool
+
+        :param huge_pages: Back the scorer tables with transparent huge pages where the system supports them.
+        :type huge_pages: bool
+
+        :throws: RuntimeError on error
+        """
+        status = deepspeech.impl.SetScorerLoadOptions(self._impl, load_method, int(prefault), int(huge_pages))
+        if status != 0:
+            raise RuntimeError("SetScorerLoadOptions failed with '{}' (0x{:X})".format(deepspeech.impl.ErrorCodeToErrorMessage(status),status))
+
     def enableExternalScorer(self, scorer_path):
         """
         Enable decoding using an external scorer.
@@ -95,12 +153,77 @@ class Model(object):
         """
         return deepspeech.impl.DisableExternalScorer(self._impl)
 
+    def enableRescoringScorer(self, scorer_path):
+        """
+        Enable rescoring of the final transcripts with a second scorer, typically built from a larger language model than the external scorer, with the same vocabulary.
+
+        :param scorer_path: The path to the rescoring scorer file.
+        :type scorer_path: str
+
+        :throws: RuntimeError on error
+        """
+        status = deepspeech.impl.EnableRescoringScorer(self._impl, scorer_path)
+        if status != 0:
+            raise RuntimeError("EnableRescoringScorer failed with '{}' (0x{:X})".format(deepspeech.impl.ErrorCodeToErrorMessage(status),status))
+
+    def disableRescoringScorer(self):
+        """
+        Disable rescoring of the final transcripts.
+
+        :return: Zero on success, non-zero on failure.
+        """
+        return deepspeech.impl.DisableRescoringScorer(self._impl)
+
+    def setRescoringScorerAlphaBeta(self, alpha, beta):
+        """
+        Set hyperparameters alpha and beta of the rescoring scorer.
+
+        :param alpha: Language model weight of the rescoring scorer.
+        :type alpha: float
+
+        :param beta: Word insertion weight of the rescoring scorer.
+        :type beta: float
+
+        :return: Zero on success, non-zero on failure.
+        :type: int
+        """
+        return deepspeech.impl.SetRescoringScorerAlphaBeta(self._impl, alpha, beta)
+
+    def enableDecoderQoS(self, min_beam_width, min_cutoff_top_n, max_load):
+        """
+        Lower the decoding accuracy of streams under load instead of letting their processing fall behind. Beam width and the number of classes expanded per timestep are lowered towards the given minimums while streams use more than max_load of the processing capacity, and restored once the load drops. Applies to streams created after this call.
+
+        :param min_beam_width: Smallest beam width streams can be lowered to.
+        :type min_beam_width: int
+
+        :param min_cutoff_top_n: Smallest number of classes expanded per timestep.
+        :type min_cutoff_top_n: int
+
+        :param max_load: Share of the processing capacity streams can use before they are degraded, in (0, 1].
+        :type max_load: float
+
+        :throws: RuntimeError on error
+        """
+        status = deepspeech.impl.EnableDecoderQoS(self._impl, min_beam_width, min_cutoff_top_n, max_load)
+        if status != 0:
+            raise RuntimeError("EnableDecoderQoS failed with '{}' (0x{:X})".format(deepspeech.impl.ErrorCodeToErrorMessage(status),status))
+
+    def disableDecoderQoS(self):
+        """
+        Stop degrading new streams under load.
+
+        :return: Zero on success, non-zero on failure.
+        """
+        return deepspeech.impl.DisableDecoderQoS(self._impl)
+
     def addHotWord(self, word, boost):
         """
         Add a word and its boost for decoding.
         
         Words that don't occur in the scorer (e.g. proper nouns) or strings that contain spaces won't be taken into account.
 
+        The boost is applied once per occurrence of the hot-word in a transcription. Up to version 0.9 it was applied once per scored n-gram containing the word, so boosts tuned for those versions may need to be raised.
+
         :param word: the hot-word
         :type word: str
 
@@ -206,6 +329,49 @@ class Stream(object):
         if self._impl:
             self.freeStream()
 
+    def setDeadline(self, seconds):
+        """
+        Give each call processing audio of this stream a latency budget. When decoding falls behind, the beam is narrowed for the rest of the call so that it returns on time, at the cost of accuracy. Each batch of timesteps a call processes gets an equal share of what is left of the budget.
+
+        :param seconds: Time each call may take, zero for no limit.
+        :type seconds: float
+
+        :throws: RuntimeError if the stream object is not valid
+        """
+        if not self._impl:
+            raise RuntimeError("Stream object is not valid. Trying to configure an already finished stream?")
+        deepspeech.impl.SetStreamDeadline(self._impl, seconds)
+
+    def deadlineHits(self):
+        """
+        Number of times decoding had to narrow the beam to meet the deadline.
+
+        :return: Number of batches of audio decoded with a narrowed beam.
+        :type: int
+
+        :throws: RuntimeError if the stream object is not valid
+        """
+        if not self._impl:
+            raise RuntimeError("Stream object is not valid. Trying to query an already finished stream?")
+        return deepspeech.impl.GetStreamDeadlineHits(self._impl)
+
+    def setGreedyDecoding(self, greedy):
+        """
+        Decode this stream with the best path (greedy) decoder instead of the beam search.
+        This is much faster, but ignores the external scorer, hot-words and beam width.
+        Must be called before any audio is fed.
+
+        :param greedy: True to use the greedy decoder, False for beam search.
+        :type greedy: bool
+
+        :throws: RuntimeError on error
+        """
+        if not self._impl:
+            raise RuntimeError("Stream object is not valid. Trying to configure an already finished stream?")
+        status = deepspeech.impl.SetStreamGreedyDecoding(self._impl, int(greedy))
+        if status != 0:
+            raise RuntimeError("SetStreamGreedyDecoding failed with '{}' (0x{:X})".format(deepspeech.impl.ErrorCodeToErrorMessage(status),status))
+
     def feedAudioContent(self, audio_buffer):
         """
         Feed audio samples to an ongoing streaming inference.
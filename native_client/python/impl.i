@@ -102,6 +102,13 @@ static PyObject *parent_reference() {
 %ignore Metadata::num_transcripts;
 %ignore CandidateTranscript::num_tokens;
 
+// Word lattices are only exposed by the C API for now.
+%ignore DS_FinishStreamWithLattice;
+%ignore DS_FreeLattice;
+%ignore WordLattice;
+%ignore LatticeArc;
+%ignore LatticeFinal;
+
 %extend struct Metadata {
   ~Metadata() {
     DS_FreeMetadata($self);
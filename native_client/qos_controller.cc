@@ -0,0 +1,92 @@
+#include "qos_controller.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+// Load is measured over windows of this length
+static const double WINDOW_SECONDS = 0.25;
+// Quality is cut by this factor after an overloaded window...
+static const float DECREASE_FACTOR = 0.7f;
+// ...and raised by this step after a window below RESTORE_LOAD * max_load
+static const float INCREASE_STEP = 0.1f;
+static const float RESTORE_LOAD = 0.5f;
+
+QosController::QosController(unsigned int min_beam_width,
+                             unsigned int min_cutoff_top_n,
+                             float max_load,
+                             unsigned int capacity)
+  : min_beam_width_(std::max(1u, min_beam_width))
+  , min_cutoff_top_n_(std::max(1u, min_cutoff_top_n))
+  , max_load_(max_load)
+  , capacity_(capacity)
+  , level_(1.f)
+  , window_start_(Clock::now())
+  , busy_seconds_(0.0)
+  , active_(0)
+  , peak_active_(0)
+{
+  if (capacity_ == 0) {
+    capacity_ = std::max(1u, std::thread::hardware_concurrency());
+  }
+}
+
+void
+QosController::begin_batch()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++active_;
+  peak_active_ = std::max(peak_active_, active_);
+}
+
+void
+QosController::end_batch(double seconds)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  --active_;
+  busy_seconds_ += seconds;
+
+  Clock::time_point now = Clock::now();
+  double elapsed = std::chrono::duration<double>(now - window_start_).count();
+  if (elapsed < WINDOW_SECONDS) {
+    return;
+  }
+
+  // More streams processing at once than the machine can run means batches
+  // are queueing, even if each of them is fast
+  double load = busy_seconds_ / (elapsed * capacity_);
+  bool backlog = peak_active_ > capacity_;
+
+  float level = level_;
+  if (load > max_load_ || backlog) {
+    level *= DECREASE_FACTOR;
+  } else if (load < max_load_ * RESTORE_LOAD) {
+    level = std::min(1.f, level + INCREASE_STEP);
+  }
+  level_ = level;
+
+  window_start_ = now;
+  busy_seconds_ = 0.0;
+  peak_active_ = active_;
+}
+
+unsigned int
+QosController::scale(unsigned int value, unsigned int min_value) const
+{
+  if (value <= min_value) {
+    return value;
+  }
+  return min_value + static_cast<unsigned int>(std::lround(level_ * (value - min_value)));
+}
+
+unsigned int
+QosController::beam_width(unsigned int beam_width) const
+{
+  return scale(beam_width, min_beam_width_);
+}
+
+unsigned int
+QosController::cutoff_top_n(unsigned int cutoff_top_n) const
+{
+  return scale(cutoff_top_n, min_cutoff_top_n_);
+}
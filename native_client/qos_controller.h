@@ -0,0 +1,62 @@
+#ifndef QOS_CONTROLLER_H
+#define QOS_CONTROLLER_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+/*
+ * Trades decoding accuracy for throughput when a model is overloaded. Streams
+ * report the time spent on each batch they process, and the controller keeps
+ * a quality level between 0 and 1 from the share of the machine the streams
+ * use and from how many of them are processing at once. The level drops
+ * quickly while the load is above the configured maximum and recovers slowly
+ * once it has gone well below it. Streams scale their beam width and class
+ * cutoff with the level before each batch.
+ */
+class QosController {
+public:
+  /* Parameters:
+   *     min_beam_width: Beam width used at the lowest quality level.
+   *     min_cutoff_top_n: Classes expanded per frame at the lowest level.
+   *     max_load: Share of the processing capacity streams may use before
+   *               quality is lowered, in (0, 1].
+   *     capacity: Number of streams that can be processed in parallel,
+   *               zero for the number of hardware threads.
+   */
+  QosController(unsigned int min_beam_width,
+                unsigned int min_cutoff_top_n,
+                float max_load,
+                unsigned int capacity);
+
+  // Called by a stream before and after it processes a batch
+  void begin_batch();
+  void end_batch(double seconds);
+
+  // Values to use now for a stream asking for beam_width and cutoff_top_n
+  unsigned int beam_width(unsigned int beam_width) const;
+  unsigned int cutoff_top_n(unsigned int cutoff_top_n) const;
+
+  float level() const { return level_; }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  unsigned int scale(unsigned int value, unsigned int min_value) const;
+
+  const unsigned int min_beam_width_;
+  const unsigned int min_cutoff_top_n_;
+  const float max_load_;
+  unsigned int capacity_;
+
+  std::atomic<float> level_;
+
+  std::mutex mutex_;
+  // processing time reported and streams processing at once since window_start_
+  Clock::time_point window_start_;
+  double busy_seconds_;
+  unsigned int active_;
+  unsigned int peak_active_;
+};
+
+#endif // QOS_CONTROLLER_H
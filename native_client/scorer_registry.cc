@@ -0,0 +1,85 @@
+#include "scorer_registry.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "deepspeech.h"
+
+// labels of the alphabet in order, two alphabets with the same key decode
+// the same way
+static std::string
+alphabet_key(const Alphabet& alphabet)
+{
+  std::string key;
+  for (unsigned int label = 0; label < alphabet.GetSize(); ++label) {
+    std::string str = alphabet.DecodeSingle(label);
+    key += std::to_string(str.size());
+    key += ':';
+    key += str;
+  }
+  return key;
+}
+
+ScorerRegistry&
+ScorerRegistry::instance()
+{
+  static ScorerRegistry registry;
+  return registry;
+}
+
+int
+ScorerRegistry::acquire(const std::string& path,
+                        const Alphabet& alphabet,
+                        util::LoadMethod load_method,
+                        bool prefault,
+                        bool huge_pages,
+                        std::shared_ptr<Scorer>* scorer)
+{
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    return DS_ERR_SCORER_UNREADABLE;
+  }
+  Key key(path,
+          static_cast<uint64_t>(info.st_dev),
+          static_cast<uint64_t>(info.st_ino),
+          static_cast<int64_t>(info.st_size),
+          static_cast<int64_t>(info.st_mtime),
+          alphabet_key(alphabet),
+          static_cast<int>(load_method),
+          huge_pages);
+
+  std::shared_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // forget the scorers no model holds anymore, unless a call is loading
+    // or waiting for them
+    for (auto it = scorers_.begin(); it != scorers_.end();) {
+      if (it->second.use_count() == 1 && it->second->scorer.expired()) {
+        it = scorers_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    std::shared_ptr<Entry>& slot = scorers_[key];
+    if (!slot) {
+      slot = std::make_shared<Entry>();
+    }
+    entry = slot;
+  }
+
+  std::lock_guard<std::mutex> load_lock(entry->load_mutex);
+  *scorer = entry->scorer.lock();
+  if (*scorer) {
+    return DS_ERR_OK;
+  }
+
+  std::shared_ptr<Scorer> loaded = std::make_shared<Scorer>();
+  loaded->set_load_options(load_method, prefault, huge_pages);
+  int err = loaded->init(path, alphabet);
+  if (err != 0) {
+    return err;
+  }
+  entry->scorer = loaded;
+  *scorer = loaded;
+  return DS_ERR_OK;
+}
@@ -0,0 +1,71 @@
+#ifndef SCORER_REGISTRY_H
+#define SCORER_REGISTRY_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include "ctcdecode/scorer.h"
+
+/*
+ * Scorers loaded by the models of the process. A scorer package is loaded
+ * once and shared by every model enabling it while one of them still holds
+ * it, so additional models cost neither memory nor loading time. Packages
+ * are identified by their path and by the file it leads to, so a package
+ * replaced or rewritten in place is loaded again. Shared scorers must not be
+ * modified: alpha, beta and hot-words are kept per model and applied by the
+ * decoder.
+ */
+class ScorerRegistry {
+public:
+  static ScorerRegistry& instance();
+
+  /* Get the scorer of a package, loading it if no model holds it.
+   *
+   * Parameters:
+   *     path: Path of the scorer package.
+   *     alphabet: Alphabet of the model.
+   *     load_method, prefault, huge_pages: See Scorer::set_load_options().
+   *                                        Packages loaded with a different
+   *                                        load method or huge pages setting
+   *                                        are not shared.
+   *     scorer: Receives the scorer.
+   *
+   * Return:
+   *     Zero on success, the error of Scorer::init() otherwise.
+   *
+   * Concurrent calls for the same package wait for a single load of it,
+   * while other packages load at the same time.
+   */
+  int acquire(const std::string& path,
+              const Alphabet& alphabet,
+              util::LoadMethod load_method,
+              bool prefault,
+              bool huge_pages,
+              std::shared_ptr<Scorer>* scorer);
+
+private:
+  ScorerRegistry() = default;
+
+  // path, device, inode, size and modification time of the package,
+  // alphabet, load method and huge pages
+  using Key = std::tuple<std::string, uint64_t, uint64_t, int64_t, int64_t, std::string, int, bool>;
+
+  // A package being loaded or loaded already. Its mutex is held during the
+  // load, so that calls for the package wait for it instead of loading it
+  // again.
+  struct Entry {
+    std::mutex load_mutex;
+    std::weak_ptr<Scorer> scorer;
+  };
+
+  // guards scorers_ only, entries are looked up under it and loaded
+  // without it
+  std::mutex mutex_;
+  std::map<Key, std::shared_ptr<Entry>> scorers_;
+};
+
+#endif // SCORER_REGISTRY_H
@@ -289,6 +289,10 @@ public class DeepSpeechStream {
 }
 
 /// An object providing an interface to a trained DeepSpeech model.
+///
+/// Some decoder options of the C API, such as score threshold pruning,
+/// load-aware QoS, rescoring, deadlines, greedy decoding and word lattices,
+/// are not exposed by this binding yet, see the C API documentation.
 public class DeepSpeechModel {
     private var modelCtx: OpaquePointer!
 
@@ -1,6 +1,11 @@
 #include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <string>
+#include <vector>
 
 #include "ctcdecode/scorer.h"
 #include "alphabet.h"
@@ -13,6 +18,84 @@
 
 using namespace std;
 
+template<typename NextFn>
+static void time_lookups(const char* name,
+                         const vector<pair<int, int>>& queries,
+                         NextFn next)
+{
+  long checksum = 0;
+  auto start = chrono::steady_clock::now();
+  for (const auto& q : queries) {
+    checksum += next(q.first, q.second);
+  }
+  auto end = chrono::steady_clock::now();
+  double ns = chrono::duration<double, nano>(end - start).count() / queries.size();
+  printf("%s: %.2f ns/lookup (checksum %ld)\n", name, ns, checksum);
+}
+
+// Time dictionary lookups along random walks through the vocabulary, in the
+// FST (binary search over the arcs of each state) and in the dense table
+static void benchmark_dictionary(const Scorer& scorer)
+{
+  using FstType = Scorer::FstType;
+  const FstType& dict = *scorer.dictionary;
+  // build the dense table only if the scorer was loaded without one
+  unique_ptr<DenseDictionary> owned_dense;
+  if (!scorer.dense_dictionary) {
+    owned_dense.reset(new DenseDictionary(dict));
+  }
+  const DenseDictionary& dense = scorer.dense_dictionary ? *scorer.dense_dictionary : *owned_dense;
+
+  // Record (state, label) queries: the labels of a random walk, each
+  // followed by a few labels picked at random, like the beam search does
+  const size_t num_queries = 10000000;
+  mt19937 rng(42);
+  vector<pair<int, int>> queries;
+  queries.reserve(num_queries);
+  int state = dict.Start();
+  while (queries.size() < num_queries) {
+    if (dict.NumArcs(state) == 0) {
+      state = dict.Start();
+      continue;
+    }
+    for (int i = 0; i < 3; ++i) {
+      queries.emplace_back(state, 1 + rng() % dense.NumLabels());
+    }
+    fst::ArcIterator<FstType> aiter(dict, state);
+    aiter.Seek(rng() % dict.NumArcs(state));
+    queries.emplace_back(state, aiter.Value().ilabel);
+    state = aiter.Value().nextstate;
+  }
+
+  fst::SortedMatcher<FstType> matcher(dict, fst::MATCH_INPUT);
+  time_lookups("ConstFst SortedMatcher", queries, [&](int s, int label) {
+    matcher.SetState(s);
+    return matcher.Find(label) ? matcher.Value().nextstate : -1;
+  });
+  time_lookups("ConstFst binary search", queries, [&](int s, int label) {
+    fst::ArcIterator<FstType> aiter(dict, s);
+    size_t low = 0;
+    size_t high = dict.NumArcs(s);
+    while (low < high) {
+      size_t mid = low + (high - low) / 2;
+      aiter.Seek(mid);
+      if (aiter.Value().ilabel < label) {
+        low = mid + 1;
+      } else if (aiter.Value().ilabel > label) {
+        high = mid;
+      } else {
+        return aiter.Value().nextstate;
+      }
+    }
+    return -1;
+  });
+  time_lookups("DenseDictionary", queries, [&](int s, int label) {
+    return dense.Next(s, label);
+  });
+  printf("dense table: %d states x %d labels, %.1f MiB\n", dense.NumStates(),
+         dense.NumLabels(), dense.NumStates() * (dense.NumLabels() * 4.0 + 1) / (1 << 20));
+}
+
 int main(int argc, char** argv)
 {
   const char* kenlm_path    = argv[1];
@@ -28,6 +111,12 @@ int main(int argc, char** argv)
   }
   Scorer scorer;
   err = scorer.init(kenlm_path, alphabet);
+  if (err == 0) {
+    printf("scorer load time: %.3f ms\n", scorer.get_load_seconds() * 1e3);
+  }
+  if (err == 0 && argc > 4 && strcmp(argv[4], "--benchmark") == 0) {
+    benchmark_dictionary(scorer);
+  }
 #ifndef DEBUG
   return err;
 #else
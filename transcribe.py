@@ -18,7 +18,7 @@ from deepspeech_training.util.config import Config, initialize_globals
 from deepspeech_training.util.feeding import split_audio_file
 from deepspeech_training.util.flags import create_flags, FLAGS
 from deepspeech_training.util.logging import log_error, log_info, log_progress, create_progressbar
-from ds_ctcdecoder import ctc_beam_search_decoder_batch, Scorer
+from ds_ctcdecoder import DecoderExecutor, Scorer
 from multiprocessing import Process, cpu_count
 
 
@@ -36,6 +36,7 @@ def transcribe_file(audio_path, tlog_path):
         num_processes = cpu_count()
     except NotImplementedError:
         num_processes = 1
+    decoder = DecoderExecutor(num_processes)
     with AudioFile(audio_path, as_path=True) as wav_path:
         data_set = split_audio_file(wav_path,
                                     batch_size=FLAGS.batch_size,
@@ -59,9 +60,8 @@ def transcribe_file(audio_path, tlog_path):
                         session.run([batch_time_start, batch_time_end, transposed, batch_x_len])
                 except tf.errors.OutOfRangeError:
                     break
-                decoded = ctc_beam_search_decoder_batch(batch_logits, batch_lengths, Config.alphabet, FLAGS.beam_width,
-                                                        num_processes=num_processes,
-                                                        scorer=scorer)
+                decoded = decoder.decode_batch(batch_logits, batch_lengths, Config.alphabet, FLAGS.beam_width,
+                                               scorer=scorer)
                 decoded = list(d[0][1] for d in decoded)
                 transcripts.extend(zip(starts, ends, decoded))
             transcripts.sort(key=lambda t: t[0])